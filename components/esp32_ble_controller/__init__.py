@@ -5,8 +5,10 @@ import esphome.config_validation as cv
 from esphome.automation import LambdaAction
 from esphome.const import CONF_ID, CONF_TRIGGER_ID, CONF_FORMAT, CONF_ARGS
 from esphome import automation
-from esphome.core import coroutine, Lambda
+import esphome.final_validate as fv
+from esphome.core import coroutine, Lambda, CORE, ID
 from esphome.cpp_generator import MockObj
+from esphome.helpers import write_file_if_changed
 
 CODEOWNERS = ['@wifwucite']
 
@@ -23,21 +25,53 @@ CONF_BLE_SERVICE = "service"
 CONF_BLE_CHARACTERISTICS = "characteristics"
 CONF_BLE_CHARACTERISTIC = "characteristic"
 CONF_BLE_USE_2902 = "use_BLE2902"
+CONF_BLE_MIN_NOTIFY_INTERVAL = "min_notify_interval"
+CONF_BLE_NOTIFY_DELTA = "delta"
+CONF_BLE_ENCODING = "encoding"
+CONF_BLE_EXPONENT = "exponent"
+CONF_BLE_HISTORY = "history"
 CONF_EXPOSES_COMPONENT = "exposes"
 
 def validate_UUID(value):
-    # print("UUID«", value)
+    """Validates a 32-bit UUID (8 hex digits) or a 128-bit UUID (32 hex digits, hyphens are optional) and returns it as 128-bit UUID in canonical form"""
     value = cv.string(value)
-    # TASK improve the regex
-    if re.match(r'^[0-9a-fA-F\-]{8,36}$', value) is None:
+    digits = value.replace("-", "").lower()
+    if re.match(r'^[0-9a-f]{8}$', digits):
+        digits += "00001000800000805f9b34fb" # Bluetooth base UUID
+    elif re.match(r'^[0-9a-f]{32}$', digits) is None:
         raise cv.Invalid("valid UUID required")
-    return value
+    return "-".join([digits[0:8], digits[8:12], digits[12:16], digits[16:20], digits[20:32]])
+
+BLEValueEncoding = esp32_ble_controller_ns.enum("BLEValueEncoding", is_class = True)
+CONF_BLE_ENCODING_DEFAULT = 'default' # raw layout: float for sensors, 2-byte integer for binary states, UTF-8 string otherwise
+CONF_BLE_ENCODING_SINT16 = 'sint16' # fixed-point signed 16-bit integer with exponent (sensors only)
+CONF_BLE_ENCODING_SINT24 = 'sint24' # fixed-point signed 24-bit integer with exponent (sensors only)
+CONF_BLE_ENCODING_PACKED = 'packed' # compact binary struct (fans and lights)
+CONF_BLE_ENCODING_CHUNKED = 'chunked' # UTF-8 string notified in MTU-sized chunks (text sensors only)
+ENCODING_OPTIONS = {
+    CONF_BLE_ENCODING_DEFAULT: BLEValueEncoding.DEFAULT,
+    CONF_BLE_ENCODING_SINT16: BLEValueEncoding.SINT16,
+    CONF_BLE_ENCODING_SINT24: BLEValueEncoding.SINT24,
+    CONF_BLE_ENCODING_PACKED: BLEValueEncoding.PACKED_STRUCT,
+    CONF_BLE_ENCODING_CHUNKED: BLEValueEncoding.CHUNKED,
+}
 
-BLE_CHARACTERISTIC = cv.Schema({
+def validate_exponent_usage(config):
+    """Validates that an exponent is only given for fixed-point encodings."""
+    if CONF_BLE_EXPONENT in config and config[CONF_BLE_ENCODING] not in [CONF_BLE_ENCODING_SINT16, CONF_BLE_ENCODING_SINT24]:
+        raise cv.Invalid("'" + CONF_BLE_EXPONENT + "' requires encoding " + CONF_BLE_ENCODING_SINT16 + " or " + CONF_BLE_ENCODING_SINT24)
+    return config
+
+BLE_CHARACTERISTIC = cv.All(cv.Schema({
     cv.Required("characteristic"): validate_UUID,
     cv.GenerateID(CONF_EXPOSES_COMPONENT): cv.use_id(cg.EntityBase), # TASK validate that only supported EntityBase instances are referenced
     cv.Optional(CONF_BLE_USE_2902, default=True): cv.boolean,
-})
+    cv.Optional(CONF_BLE_MIN_NOTIFY_INTERVAL, default="0ms"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_BLE_NOTIFY_DELTA, default=0.0): cv.positive_float,
+    cv.Optional(CONF_BLE_ENCODING, default=CONF_BLE_ENCODING_DEFAULT): cv.enum(ENCODING_OPTIONS, lower=True),
+    cv.Optional(CONF_BLE_EXPONENT): cv.int_range(min=-10, max=10),
+    cv.Optional(CONF_BLE_HISTORY, default=0): cv.Any(cv.one_of(0), cv.int_range(min=2, max=65535)), # number of samples (sensors only)
+}), validate_exponent_usage)
 
 BLE_SERVICE = cv.Schema({
     cv.Required(CONF_BLE_SERVICE): validate_UUID,
@@ -51,7 +85,8 @@ CONF_BLE_CMD_DESCRIPTION = "description"
 CONF_BLE_CMD_ON_EXECUTE = "on_execute"
 BLEControllerCustomCommandExecutionTrigger = esp32_ble_controller_ns.class_('BLEControllerCustomCommandExecutionTrigger', automation.Trigger.template())
 
-BUILTIN_CMD_IDS = ['help', 'ble-services', 'wifi-config', 'pairings', 'version', 'log-level']
+# names of the built-in commands (see the BLECommand subclasses in ble_command.cpp), custom commands with these names would be shadowed
+BUILTIN_CMD_IDS = ['help', 'ble-maintenance', 'ble-services', 'ble-profile', 'wifi-config', 'wifi-scan', 'pairings', 'version', 'stats', 'heap', 'log-level']
 CMD_ID_CHARACTERS = "abcdefghijklmnopqrstuvwxyz0123456789-"
 def validate_command_id(value):
     """Validate that this value is a valid command id.
@@ -75,8 +110,111 @@ BLE_COMMAND = cv.Schema({
 # BLE maintenance services #####
 CONF_EXPOSE_MAINTENANCE_SERVICE = "maintenance"
 
+CONF_CHUNKED_COMMAND_RESULTS = "chunked_command_results"
+CONF_EXPOSE_DIAGNOSTICS = "diagnostics"
+CONF_EXPOSE_SNAPSHOT = "snapshot"
+CONF_EXPOSE_OTA = "ota"
+CONF_EXPOSE_BATCH = "batch"
+
+# BLE host stack #####
+CONF_STACK = "stack"
+# host stacks with a backend of the stack layer (see ble_stack.h) and their defines
+BLE_STACKS = {
+    'bluedroid': "USE_BLE_CONTROLLER_STACK_BLUEDROID",
+}
+
+# MTU #####
+CONF_MTU = "mtu"
+
+# connections #####
+CONF_MAX_CONNECTIONS = "max_connections"
+
+# idle dormancy #####
+CONF_IDLE_TIMEOUT = "idle_timeout"
+CONF_RELEASE_BT_MEMORY_WHEN_OFF = "release_bt_memory_when_off"
+# other components that use the Bluetooth controller, its memory must not be released if one of them is configured
+OTHER_BLUETOOTH_COMPONENTS = ['esp32_ble', 'esp32_ble_tracker', 'esp32_ble_beacon', 'esp32_ble_server', 'ble_client', 'bluetooth_proxy', 'esp32_improv']
+
+# queues of the functions deferred from the BLE task to the main loop #####
+CONF_DEFERRED_QUEUES = "deferred_queues"
+CONF_QUEUE_EVENTS = "events"
+CONF_QUEUE_SUBSCRIPTIONS = "subscriptions"
+CONF_QUEUE_COMMANDS = "commands"
+CONF_QUEUE_COMPONENT_WRITES = "component_writes"
+
+# notification task #####
+CONF_NOTIFY_TASK = "notify_task"
+CONF_NOTIFY_TASK_CORE = "core"
+CONF_NOTIFY_TASK_PRIORITY = "priority"
+CONF_NOTIFY_TASK_QUEUE_DEPTH = "queue_depth"
+
+NOTIFY_TASK = cv.Schema({
+    cv.Optional(CONF_NOTIFY_TASK_CORE, default=0): cv.int_range(min=0, max=1), # core of the BLE stack by default
+    cv.Optional(CONF_NOTIFY_TASK_PRIORITY, default=5): cv.int_range(min=1, max=24),
+    cv.Optional(CONF_NOTIFY_TASK_QUEUE_DEPTH, default=32): cv.int_range(min=4, max=255),
+})
+
+# maximum number of events a connection defers (see BLE_CONTROLLER_EVENTS_PER_CONNECTION)
+EVENTS_PER_CONNECTION = 8
+
+DEFERRED_QUEUES = cv.Schema({
+    cv.Optional(CONF_QUEUE_EVENTS): cv.int_range(min=2 * EVENTS_PER_CONNECTION, max=255), # default depends on max_connections
+    cv.Optional(CONF_QUEUE_SUBSCRIPTIONS, default=16): cv.int_range(min=2, max=255),
+    cv.Optional(CONF_QUEUE_COMMANDS, default=8): cv.int_range(min=2, max=255),
+    cv.Optional(CONF_QUEUE_COMPONENT_WRITES, default=16): cv.int_range(min=2, max=255),
+})
+
+# advertising and connection parameter profiles #####
+CONF_CONNECTION_PROFILE = "connection_profile"
+CONF_CONNECTION_PROFILES = "connection_profiles"
+CONF_PROFILE_NAME = "name"
+CONF_MIN_ADVERTISING_INTERVAL = "min_advertising_interval"
+CONF_MAX_ADVERTISING_INTERVAL = "max_advertising_interval"
+CONF_MIN_CONNECTION_INTERVAL = "min_connection_interval"
+CONF_MAX_CONNECTION_INTERVAL = "max_connection_interval"
+CONF_SLAVE_LATENCY = "slave_latency"
+CONF_SUPERVISION_TIMEOUT = "supervision_timeout"
+
+# built-in profiles (in microseconds, except for the slave latency), can be overridden by profiles with the same name
+BUILT_IN_CONNECTION_PROFILES = {
+    "low_latency": (20000, 40000, 7500, 15000, 0, 2000000),
+    "balanced": (100000, 200000, 30000, 50000, 0, 4000000),
+    "low_power": (1000000, 1280000, 100000, 200000, 4, 6000000),
+}
+
+def validate_connection_profile(config):
+    """Validates that the intervals are ordered and the supervision timeout is long enough for the slave latency."""
+    if config[CONF_MIN_ADVERTISING_INTERVAL].total_microseconds > config[CONF_MAX_ADVERTISING_INTERVAL].total_microseconds:
+        raise cv.Invalid("'" + CONF_MIN_ADVERTISING_INTERVAL + "' must not exceed '" + CONF_MAX_ADVERTISING_INTERVAL + "'")
+    max_connection_interval = config[CONF_MAX_CONNECTION_INTERVAL].total_microseconds
+    if config[CONF_MIN_CONNECTION_INTERVAL].total_microseconds > max_connection_interval:
+        raise cv.Invalid("'" + CONF_MIN_CONNECTION_INTERVAL + "' must not exceed '" + CONF_MAX_CONNECTION_INTERVAL + "'")
+    if config[CONF_SUPERVISION_TIMEOUT].total_microseconds <= (1 + config[CONF_SLAVE_LATENCY]) * max_connection_interval * 2:
+        raise cv.Invalid("'" + CONF_SUPERVISION_TIMEOUT + "' must exceed (1 + " + CONF_SLAVE_LATENCY + ") * " + CONF_MAX_CONNECTION_INTERVAL + " * 2")
+    return config
+
+BLE_CONNECTION_PROFILE = cv.All(cv.Schema({
+    cv.Required(CONF_PROFILE_NAME): cv.string_strict,
+    cv.Required(CONF_MIN_ADVERTISING_INTERVAL): cv.All(cv.positive_time_period_microseconds, cv.Range(min=cv.TimePeriod(milliseconds=20), max=cv.TimePeriod(milliseconds=10240))),
+    cv.Required(CONF_MAX_ADVERTISING_INTERVAL): cv.All(cv.positive_time_period_microseconds, cv.Range(min=cv.TimePeriod(milliseconds=20), max=cv.TimePeriod(milliseconds=10240))),
+    cv.Required(CONF_MIN_CONNECTION_INTERVAL): cv.All(cv.positive_time_period_microseconds, cv.Range(min=cv.TimePeriod(microseconds=7500), max=cv.TimePeriod(milliseconds=4000))),
+    cv.Required(CONF_MAX_CONNECTION_INTERVAL): cv.All(cv.positive_time_period_microseconds, cv.Range(min=cv.TimePeriod(microseconds=7500), max=cv.TimePeriod(milliseconds=4000))),
+    cv.Optional(CONF_SLAVE_LATENCY, default=0): cv.int_range(min=0, max=499),
+    cv.Required(CONF_SUPERVISION_TIMEOUT): cv.All(cv.positive_time_period_microseconds, cv.Range(min=cv.TimePeriod(milliseconds=100), max=cv.TimePeriod(milliseconds=32000))),
+}), validate_connection_profile)
+
+def connection_profile_available(config):
+    """Validates that the selected connection profile is either built-in or defined in the configuration."""
+    if CONF_CONNECTION_PROFILE in config:
+        name = config[CONF_CONNECTION_PROFILE]
+        names = list(BUILT_IN_CONNECTION_PROFILES) + [profile[CONF_PROFILE_NAME] for profile in config.get(CONF_CONNECTION_PROFILES, [])]
+        if name not in names:
+            raise cv.Invalid("Unknown " + CONF_CONNECTION_PROFILE + " '" + name + "', available: " + ", ".join(names))
+    return config
+
 # security mode enumeration #####
 CONF_SECURITY_MODE = 'security_mode'
+CONF_ACCEPT_LIST_ONLY = 'accept_list_only'
 BLESecurityMode = esp32_ble_controller_ns.enum("BLESecurityMode", is_class = True)
 CONF_SECURITY_MODE_NONE = 'none' # no security, no bonding
 CONF_SECURITY_MODE_BOND = 'bond' # no secure connection, no man-in-the-middle protection, just bonding (pairing)
@@ -100,9 +238,16 @@ def forbid_config_setting_for_automation(automation_id, setting_key, forbidden_s
         raise cv.Invalid("Automation '" + automation_id + "' not available if " + setting_key + " = " + forbidden_setting_value)
 
 def automations_available(config):
-    """Validates that the security related automations are only present if the security mode is not none."""
+    """Validates that the security related automations (and the accept list) are only present if the security mode is not none."""
     forbid_config_setting_for_automation(CONF_ON_SHOW_PASS_KEY, CONF_SECURITY_MODE, CONF_SECURITY_MODE_NONE, config)
     forbid_config_setting_for_automation(CONF_ON_AUTHENTICATION_COMPLETE, CONF_SECURITY_MODE, CONF_SECURITY_MODE_NONE, config)
+    if config[CONF_ACCEPT_LIST_ONLY] and config[CONF_SECURITY_MODE] == CONF_SECURITY_MODE_NONE:
+        raise cv.Invalid("'" + CONF_ACCEPT_LIST_ONLY + "' not available if " + CONF_SECURITY_MODE + " = " + CONF_SECURITY_MODE_NONE)
+    # The image is only checked against the hash the client sends, so only bonded clients with MITM protection may update the firmware.
+    if config[CONF_EXPOSE_OTA] and config[CONF_SECURITY_MODE] != CONF_SECURITY_MODE_SECURE:
+        raise cv.Invalid("'" + CONF_EXPOSE_OTA + "' requires " + CONF_SECURITY_MODE + " = " + CONF_SECURITY_MODE_SECURE)
+    if config[CONF_EXPOSE_OTA] and not config[CONF_EXPOSE_MAINTENANCE_SERVICE]:
+        raise cv.Invalid("'" + CONF_EXPOSE_OTA + "' requires the " + CONF_EXPOSE_MAINTENANCE_SERVICE + " service")
     return config
 
 def require_automation_for_config_setting(automation_id, setting_key, requiring_setting_value, config):
@@ -130,8 +275,25 @@ CONFIG_SCHEMA = cv.All(cv.only_on_esp32, cv.only_with_arduino, cv.Schema({
     cv.Optional(CONF_BLE_COMMANDS): cv.ensure_list(BLE_COMMAND),
 
     cv.Optional(CONF_EXPOSE_MAINTENANCE_SERVICE, default=True): cv.boolean,
+    cv.Optional(CONF_CHUNKED_COMMAND_RESULTS, default=False): cv.boolean,
+    cv.Optional(CONF_EXPOSE_DIAGNOSTICS, default=False): cv.boolean,
+    cv.Optional(CONF_EXPOSE_SNAPSHOT, default=False): cv.boolean,
+    cv.Optional(CONF_EXPOSE_OTA, default=False): cv.boolean,
+    cv.Optional(CONF_EXPOSE_BATCH, default=False): cv.boolean,
+
+    cv.Optional(CONF_STACK, default='bluedroid'): cv.one_of(*BLE_STACKS, lower=True),
+    cv.Optional(CONF_MTU, default=517): cv.int_range(min=23, max=517),
+    cv.Optional(CONF_MAX_CONNECTIONS, default=1): cv.int_range(min=1, max=9),
+    cv.Optional(CONF_IDLE_TIMEOUT, default="0s"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_RELEASE_BT_MEMORY_WHEN_OFF, default=False): cv.boolean,
+    cv.Optional(CONF_DEFERRED_QUEUES, default={}): DEFERRED_QUEUES,
+    cv.Optional(CONF_NOTIFY_TASK): NOTIFY_TASK,
+
+    cv.Optional(CONF_CONNECTION_PROFILES): cv.ensure_list(BLE_CONNECTION_PROFILE),
+    cv.Optional(CONF_CONNECTION_PROFILE): cv.string_strict,
 
     cv.Optional(CONF_SECURITY_MODE, default=CONF_SECURITY_MODE_SECURE): cv.enum(SECURTY_MODE_OPTIONS),
+    cv.Optional(CONF_ACCEPT_LIST_ONLY, default=False): cv.boolean,
 
     cv.Optional(CONF_ON_SHOW_PASS_KEY): automation.validate_automation({
         cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(BLEControllerShowPassKeyTrigger),
@@ -147,10 +309,74 @@ CONFIG_SCHEMA = cv.All(cv.only_on_esp32, cv.only_with_arduino, cv.Schema({
         cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(BLEControllerServerDisconnectedTrigger),
     }),
 
-    }), automations_available, required_automations_present)
+    }), automations_available, required_automations_present, connection_profile_available, events_queue_large_enough)
+
+def get_events_queue_capacity(config):
+    """Returns the capacity of the events queue that holds all events of the allowed connections plus one rejected connection."""
+    return EVENTS_PER_CONNECTION * (config[CONF_MAX_CONNECTIONS] + 1)
+
+def events_queue_large_enough(config):
+    """Validates that the events queue cannot overflow (events are never dropped), and sets its default."""
+    deferred_queues = config[CONF_DEFERRED_QUEUES]
+    minimum = get_events_queue_capacity(config)
+    if CONF_QUEUE_EVENTS not in deferred_queues:
+        deferred_queues[CONF_QUEUE_EVENTS] = minimum
+    elif deferred_queues[CONF_QUEUE_EVENTS] < minimum:
+        raise cv.Invalid(f"The events queue needs at least {minimum} entries for {config[CONF_MAX_CONNECTIONS]} connection(s)", [CONF_DEFERRED_QUEUES, CONF_QUEUE_EVENTS])
+    return config
+
+def validate_bluetooth_memory_release(config):
+    """Validates that the memory of the Bluetooth controller is only released if no other component uses Bluetooth."""
+    if config[CONF_RELEASE_BT_MEMORY_WHEN_OFF]:
+        full_config = fv.full_config.get()
+        users = [component for component in OTHER_BLUETOOTH_COMPONENTS if component in full_config]
+        if users:
+            raise cv.Invalid("'" + CONF_RELEASE_BT_MEMORY_WHEN_OFF + "' not available together with " + ", ".join(users) + " (which use Bluetooth as well)")
+    return config
+
+# lights always use the packed struct, 'packed' only adds the presentation format descriptor (see BLELightHandler)
+LIGHT_ENCODINGS = [CONF_BLE_ENCODING_DEFAULT, CONF_BLE_ENCODING_PACKED]
+
+def validate_light_encodings(config):
+    """Validates that exposed lights do not ask for an encoding other than the packed struct (there is no other encoding for lights)."""
+    full_config = fv.full_config.get()
+    for service in config.get(CONF_BLE_SERVICES, []):
+        for characteristic in service[CONF_BLE_CHARACTERISTICS]:
+            path = full_config.get_path_for_id(characteristic[CONF_EXPOSES_COMPONENT])
+            if path[0] == "light" and characteristic[CONF_BLE_ENCODING] not in LIGHT_ENCODINGS:
+                raise cv.Invalid("Light " + str(characteristic[CONF_EXPOSES_COMPONENT]) + " only supports encoding " + " or ".join(LIGHT_ENCODINGS))
+    return config
+
+def validate_history_usage(config):
+    """Validates that only sensors keep a history (the other components have no numeric samples to record)."""
+    full_config = fv.full_config.get()
+    for service in config.get(CONF_BLE_SERVICES, []):
+        for characteristic in service[CONF_BLE_CHARACTERISTICS]:
+            path = full_config.get_path_for_id(characteristic[CONF_EXPOSES_COMPONENT])
+            if path[0] != "sensor" and characteristic[CONF_BLE_HISTORY] > 0:
+                raise cv.Invalid("'" + CONF_BLE_HISTORY + "' is only available for sensors, not for " + path[0] + " " + str(characteristic[CONF_EXPOSES_COMPONENT]))
+    return config
+
+def final_validate(config):
+    """Validates the parts of the configuration that depend on other components."""
+    validate_bluetooth_memory_release(config)
+    validate_light_encodings(config)
+    validate_history_usage(config)
+    return config
+
+FINAL_VALIDATE_SCHEMA = final_validate
 
 ### Code generation ############################################################################################
 
+def uuid_constant(uuid):
+    """Returns the 128-bit constant (in flash) for the given validated UUID, its bytes are ordered least significant first like in the BLE stack"""
+    constants = CORE.data.setdefault("esp32_ble_controller_uuids", {})
+    if uuid not in constants:
+        uuid_bytes = reversed(bytes.fromhex(uuid.replace("-", "")))
+        constant_id = ID("esp32_ble_controller_uuid_" + uuid.replace("-", "_"), is_declaration=True, type=cg.uint8)
+        constants[uuid] = cg.static_const_array(constant_id, cg.ArrayInitializer(*uuid_bytes))
+    return constants[uuid]
+
 @coroutine
 def to_code_characteristic(ble_controller_var, service_uuid, characteristic_description):
     """Coroutine that registers the given characteristic of the given service with BLE controller, 
@@ -159,8 +385,32 @@ def to_code_characteristic(ble_controller_var, service_uuid, characteristic_desc
     component_id = characteristic_description[CONF_EXPOSES_COMPONENT]
     component = yield cg.get_variable(component_id)
     use_BLE2902 = characteristic_description[CONF_BLE_USE_2902]
-    cg.add(ble_controller_var.register_component(component, service_uuid, characteristic_uuid, use_BLE2902))
+    min_notify_interval = characteristic_description[CONF_BLE_MIN_NOTIFY_INTERVAL].total_milliseconds
+    notify_delta = characteristic_description[CONF_BLE_NOTIFY_DELTA]
+    encoding = characteristic_description[CONF_BLE_ENCODING]
+    exponent = characteristic_description.get(CONF_BLE_EXPONENT, 0)
+    history_size = characteristic_description[CONF_BLE_HISTORY]
+    cg.add(ble_controller_var.register_component(component, uuid_constant(service_uuid), uuid_constant(characteristic_uuid), use_BLE2902, min_notify_interval, notify_delta, encoding, exponent, history_size))
     
+def get_num_handles(characteristic_description):
+    """Returns the number of attribute handles of the given characteristic: declaration, value, 0x2901 descriptor, and possibly 0x2902 and 0x2904 descriptors"""
+    num_handles = 3
+    if characteristic_description[CONF_BLE_USE_2902]:
+        num_handles += 1
+    if characteristic_description[CONF_BLE_ENCODING] not in [CONF_BLE_ENCODING_DEFAULT, CONF_BLE_ENCODING_CHUNKED]:
+        num_handles += 1
+    return num_handles
+
+def to_code_service_layouts(ble_controller_var, services):
+    """Registers each service UUID with the number of handles required by all its characteristics (a UUID may be used by several service entries)"""
+    num_handles_per_service = {}
+    for service in services:
+        service_uuid = service[CONF_BLE_SERVICE]
+        num_handles = sum(get_num_handles(characteristic) for characteristic in service[CONF_BLE_CHARACTERISTICS])
+        num_handles_per_service[service_uuid] = num_handles_per_service.get(service_uuid, 1) + num_handles
+    for service_uuid, num_handles in num_handles_per_service.items():
+        cg.add(ble_controller_var.register_service(uuid_constant(service_uuid), num_handles))
+
 @coroutine
 def to_code_service(ble_controller_var, service):
     """Coroutine that registers all characteristics of the given service with BLE controller"""
@@ -169,6 +419,35 @@ def to_code_service(ble_controller_var, service):
     for characteristic_description in characteristics:
         yield to_code_characteristic(ble_controller_var, service_uuid, characteristic_description)
 
+# header for clients with the index of each component, written to the build directory
+COMPONENT_INDICES_HEADER = "esp32_ble_controller_indices.h"
+
+def write_component_indices_header(services):
+    """Writes a header with the index of each exposed component (its registration order, as used by the snapshot, history and batch characteristics) for clients"""
+    lines = ["// Generated by the esp32_ble_controller component from the yaml configuration, do not edit.",
+             "// Index of each exposed component in the snapshot, history download and batch control characteristics.",
+             "#pragma once", ""]
+    index = 0
+    for service in services:
+        for characteristic in service[CONF_BLE_CHARACTERISTICS]:
+            component_id = str(characteristic[CONF_EXPOSES_COMPONENT].id)
+            lines.append(f"#define BLE_CONTROLLER_INDEX_{re.sub(r'[^A-Za-z0-9]', '_', component_id).upper()} {index} // characteristic {characteristic[CONF_BLE_CHARACTERISTIC]}")
+            index += 1
+    write_file_if_changed(CORE.relative_build_path(COMPONENT_INDICES_HEADER), "\n".join(lines) + "\n")
+
+def to_code_connection_profiles(ble_controller_var, config):
+    """Registers the built-in connection profiles and those from the configuration (converted to the units of the BLE specification) with the BLE controller"""
+    profiles = dict(BUILT_IN_CONNECTION_PROFILES)
+    for profile in config.get(CONF_CONNECTION_PROFILES, []):
+        profiles[profile[CONF_PROFILE_NAME]] = (profile[CONF_MIN_ADVERTISING_INTERVAL].total_microseconds, profile[CONF_MAX_ADVERTISING_INTERVAL].total_microseconds,
+                                                profile[CONF_MIN_CONNECTION_INTERVAL].total_microseconds, profile[CONF_MAX_CONNECTION_INTERVAL].total_microseconds,
+                                                profile[CONF_SLAVE_LATENCY], profile[CONF_SUPERVISION_TIMEOUT].total_microseconds)
+    for name, (min_adv, max_adv, min_conn, max_conn, latency, timeout) in profiles.items():
+        cg.add(ble_controller_var.add_connection_profile(name, round(min_adv / 625), round(max_adv / 625), round(min_conn / 1250), round(max_conn / 1250), latency, round(timeout / 10000)))
+
+    if CONF_CONNECTION_PROFILE in config:
+        cg.add(ble_controller_var.set_connection_profile(config[CONF_CONNECTION_PROFILE]))
+
 @coroutine
 def to_code_command(ble_controller_var, cmd):
     """Coroutine that registers all BLE commands with BLE controller"""
@@ -184,6 +463,13 @@ def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     yield cg.register_component(var, config)
 
+    # the arena for the handlers, descriptors and custom commands is sized for these numbers (see BLEObjectArena)
+    cg.add_define(BLE_STACKS[config[CONF_STACK]])
+    cg.add_define("BLE_CONTROLLER_NUM_CHARACTERISTICS", sum(len(service[CONF_BLE_CHARACTERISTICS]) for service in config.get(CONF_BLE_SERVICES, [])))
+    cg.add_define("BLE_CONTROLLER_NUM_CUSTOM_COMMANDS", len(config.get(CONF_BLE_COMMANDS, [])))
+
+    to_code_service_layouts(var, config.get(CONF_BLE_SERVICES, []))
+    write_component_indices_header(config.get(CONF_BLE_SERVICES, []))
     for cmd in config.get(CONF_BLE_SERVICES, []):
         yield to_code_service(var, cmd)
 
@@ -191,9 +477,36 @@ def to_code(config):
         yield to_code_command(var, cmd)
 
     cg.add(var.set_maintenance_service_exposed_after_flash(config[CONF_EXPOSE_MAINTENANCE_SERVICE]))
+    cg.add(var.set_chunked_command_results(config[CONF_CHUNKED_COMMAND_RESULTS]))
+    cg.add(var.set_diagnostics_characteristic_exposed(config[CONF_EXPOSE_DIAGNOSTICS]))
+    cg.add(var.set_snapshot_characteristic_exposed(config[CONF_EXPOSE_SNAPSHOT]))
+    cg.add(var.set_batch_characteristic_exposed(config[CONF_EXPOSE_BATCH]))
+    if config[CONF_EXPOSE_OTA]:
+        cg.add_define("USE_BLE_CONTROLLER_OTA")
+
+    cg.add(var.set_mtu(config[CONF_MTU]))
+    cg.add(var.set_max_connections(config[CONF_MAX_CONNECTIONS]))
+    cg.add(var.set_idle_timeout(config[CONF_IDLE_TIMEOUT].total_milliseconds))
+    cg.add(var.set_release_bt_memory_when_off(config[CONF_RELEASE_BT_MEMORY_WHEN_OFF]))
+
+    deferred_queues = config[CONF_DEFERRED_QUEUES]
+    cg.add_define("BLE_CONTROLLER_EVENTS_QUEUE_CAPACITY", deferred_queues[CONF_QUEUE_EVENTS])
+    cg.add_define("BLE_CONTROLLER_SUBSCRIPTIONS_QUEUE_CAPACITY", deferred_queues[CONF_QUEUE_SUBSCRIPTIONS])
+    cg.add_define("BLE_CONTROLLER_COMMANDS_QUEUE_CAPACITY", deferred_queues[CONF_QUEUE_COMMANDS])
+    cg.add_define("BLE_CONTROLLER_COMPONENT_WRITES_QUEUE_CAPACITY", deferred_queues[CONF_QUEUE_COMPONENT_WRITES])
+
+    if CONF_NOTIFY_TASK in config:
+        notify_task = config[CONF_NOTIFY_TASK]
+        cg.add_define("USE_BLE_CONTROLLER_NOTIFY_TASK")
+        cg.add_define("BLE_CONTROLLER_NOTIFY_TASK_CORE", notify_task[CONF_NOTIFY_TASK_CORE])
+        cg.add_define("BLE_CONTROLLER_NOTIFY_TASK_PRIORITY", notify_task[CONF_NOTIFY_TASK_PRIORITY])
+        cg.add_define("BLE_CONTROLLER_NOTIFY_QUEUE_DEPTH", notify_task[CONF_NOTIFY_TASK_QUEUE_DEPTH])
+
+    to_code_connection_profiles(var, config)
 
     security_enabled = SECURTY_MODE_OPTIONS[config[CONF_SECURITY_MODE]]
     cg.add(var.set_security_mode(config[CONF_SECURITY_MODE]))
+    cg.add(var.set_accept_list_only(config[CONF_ACCEPT_LIST_ONLY]))
 
     for conf in config.get(CONF_ON_SHOW_PASS_KEY, []):
         trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
@@ -282,3 +595,12 @@ BLE_MAINTENANCE_ACTION_SCHEMA = cv.Schema({}) # no arguments required
 async def ble_maintenance_toggle_to_code(config, action_id, template_arg, args):
     print(config, action_id, template_arg, args)
     return cg.new_Pvariable(action_id, template_arg)
+
+
+### Automation action: esp32_ble_controller.wake ###
+
+WakeAction = esp32_ble_controller_ns.class_("WakeAction", automation.Action)
+
+@automation.register_action("esp32_ble_controller.wake", WakeAction, cv.Schema({}))
+async def esp32_ble_controller_wake_to_code(config, action_id, template_arg, args):
+    return cg.new_Pvariable(action_id, template_arg)
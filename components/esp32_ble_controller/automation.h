@@ -89,5 +89,12 @@ public:
   }
 };
 
+// action for idle dormancy ////////////////////////////////////////////////////////////////////////////////////////////
+
+template<typename... Ts> class WakeAction : public Action<Ts...> {
+public:
+  void play(Ts... x) override { global_ble_controller->wake(); }
+};
+
 } // namespace esp32_ble_controller
 } // namespace esphome
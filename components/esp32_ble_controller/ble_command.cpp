@@ -18,14 +18,14 @@ void BLECommand::set_result(const string& result) const {
 }
 
 string BLECommand::get_command_specific_help() const {
-  return get_description();
+  return string(get_description());
 }
 
 // help ///////////////////////////////////////////////////////////////////////////////////////////////
 
 BLECommandHelp::BLECommandHelp() : BLECommand("help", "shows help for commands.") {}
 
-void BLECommandHelp::execute(const vector<string>& arguments) const {
+void BLECommandHelp::execute(const BLECommandArguments& arguments) const {
   if (arguments.empty()) {
     string help("Availabe:");
     for (const auto& command : global_ble_controller->get_commands()) {
@@ -35,12 +35,11 @@ void BLECommandHelp::execute(const vector<string>& arguments) const {
     help += ", 'help <cmd>' for more.";
     set_result(help);
   } else {
-    string command_name = arguments[0];
-    for (const auto& command : global_ble_controller->get_commands()) {
-      if (command->get_name() == command_name) {
-        set_result(command_name + ": " + command->get_command_specific_help());
-        return;
-      }
+    const string command_name(arguments[0]);
+    const BLECommand* command = global_ble_controller->find_command(command_name);
+    if (command != nullptr) {
+      set_result(command_name + ": " + command->get_command_specific_help());
+    } else {
       set_result("Unknown BLE command '" + command_name + "'");
     }
   }
@@ -50,40 +49,79 @@ void BLECommandHelp::execute(const vector<string>& arguments) const {
 
 BLECommandSwitchMaintenanceOnOrOff::BLECommandSwitchMaintenanceOnOrOff() : BLECommand("ble-maintenance", "'ble-maintenance off' disables the maintenance BLE service.") {}
 
-void BLECommandSwitchMaintenanceOnOrOff::execute(const vector<string>& arguments) const {
+void BLECommandSwitchMaintenanceOnOrOff::execute(const BLECommandArguments& arguments) const {
   if (!arguments.empty()) {
-    const string& on_or_off = arguments[0];
+    const string_view& on_or_off = arguments[0];
     global_ble_controller->switch_maintenance_service_exposed(on_or_off != "off");
   }
-  string enabled_or_disabled = global_ble_controller->get_component_services_exposed() ? "disabled" : "enabled";
-  set_result("Maintenance services is " + enabled_or_disabled +".");
+  string enabled_or_disabled = global_ble_controller->get_maintenance_service_exposed() ? "enabled" : "disabled";
+  set_result("Maintenance service is " + enabled_or_disabled +".");
 }
 
 // ble-services ///////////////////////////////////////////////////////////////////////////////////////////////
 
 BLECommandSwitchComponentServicesOnOrOff::BLECommandSwitchComponentServicesOnOrOff() : BLECommand("ble-services", "'ble-services on|off' enables or disables the non-maintenance BLE services.") {}
 
-void BLECommandSwitchComponentServicesOnOrOff::execute(const vector<string>& arguments) const {
+void BLECommandSwitchComponentServicesOnOrOff::execute(const BLECommandArguments& arguments) const {
   if (!arguments.empty()) {
-    const string& on_or_off = arguments[0];
+    const string_view& on_or_off = arguments[0];
     global_ble_controller->switch_component_services_exposed(on_or_off != "off");
   }
-  string enabled_or_disabled = global_ble_controller->get_component_services_exposed() ? "disabled" : "enabled";
+  string enabled_or_disabled = global_ble_controller->get_component_services_exposed() ? "enabled" : "disabled";
   set_result("Non-maintenance services are " + enabled_or_disabled +".");
 }
 
+// ble-profile ///////////////////////////////////////////////////////////////////////////////////////////////
+
+BLECommandConnectionProfile::BLECommandConnectionProfile() : BLECommand("ble-profile", "gets or sets the advertising and connection parameter profile.") {}
+
+void BLECommandConnectionProfile::execute(const BLECommandArguments& arguments) const {
+  if (!arguments.empty()) {
+    const string name(arguments[0]);
+    if (!global_ble_controller->set_connection_profile(name)) {
+      set_result("Unknown profile '" + name + "'.");
+      return;
+    }
+  }
+
+  const BLEConnectionProfile* profile = global_ble_controller->get_connection_profile();
+  if (profile != nullptr) {
+    set_result("Profile is " + profile->name + ".");
+  } else {
+    set_result("No profile, BLE defaults used.");
+  }
+}
+
+string BLECommandConnectionProfile::get_command_specific_help() const {
+  string help("'ble-profile <name>' switches to one of:");
+  for (const auto& profile : global_ble_controller->get_connection_profiles()) {
+    help += ' ';
+    help += profile.name;
+  }
+  return help + " (until reboot).";
+}
+
 // wifi-config ///////////////////////////////////////////////////////////////////////////////////////////////
 
 #ifdef USE_WIFI
 BLECommandWifiConfiguration::BLECommandWifiConfiguration() : BLECommand("wifi-config", "sets or clears the WIFI configuration") {}
 
-void BLECommandWifiConfiguration::execute(const vector<string>& arguments) const {
-  if (arguments.size() >= 2 && arguments.size() <= 3) {
-    const string& ssid = arguments[0];
-    const string& password = arguments[1];
-    const bool hidden_network = arguments.size() == 3 && arguments[2] == "hidden";
-    global_ble_controller->set_wifi_configuration(ssid, password, hidden_network);
-    set_result("WIFI configuration updated.");
+void BLECommandWifiConfiguration::execute(const BLECommandArguments& arguments) const {
+  const bool test = arguments.size() >= 3 && arguments[arguments.size() - 1] == "test";
+  const size_t option_count = arguments.size() - (test ? 1 : 0);
+  if (option_count >= 2 && option_count <= 3) {
+    const string ssid(arguments[0]);
+    const string password(arguments[1]);
+    const bool hidden_network = option_count == 3 && arguments[2] == "hidden";
+    if (!test) {
+      global_ble_controller->set_wifi_configuration(ssid, password, hidden_network);
+      set_result("WIFI configuration updated.");
+    } else if (global_ble_controller->is_testing_wifi_configuration()) {
+      set_result("WIFI test already running.");
+    } else {
+      set_result("WIFI test started for network " + ssid + ".");
+      global_ble_controller->test_wifi_configuration(ssid, password, hidden_network);
+    }
   } else if (arguments.size() == 1 && arguments[0] == "clear") {
     set_result("WIFI configuration cleared.");
     global_ble_controller->clear_wifi_configuration_and_reboot();
@@ -104,32 +142,45 @@ string BLECommandWifiConfiguration::get_command_specific_help() const {
     if (ssid.has_value()) {
       return "'wifi-config clear' clears the configuration and reverts to default WIFI configuration.";
     } else {
-      return "'wifi-config <ssid> <pwd> [hidden]' sets WIFI SSID and password and if the network is hidden.";
+      return "'wifi-config <ssid> <pwd> [hidden] [test]' sets WIFI SSID and password and if the network is hidden; with 'test' they are tried first and saved only once connected.";
     }
 }
+
+// wifi-scan ///////////////////////////////////////////////////////////////////////////////////////////////
+
+BLECommandWifiScan::BLECommandWifiScan() : BLECommand("wifi-scan", "scans for WIFI networks, sending the networks of each channel as soon as they are found and finally all of them sorted by RSSI") {}
+
+void BLECommandWifiScan::execute(const BLECommandArguments& arguments) const {
+  if (global_ble_controller->is_scanning_wifi()) {
+    set_result("WIFI scan already running.");
+    return;
+  }
+  set_result("WIFI scan started.");
+  global_ble_controller->start_wifi_scan();
+}
 #endif
 
 // pairings ///////////////////////////////////////////////////////////////////////////////////////////////
 
 BLECommandPairings::BLECommandPairings() : BLECommand("pairings", "'pairings [clear]' displays or clears the paired devices.") {}
 
-void BLECommandPairings::execute(const vector<string>& arguments) const {
+void BLECommandPairings::execute(const BLECommandArguments& arguments) const {
   if (!arguments.empty()) {
     if (arguments[0] == "clear") {
-      remove_all_bonded_devices();
+      global_ble_controller->remove_all_bonded_devices();
       set_result("Pairings cleared.");
       return;
     }
   }
   
-  vector<string> paired_devices = get_bonded_devices();
+  const auto& paired_devices = global_ble_controller->get_bonded_devices();
   if (paired_devices.empty()) {
     set_result("No paired devices.");
   } else {
     string paired_devices_listing = "Paired devices:";
-    for (const string& paired_device : paired_devices) {
+    for (const auto& paired_device : paired_devices) {
       paired_devices_listing += " ";
-      paired_devices_listing += paired_device;
+      paired_devices_listing += format_bd_address(paired_device.address.bytes);
     } 
     set_result(paired_devices_listing +".");
   }
@@ -139,19 +190,40 @@ void BLECommandPairings::execute(const vector<string>& arguments) const {
 
 BLECommandVersion::BLECommandVersion() : BLECommand("version", "displays the current version, i.e. compile time.") {}
 
-void BLECommandVersion::execute(const vector<string>& arguments) const {
+void BLECommandVersion::execute(const BLECommandArguments& arguments) const {
   set_result("Version: " + App.get_compilation_time());
 }
 
+// stats ///////////////////////////////////////////////////////////////////////////////////////////////
+
+BLECommandStatistics::BLECommandStatistics() : BLECommand("stats", "'stats [reset]' shows or resets the notification, queue and latency counters.") {}
+
+void BLECommandStatistics::execute(const BLECommandArguments& arguments) const {
+  if (!arguments.empty() && arguments[0] == "reset") {
+    global_ble_controller->reset_statistics();
+    set_result("Statistics reset.");
+    return;
+  }
+
+  set_result(global_ble_controller->get_statistics_report());
+}
+
+// heap ///////////////////////////////////////////////////////////////////////////////////////////////
+
+BLECommandHeap::BLECommandHeap() : BLECommand("heap", "displays the memory used by the BLE controller and the free heap.") {}
+
+void BLECommandHeap::execute(const BLECommandArguments& arguments) const {
+  set_result(global_ble_controller->get_heap_report());
+}
+
 // log-level ///////////////////////////////////////////////////////////////////////////////////////////////
 
 #ifdef USE_LOGGER
 BLECommandLogLevel::BLECommandLogLevel() : BLECommand("log-level", "gets or sets log level (0=None, 4=Config, 5=Debug).") {}
 
-void BLECommandLogLevel::execute(const vector<string>& arguments) const {
+void BLECommandLogLevel::execute(const BLECommandArguments& arguments) const {
   if (!arguments.empty()) {
-    string log_level = arguments[0];
-    const optional<int> level = parse_number<int>(log_level);
+    const optional<int> level = parse_number<int>(string(arguments[0]));
     if (level.has_value()) {
       global_ble_controller->set_log_level(level.value());
     }
@@ -163,12 +235,14 @@ void BLECommandLogLevel::execute(const vector<string>& arguments) const {
 
 // custom ///////////////////////////////////////////////////////////////////////////////////////////////
 
-BLECustomCommand::BLECustomCommand(const string& name, const string& description, BLEControllerCustomCommandExecutionTrigger* trigger)
+BLECustomCommand::BLECustomCommand(const char* name, const char* description, BLEControllerCustomCommandExecutionTrigger* trigger)
  : BLECommand(name, description), trigger(trigger) {}
 
-void BLECustomCommand::execute(const vector<string>& arguments) const {
+void BLECustomCommand::execute(const BLECommandArguments& arguments) const {
+  // Note: The automation expects the arguments as strings, so they are copied only here.
+  const vector<string> argument_strings(arguments.begin(), arguments.end());
   BLECustomCommandResultSender result_sender;
-  trigger->trigger(arguments, result_sender);
+  trigger->trigger(argument_strings, result_sender);
 }
 
 } // namespace esp32_ble_controller
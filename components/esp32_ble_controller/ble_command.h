@@ -1,11 +1,14 @@
 #pragma once
 
+#include <cstddef>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "esphome/core/defines.h"
 
 using std::string;
+using std::string_view;
 using std::vector;
 
 namespace esphome {
@@ -13,24 +16,44 @@ namespace esp32_ble_controller {
 
 // generic ///////////////////////////////////////////////////////////////////////////////////////////////
 
+/// Non-owning view of the arguments of a command, which point into the command line.
+class BLECommandArguments {
+public:
+  BLECommandArguments(const string_view* arguments, size_t size) : arguments(arguments), count(size) {}
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  const string_view& operator[](size_t index) const { return arguments[index]; }
+  const string_view* begin() const { return arguments; }
+  const string_view* end() const { return arguments + count; }
+
+private:
+  const string_view* arguments;
+  size_t count;
+};
+
 class BLECommand {
 public:
-  BLECommand(const string& name, const string& description) : name(name), description(description) {}
+  /// Creates a command with the given name and description, which must be null-terminated constants (e.g. string literals), so that commands need no heap memory.
+  BLECommand(const char* name, const char* description) : name(name), description(description) {}
   virtual ~BLECommand() {}
 
-  const string get_name() const { return name; }
-  const string get_description() const { return description; }
+  string_view get_name() const { return name; }
+  string_view get_description() const { return description; }
 
-  virtual void execute(const std::vector<string>& arguments) const = 0;
+  virtual void execute(const BLECommandArguments& arguments) const = 0;
 
   virtual string get_command_specific_help() const;
+
+  /// Returns true if the arguments may contain ';' (e.g. passwords), then the command takes the rest of its line instead of ending at the next ';'.
+  virtual bool takes_rest_of_line() const { return false; }
   
 protected:
   void set_result(const string& result) const;
 
 private:
-  string name;
-  string description;
+  const char* name;
+  const char* description;
 };
 
 // help ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -40,7 +63,7 @@ public:
   BLECommandHelp();
   virtual ~BLECommandHelp() {}
 
-  virtual void execute(const vector<string>& arguments) const override;
+  virtual void execute(const BLECommandArguments& arguments) const override;
 };
 
 // ble-maintenance ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -50,7 +73,7 @@ public:
   BLECommandSwitchMaintenanceOnOrOff();
   virtual ~BLECommandSwitchMaintenanceOnOrOff() {}
 
-  virtual void execute(const vector<string>& arguments) const override;
+  virtual void execute(const BLECommandArguments& arguments) const override;
 };
 
 // ble-services ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -60,7 +83,19 @@ public:
   BLECommandSwitchComponentServicesOnOrOff();
   virtual ~BLECommandSwitchComponentServicesOnOrOff() {}
 
-  virtual void execute(const vector<string>& arguments) const override;
+  virtual void execute(const BLECommandArguments& arguments) const override;
+};
+
+// ble-profile ///////////////////////////////////////////////////////////////////////////////////////////////
+
+class BLECommandConnectionProfile : public BLECommand {
+public:
+  BLECommandConnectionProfile();
+  virtual ~BLECommandConnectionProfile() {}
+
+  virtual void execute(const BLECommandArguments& arguments) const override;
+
+  virtual string get_command_specific_help() const override;
 };
 
 // wifi-config ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -71,9 +106,21 @@ public:
   BLECommandWifiConfiguration();
   virtual ~BLECommandWifiConfiguration() {}
 
-  virtual void execute(const vector<string>& arguments) const override;
+  virtual void execute(const BLECommandArguments& arguments) const override;
 
   virtual string get_command_specific_help() const override;
+
+  virtual bool takes_rest_of_line() const override { return true; }
+};
+
+// wifi-scan ///////////////////////////////////////////////////////////////////////////////////////////////
+
+class BLECommandWifiScan : public BLECommand {
+public:
+  BLECommandWifiScan();
+  virtual ~BLECommandWifiScan() {}
+
+  virtual void execute(const BLECommandArguments& arguments) const override;
 };
 #endif
 
@@ -84,7 +131,7 @@ public:
   BLECommandPairings();
   virtual ~BLECommandPairings() {}
 
-  virtual void execute(const vector<string>& arguments) const override;
+  virtual void execute(const BLECommandArguments& arguments) const override;
 };
 
 // version ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -94,7 +141,26 @@ public:
   BLECommandVersion();
   virtual ~BLECommandVersion() {}
 
-  virtual void execute(const vector<string>& arguments) const override;
+  virtual void execute(const BLECommandArguments& arguments) const override;
+};
+
+// stats ///////////////////////////////////////////////////////////////////////////////////////////////
+
+class BLECommandStatistics : public BLECommand {
+public:
+  BLECommandStatistics();
+  virtual ~BLECommandStatistics() {}
+
+  virtual void execute(const BLECommandArguments& arguments) const override;
+};
+
+// heap ///////////////////////////////////////////////////////////////////////////////////////////////
+
+class BLECommandHeap : public BLECommand {
+public:
+  BLECommandHeap();
+  virtual ~BLECommandHeap() {}
+  virtual void execute(const BLECommandArguments& arguments) const override;
 };
 
 // log-level ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -105,7 +171,7 @@ public:
   BLECommandLogLevel();
   virtual ~BLECommandLogLevel() {}
 
-  virtual void execute(const vector<string>& arguments) const override;
+  virtual void execute(const BLECommandArguments& arguments) const override;
 };
 #endif
 
@@ -115,10 +181,12 @@ class BLEControllerCustomCommandExecutionTrigger;
 
 class BLECustomCommand : public BLECommand {
 public:
-  BLECustomCommand(const string& name, const string& description, BLEControllerCustomCommandExecutionTrigger* trigger);
+  BLECustomCommand(const char* name, const char* description, BLEControllerCustomCommandExecutionTrigger* trigger);
   virtual ~BLECustomCommand() {}
 
-  virtual void execute(const vector<string>& arguments) const override;
+  virtual void execute(const BLECommandArguments& arguments) const override;
+
+  virtual bool takes_rest_of_line() const override { return true; }
 
 private:
   BLEControllerCustomCommandExecutionTrigger* trigger;
@@ -1,7 +1,11 @@
 #include "ble_component_handler_base.h"
 
+#include <cmath>
+
 #include <BLE2902.h>
+#include <BLE2904.h>
 
+#include "esphome/core/hal.h"
 #include "esphome/core/log.h"
 
 #include "esp32_ble_controller.h"
@@ -19,45 +23,68 @@ BLEComponentHandlerBase::BLEComponentHandlerBase(EntityBase* component, const BL
 BLEComponentHandlerBase::~BLEComponentHandlerBase() 
 {}
 
-void BLEComponentHandlerBase::setup(BLEServer* ble_server) {
+void BLEComponentHandlerBase::setup(BLEService* service) {
   const string& object_id = component->get_object_id();
 
   ESP_LOGCONFIG(TAG, "Setting up BLE characteristic for component %s", object_id.c_str());
 
-  // Get or create the BLE service.
-  const string& service_UUID = characteristic_info.service_UUID;
-  BLEService* service = ble_server->getServiceByUUID(BLEUUID(service_UUID));
-  if (service == nullptr) {
-    service = ble_server->createService(service_UUID);
-  }
-
   // Create the BLE characteristic.
-  const string& characteristic_UUID = characteristic_info.characteristic_UUID;
+  BLEUUID characteristic_UUID = to_ble_uuid(characteristic_info.characteristic_UUID);
+  const auto presentation_format = get_presentation_format();
   if (can_receive_writes()) {
-    characteristic = create_writeable_ble_characteristic(service, characteristic_UUID, this, get_component_description(), characteristic_info.use_BLE2902);
+    characteristic = create_writeable_ble_characteristic(service, characteristic_UUID, this, get_component_description(), characteristic_info.use_BLE2902, presentation_format,
+                                                         accepts_writes_without_response());
   } else {
-    characteristic = create_read_only_ble_characteristic(service, characteristic_UUID, get_component_description(), characteristic_info.use_BLE2902);
+    characteristic = create_read_only_ble_characteristic(service, characteristic_UUID, get_component_description(), characteristic_info.use_BLE2902, presentation_format);
   }
 
-  service->start();
+  ESP_LOGCONFIG(TAG, "%s: SRV %s - CHAR %s", object_id.c_str(), to_ble_uuid(characteristic_info.service_UUID).toString().c_str(), characteristic_UUID.toString().c_str());
+}
 
-  ESP_LOGCONFIG(TAG, "%s: SRV %s - CHAR %s", object_id.c_str(), service_UUID.c_str(), characteristic_UUID.c_str());
+void BLEComponentHandlerBase::loop() {
+  if (notification_pending && is_notification_due()) {
+    notify();
+  }
 }
 
 void BLEComponentHandlerBase::send_value(float value) {
   const string& object_id = component->get_object_id();
   ESP_LOGD(TAG, "Update component %s to %f", object_id.c_str(), value);
 
-  characteristic->setValue(value);
-  characteristic->notify();
+  switch (get_encoding()) {
+    case BLEValueEncoding::SINT16: {
+      const int16_t fixed_point = to_fixed_point(value, get_exponent(), INT16_MIN, INT16_MAX);
+      const uint8_t data[2] = { uint8_t(fixed_point), uint8_t(fixed_point >> 8) };
+      characteristic->setValue(const_cast<uint8_t*>(data), sizeof(data));
+      break;
+    }
+    case BLEValueEncoding::SINT24: {
+      const int32_t fixed_point = to_fixed_point(value, get_exponent(), -0x800000, 0x7FFFFF);
+      const uint8_t data[3] = { uint8_t(fixed_point), uint8_t(fixed_point >> 8), uint8_t(fixed_point >> 16) };
+      characteristic->setValue(const_cast<uint8_t*>(data), sizeof(data));
+      break;
+    }
+    default:
+      characteristic->setValue(value);
+  }
+  latest_number = value;
+
+  // Changes below the delta threshold only update the value, they do not trigger a notification.
+  const float delta = characteristic_info.notify_delta;
+  if (delta > 0 && has_notified_number && std::fabs(value - last_notified_number) < delta) {
+    ++statistics.suppressed_updates;
+    return;
+  }
+
+  request_notification();
 }
 
-void BLEComponentHandlerBase::send_value(string value) {
+void BLEComponentHandlerBase::send_value(const string& value) {
   const string& object_id = component->get_object_id();
   ESP_LOGD(TAG, "Update component %s to %s", object_id.c_str(), value.c_str());
 
   characteristic->setValue(value);
-  characteristic->notify();
+  request_notification();
 }
 
 void BLEComponentHandlerBase::send_value(bool raw_value) {
@@ -66,11 +93,111 @@ void BLEComponentHandlerBase::send_value(bool raw_value) {
 
   uint16_t value = raw_value;
   characteristic->setValue(value);
-  characteristic->notify();
+  request_notification();
+}
+
+void BLEComponentHandlerBase::send_raw_value(const uint8_t* data, size_t length) {
+  characteristic->setValue(const_cast<uint8_t*>(data), length);
+  request_notification();
+}
+
+void BLEComponentHandlerBase::notify_raw_value(const uint8_t* data, size_t length) {
+  if (global_ble_controller->get_component_services_exposed()) {
+    global_ble_controller->notify(characteristic, data, length, &statistics);
+  }
+}
+
+bool BLEComponentHandlerBase::is_notification_due() const {
+  return millis() - last_notification_millis >= global_ble_controller->get_notify_interval(characteristic_info.min_notify_interval);
+}
+
+void BLEComponentHandlerBase::on_value_notified(uint32_t changed_micros) {
+  statistics.notify_latency.add(micros() - changed_micros);
+  last_notification_millis = millis();
+}
+
+bool BLEComponentHandlerBase::apply_written_value(const uint8_t* data, size_t length) {
+  if (!can_receive_writes() || characteristic == nullptr) {
+    return false;
+  }
+
+  characteristic->setValue(const_cast<uint8_t*>(data), length);
+  on_characteristic_written();
+  return true;
+}
+
+optional<BLEPresentationFormat> BLEComponentHandlerBase::get_presentation_format() {
+  switch (get_encoding()) {
+    case BLEValueEncoding::SINT16:
+      return BLEPresentationFormat{ BLE2904::FORMAT_SINT16, get_exponent(), BLE_UNIT_UNITLESS };
+    case BLEValueEncoding::SINT24:
+      return BLEPresentationFormat{ BLE2904::FORMAT_SINT24, get_exponent(), BLE_UNIT_UNITLESS };
+    default:
+      return {};
+  }
+}
+
+/**
+ * Notifies the client about the new value right away unless the last notification happened less than the minimum notification interval ago.
+ * In that case the notification is postponed (see loop()) and all changes up to then are coalesced, i.e. only the latest value is sent.
+ */
+void BLEComponentHandlerBase::request_notification() {
+  if (notification_pending) {
+    ++statistics.coalesced_updates;
+  } else {
+    unsent_change_micros = micros();
+  }
+
+  if (!notification_pending && is_notification_due()) {
+    notify();
+  } else {
+    notification_pending = true;
+  }
+}
+
+void BLEComponentHandlerBase::notify() {
+  if (!global_ble_controller->get_component_services_exposed()) {
+    // The services are stopped, clients read the current value once they are started again.
+    notification_pending = false;
+    return;
+  }
+
+  global_ble_controller->notify(characteristic, &statistics);
+  statistics.notify_latency.add(micros() - unsent_change_micros);
+
+  notification_pending = false;
+  last_notification_millis = millis();
+
+  has_notified_number = true;
+  last_notified_number = latest_number;
 }
 
 void BLEComponentHandlerBase::onWrite(BLECharacteristic *characteristic) {
-  global_ble_controller->execute_in_loop([this](){ on_characteristic_written(); });
+  const bool coalesce = coalesces_writes();
+  if (coalesce && write_pending.exchange(true)) {
+    return; // the pending deferred function reads the latest value
+  }
+
+  const uint32_t written_micros = micros();
+  // an earlier write still in the queue reads the latest value of the characteristic, so this one may be coalesced if the queue is full
+  const bool coalescable = queued_writes.fetch_add(1) > 0;
+  const bool deferred = global_ble_controller->execute_in_loop([this, coalesce, written_micros](){
+    queued_writes.fetch_sub(1);
+    if (coalesce) {
+      write_pending = false;
+    }
+    on_characteristic_written();
+    // end-to-end latency from the write by the client to the executed change (e.g. perform() of the switch)
+    statistics.write_latency.add(micros() - written_micros);
+    global_ble_controller->on_client_write_handled();
+  }, BLEDeferredLane::COMPONENT_WRITES, coalescable);
+  if (!deferred) {
+    queued_writes.fetch_sub(1);
+    if (!coalescable) {
+      ESP_LOGW(TAG, "Write to %s dropped, queue full", get_component_description().c_str());
+    }
+    write_pending = false;
+  }
 }
 
 bool BLEComponentHandlerBase::is_security_enabled() {
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <string>
 
 #include <BLEServer.h>
@@ -8,18 +9,47 @@
 #include "esphome/core/entity_base.h"
 #include "esphome/core/controller.h"
 #include "esphome/core/defines.h"
+#include "esphome/core/optional.h"
+
+#include "ble_statistics.h"
+#include "ble_utils.h"
 
 using std::string;
 
 namespace esphome {
 namespace esp32_ble_controller {
 
+/// Encoding of the value of a characteristic; the binary encodings are announced to the client via a presentation format descriptor (0x2904).
+enum class BLEValueEncoding : uint8_t {
+  DEFAULT, // raw layout of the value (float for sensors, uint16 for binary states, string otherwise)
+  SINT16, // fixed-point signed 16-bit integer (little-endian) with exponent (for sensors)
+  SINT24, // fixed-point signed 24-bit integer (little-endian) with exponent (for sensors)
+  PACKED_STRUCT, // compact binary struct (for fans and lights)
+  CHUNKED, // UTF-8 string, notified in chunks that fit into the MTU (for text sensors)
+};
+
+/// Type of the component exposed by a handler (e.g. as type tag in the state snapshot).
+enum class BLEComponentType : uint8_t { UNKNOWN = 0, BINARY_SENSOR = 1, FAN = 2, SENSOR = 3, SWITCH = 4, TEXT_SENSOR = 5, LIGHT = 6 };
+
 struct BLECharacteristicInfoForHandler {
-  string service_UUID;
-  string characteristic_UUID;
+  BLEComponentType component_type{BLEComponentType::UNKNOWN};
+  /// 128-bit UUIDs (see to_ble_uuid()), which are constants in flash
+  const uint8_t* service_UUID{nullptr};
+  const uint8_t* characteristic_UUID{nullptr};
   bool use_BLE2902;
+  /// minimum time between two notifications in milliseconds (0 = notify every change); changes in between are coalesced
+  uint32_t min_notify_interval{0};
+  /// minimum change of a numeric value that triggers a notification (0 = notify every change)
+  float notify_delta{0};
+  BLEValueEncoding encoding{BLEValueEncoding::DEFAULT};
+  /// decimal exponent for fixed-point encodings, i.e. value = encoded value * 10^exponent
+  int8_t exponent{0};
+  /// number of samples kept in the history for downloading (0 = no history, sensors only)
+  uint16_t history_size{0};
 };
 
+class BLESensorHistory;
+
 /**
  * A component handler controls a single component (sensor, switch, ...). 
  * Each component corresponds one-to-one to a BLE characteristic. When the state of the component changes in ESPHome, this handler updates the characteristic 
@@ -33,18 +63,55 @@ public:
   BLEComponentHandlerBase(EntityBase* component, const BLECharacteristicInfoForHandler& characteristic_info);
   virtual ~BLEComponentHandlerBase();
 
-  void setup(BLEServer* ble_server);
+  /// Creates the characteristic in the given service, which is started by the caller afterwards.
+  void setup(BLEService* service);
+
+  /// Sends a pending (coalesced) notification once the minimum notification interval has passed.
+  virtual void loop();
 
   virtual void send_value(float value);
-  virtual void send_value(string value);
+  virtual void send_value(const string& value);
   virtual void send_value(bool value);
 
+  BLEComponentType get_component_type() const { return characteristic_info.component_type; }
+  BLECharacteristic* get_characteristic() { return characteristic; }
+
+  /**
+   * Applies the given value as if the client had written it to the characteristic (e.g. from a batch of writes).
+   * @return false if the component cannot be written by clients
+   */
+  bool apply_written_value(const uint8_t* data, size_t length);
+
+  /// Returns the history of the component's values, nullptr if it does not keep one.
+  virtual const BLESensorHistory* get_history() const { return nullptr; }
+
+  const BLEHandlerStatistics& get_statistics() const { return statistics; }
+  void reset_statistics() { statistics = BLEHandlerStatistics(); }
+
 protected:
   virtual EntityBase* get_component() { return component; }
   virtual string get_component_description() { return get_component()->get_name(); }
-  BLECharacteristic* get_characteristic() { return characteristic; }
+
+  BLEValueEncoding get_encoding() const { return characteristic_info.encoding; }
+  int8_t get_exponent() const { return characteristic_info.exponent; }
+  /// Returns the content of the presentation format descriptor (0x2904) for the characteristic, empty if the value uses the default encoding.
+  virtual optional<BLEPresentationFormat> get_presentation_format();
+
+  /// Sets the given binary value of the characteristic and notifies the client.
+  void send_raw_value(const uint8_t* data, size_t length);
+  /// Notifies the client about the given value right away without changing the value of the characteristic (e.g. a chunk of it), see is_notification_due().
+  void notify_raw_value(const uint8_t* data, size_t length);
+  /// Returns true if the minimum notification interval (widened while the links are congested) has passed since the last notified value.
+  bool is_notification_due() const;
+  /// Records that a value changed at the given time has been notified by the subclass, which starts the next minimum notification interval.
+  void on_value_notified(uint32_t changed_micros);
+  void count_coalesced_update() { ++statistics.coalesced_updates; }
 
   virtual bool can_receive_writes() { return false; }
+  /// Returns true if clients may also write without response (which requires can_receive_writes()), which saves the round trip of the write response.
+  virtual bool accepts_writes_without_response() { return false; }
+  /// Returns true if writes received before the main loop has handled the previous one collapse into a single on_characteristic_written() with the latest value.
+  virtual bool coalesces_writes() { return false; }
   virtual void on_characteristic_written() {}
 
   bool is_security_enabled();
@@ -52,10 +119,26 @@ protected:
 private:
   virtual void onWrite(BLECharacteristic *characteristic); // inherited from BLECharacteristicCallbacks
 
+  void request_notification();
+  void notify();
+
   EntityBase* component;
   BLECharacteristicInfoForHandler characteristic_info;
 
   BLECharacteristic* characteristic;
+
+  bool notification_pending{false};
+  uint32_t last_notification_millis{0};
+  uint32_t unsent_change_micros{0};
+
+  std::atomic<bool> write_pending{false}; // set by the BLE task, cleared by the main loop (only if writes are coalesced)
+  std::atomic<uint8_t> queued_writes{0}; // writes deferred to the main loop, but not yet handled
+
+  bool has_notified_number{false};
+  float last_notified_number{0};
+  float latest_number{0};
+
+  BLEHandlerStatistics statistics;
 };
 
 } // namespace esp32_ble_controller
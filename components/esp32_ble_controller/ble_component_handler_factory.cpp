@@ -1,22 +1,46 @@
 #include "ble_component_handler_factory.h"
 
+#include <initializer_list>
+
+#include "esphome/core/log.h"
+
 #include "ble_component_handler.h"
 #include "ble_fan_handler.h"
+#include "ble_light_handler.h"
+#include "ble_object_arena.h"
 #include "ble_sensor_handler.h"
 #include "ble_switch_handler.h"
+#include "ble_text_sensor_handler.h"
 
 namespace esphome {
 namespace esp32_ble_controller {
 
 static const char *TAG = "ble_component_handler_factory";
 
+/// Returns the given characteristic info, but falls back to the default encoding if the configured encoding is not supported for the component.
+static BLECharacteristicInfoForHandler with_supported_encoding(EntityBase* component, const BLECharacteristicInfoForHandler& characteristic_info, std::initializer_list<BLEValueEncoding> supported_encodings) {
+  if (characteristic_info.encoding == BLEValueEncoding::DEFAULT) {
+    return characteristic_info;
+  }
+  for (BLEValueEncoding encoding : supported_encodings) {
+    if (characteristic_info.encoding == encoding) {
+      return characteristic_info;
+    }
+  }
+
+  ESP_LOGW(TAG, "Encoding %d not supported for component %s, using default encoding", static_cast<uint8_t>(characteristic_info.encoding), component->get_object_id().c_str());
+  BLECharacteristicInfoForHandler info = characteristic_info;
+  info.encoding = BLEValueEncoding::DEFAULT;
+  return info;
+}
+
 BLEComponentHandlerBase* BLEComponentHandlerFactory::create_component_handler(EntityBase* component, const BLECharacteristicInfoForHandler& characteristic_info) {
-  return new BLEComponentHandler<EntityBase>(component, characteristic_info);
+  return BLEObjectArena::create<BLEComponentHandler<EntityBase>>(component, characteristic_info);
 }
 
 #ifdef USE_BINARY_SENSOR
 BLEComponentHandlerBase* esphome::esp32_ble_controller::BLEComponentHandlerFactory::create_binary_sensor_handler(binary_sensor::BinarySensor* component, const BLECharacteristicInfoForHandler& characteristic_info) {
-  return create_component_handler(component, characteristic_info);    
+  return create_component_handler(component, with_supported_encoding(component, characteristic_info, {}));    
 }
 #endif
 
@@ -25,28 +49,31 @@ BLEComponentHandlerBase* esphome::esp32_ble_controller::BLEComponentHandlerFacto
 
 #ifdef USE_FAN
 BLEComponentHandlerBase* BLEComponentHandlerFactory::BLEComponentHandlerFactory::create_fan_handler(fan::Fan* component, const BLECharacteristicInfoForHandler& characteristic_info) {
-  return new BLEFanHandler(component, characteristic_info);
+  return BLEObjectArena::create<BLEFanHandler>(component, with_supported_encoding(component, characteristic_info, { BLEValueEncoding::PACKED_STRUCT }));
 }
 #endif
 
 #ifdef USE_LIGHT
+BLEComponentHandlerBase* BLEComponentHandlerFactory::create_light_handler(light::LightState* component, const BLECharacteristicInfoForHandler& characteristic_info) {
+  return BLEObjectArena::create<BLELightHandler>(component, with_supported_encoding(component, characteristic_info, { BLEValueEncoding::PACKED_STRUCT }));
+}
 #endif
 
 #ifdef USE_SENSOR
 BLEComponentHandlerBase* esphome::esp32_ble_controller::BLEComponentHandlerFactory::create_sensor_handler(sensor::Sensor* component, const BLECharacteristicInfoForHandler& characteristic_info) {
-  return new BLESensorHandler(component, characteristic_info);    
+  return BLEObjectArena::create<BLESensorHandler>(component, with_supported_encoding(component, characteristic_info, { BLEValueEncoding::SINT16, BLEValueEncoding::SINT24 }));    
 }
 #endif
 
 #ifdef USE_SWITCH
 BLEComponentHandlerBase* BLEComponentHandlerFactory::create_switch_handler(switch_::Switch* component, const BLECharacteristicInfoForHandler& characteristic_info) {
-  return new BLESwitchHandler(component, characteristic_info);
+  return BLEObjectArena::create<BLESwitchHandler>(component, with_supported_encoding(component, characteristic_info, {}));
 }
 #endif
 
 #ifdef USE_TEXT_SENSOR
 BLEComponentHandlerBase* esphome::esp32_ble_controller::BLEComponentHandlerFactory::create_text_sensor_handler(text_sensor::TextSensor* component, const BLECharacteristicInfoForHandler& characteristic_info) {
-  return create_component_handler(component, characteristic_info);    
+  return BLEObjectArena::create<BLETextSensorHandler>(component, with_supported_encoding(component, characteristic_info, { BLEValueEncoding::CHUNKED }));
 }
 #endif
 
@@ -13,6 +13,7 @@
 #include "esphome/components/fan/fan.h"
 #endif
 #ifdef USE_LIGHT
+#include "esphome/components/light/light_state.h"
 #endif
 #ifdef USE_SENSOR
 #include "esphome/components/sensor/sensor.h"
@@ -51,6 +52,7 @@ public:
 #endif
 
 #ifdef USE_LIGHT
+  static BLEComponentHandlerBase* create_light_handler(light::LightState* component, const BLECharacteristicInfoForHandler& characteristic_info);
 #endif
 
 #ifdef USE_SENSOR
@@ -2,6 +2,8 @@
 
 #ifdef USE_FAN
 
+#include <BLE2904.h>
+
 #include "ble_utils.h"
 
 namespace esphome {
@@ -19,6 +21,11 @@ static const char *OPT_DIRECTION_FWD = "forward";
 static const char *OPT_DIRECTION_REV = "reverse";
 
 void BLEFanHandler::send_value(bool on_off) {
+  if (get_encoding() == BLEValueEncoding::PACKED_STRUCT) {
+    send_packed_value(on_off);
+    return;
+  }
+
   string state_as_string;
 
   state_as_string = "fan=";
@@ -50,11 +57,41 @@ void BLEFanHandler::send_value(bool on_off) {
   BLEComponentHandlerBase::send_value(state_as_string);
 }
 
+void BLEFanHandler::send_packed_value(bool on_off) {
+  /*const*/ Fan* fan = get_component();
+  const auto& traits = fan->get_traits();
+
+  BLEFanPackedState state;
+  state.flags = on_off ? BLEFanPackedState::FLAG_ON : 0;
+  if (traits.supports_oscillation() && fan->oscillating) {
+    state.flags |= BLEFanPackedState::FLAG_OSCILLATING;
+  }
+  if (traits.supports_direction() && fan->direction == fan::FanDirection::REVERSE) {
+    state.flags |= BLEFanPackedState::FLAG_REVERSE;
+  }
+  state.speed = traits.supports_speed() ? fan->speed : 0;
+  state.speed_count = traits.supports_speed() ? traits.supported_speed_count() : 0;
+
+  send_raw_value(reinterpret_cast<const uint8_t*>(&state), sizeof(state));
+}
+
+optional<BLEPresentationFormat> BLEFanHandler::get_presentation_format() {
+  if (get_encoding() == BLEValueEncoding::PACKED_STRUCT) {
+    return BLEPresentationFormat{ BLE2904::FORMAT_OPAQUE, 0, BLE_UNIT_UNITLESS };
+  }
+  return BLEComponentHandler::get_presentation_format();
+}
+
 void BLEFanHandler::on_characteristic_written() {
   std::string value = get_characteristic()->getValue();
 
   Fan* fan = get_component();
 
+  if (get_encoding() == BLEValueEncoding::PACKED_STRUCT && value.length() >= 2) {
+    on_packed_value_written(value);
+    return;
+  }
+
   // for backward compatibility
   if (value.length() == 1) {
     uint8_t on = value[0];
@@ -116,6 +153,29 @@ void BLEFanHandler::on_characteristic_written() {
   call.perform();
 }
 
+/// Applies a written packed state, which consists of the flags byte and the speed byte (see BLEFanPackedState).
+void BLEFanHandler::on_packed_value_written(const string& value) {
+  Fan* fan = get_component();
+  const auto& traits = fan->get_traits();
+
+  const uint8_t flags = value[0];
+  const uint8_t speed = value[1];
+  ESP_LOGD(TAG, "Fan chracteristic written: flags %d, speed %d", flags, speed);
+
+  auto call = fan->make_call();
+  call.set_state(flags & BLEFanPackedState::FLAG_ON);
+  if (traits.supports_speed() && speed <= traits.supported_speed_count()) {
+    call.set_speed(speed);
+  }
+  if (traits.supports_oscillation()) {
+    call.set_oscillating(flags & BLEFanPackedState::FLAG_OSCILLATING);
+  }
+  if (traits.supports_direction()) {
+    call.set_direction(flags & BLEFanPackedState::FLAG_REVERSE ? fan::FanDirection::REVERSE : fan::FanDirection::FORWARD);
+  }
+  call.perform();
+}
+
 } // namespace esp32_ble_controller
 } // namespace esphome
 
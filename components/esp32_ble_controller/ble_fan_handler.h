@@ -16,8 +16,21 @@ namespace esp32_ble_controller {
 
 using fan::Fan;
 
+/// Fan state in the packed encoding.
+struct BLEFanPackedState {
+  static const uint8_t FLAG_ON = 1 << 0;
+  static const uint8_t FLAG_OSCILLATING = 1 << 1;
+  static const uint8_t FLAG_REVERSE = 1 << 2;
+
+  uint8_t flags;
+  uint8_t speed;
+  uint8_t speed_count; // 0 if speed is not supported (ignored when written)
+} PACKED;  // NOLINT
+
 /**
  * Special component handler for fans, which allows turning the fan on and off from a BLE client.
+ * <para>
+ * By default the fan state is exposed as human-readable string. With the packed encoding it is exposed as binary struct (see BLEFanPackedState) instead.
  */
 class BLEFanHandler : public BLEComponentHandler<Fan> {
 public:
@@ -27,8 +40,15 @@ public:
   virtual void send_value(bool value) override;
 
 protected:
+  virtual optional<BLEPresentationFormat> get_presentation_format() override;
+
   virtual bool can_receive_writes() { return true; }
+  virtual bool accepts_writes_without_response() override { return true; }
   virtual void on_characteristic_written() override;
+
+private:
+  void send_packed_value(bool on_off);
+  void on_packed_value_written(const string& value);
 };
 
 } // namespace esp32_ble_controller
@@ -0,0 +1,85 @@
+#include "ble_light_handler.h"
+
+#ifdef USE_LIGHT
+
+#include <cmath>
+
+#include <BLE2904.h>
+
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+#include "ble_utils.h"
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+static const char *TAG = "ble_light_handler";
+
+static uint8_t to_byte(float value) {
+  return static_cast<uint8_t>(std::lround(clamp(value, 0.0f, 1.0f) * 255));
+}
+
+static float from_byte(uint8_t value) {
+  return value / 255.0f;
+}
+
+void BLELightHandler::send_value(bool on_off) {
+  // The remote values are the target of a running transition, which is what the client has asked for.
+  const auto& values = get_component()->remote_values;
+
+  BLELightPackedState state;
+  state.flags = on_off ? BLELightPackedState::FLAG_ON : 0;
+  state.brightness = to_byte(values.get_brightness());
+  state.red = to_byte(values.get_red());
+  state.green = to_byte(values.get_green());
+  state.blue = to_byte(values.get_blue());
+  state.cold_white = to_byte(values.get_cold_white());
+  state.warm_white = to_byte(values.get_warm_white());
+  state.transition_length = 0;
+
+  send_raw_value(reinterpret_cast<const uint8_t*>(&state), sizeof(state));
+}
+
+optional<BLEPresentationFormat> BLELightHandler::get_presentation_format() {
+  if (get_encoding() == BLEValueEncoding::PACKED_STRUCT) {
+    return BLEPresentationFormat{ BLE2904::FORMAT_OPAQUE, 0, BLE_UNIT_UNITLESS };
+  }
+  return BLEComponentHandler::get_presentation_format();
+}
+
+/// Applies a written packed state (see BLELightPackedState), fields that have not been written are left unchanged.
+void BLELightHandler::on_characteristic_written() {
+  std::string value = get_characteristic()->getValue();
+  if (value.length() < 2) {
+    ESP_LOGW(TAG, "Light characteristic written with %u bytes, at least 2 expected", static_cast<unsigned>(value.length()));
+    return;
+  }
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(value.data());
+  ESP_LOGV(TAG, "Light characteristic written: flags %d, brightness %d", data[0], data[1]);
+
+  LightState* light = get_component();
+  const auto traits = light->get_traits();
+
+  auto call = light->make_call();
+  call.set_state(data[0] & BLELightPackedState::FLAG_ON);
+  if (traits.supports_color_capability(light::ColorCapability::BRIGHTNESS)) {
+    call.set_brightness(from_byte(data[1]));
+  }
+  if (value.length() >= 5 && traits.supports_color_capability(light::ColorCapability::RGB)) {
+    call.set_rgb(from_byte(data[2]), from_byte(data[3]), from_byte(data[4]));
+  }
+  if (value.length() >= 7 && traits.supports_color_capability(light::ColorCapability::COLD_WARM_WHITE)) {
+    call.set_cold_white(from_byte(data[5]));
+    call.set_warm_white(from_byte(data[6]));
+  }
+  if (value.length() >= 9) {
+    call.set_transition_length(data[7] | (data[8] << 8));
+  }
+  call.perform();
+}
+
+} // namespace esp32_ble_controller
+} // namespace esphome
+
+#endif
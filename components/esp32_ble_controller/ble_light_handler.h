@@ -0,0 +1,59 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+#ifdef USE_LIGHT
+
+#include <string>
+
+#include "esphome/components/light/light_state.h"
+
+#include "ble_component_handler.h"
+
+using std::string;
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+using light::LightState;
+
+/// Light state in the packed encoding, channels are scaled to 0-255 (unsupported channels are 0).
+struct BLELightPackedState {
+  static const uint8_t FLAG_ON = 1 << 0;
+
+  uint8_t flags;
+  uint8_t brightness;
+  uint8_t red;
+  uint8_t green;
+  uint8_t blue;
+  uint8_t cold_white;
+  uint8_t warm_white;
+  uint16_t transition_length; // in milliseconds (little-endian), only used when written (0 otherwise)
+} PACKED;  // NOLINT
+
+/**
+ * Special component handler for lights, which exposes the target state of the light as binary struct (see BLELightPackedState) and applies written states.
+ * <para>
+ * A client may write just the leading fields of the struct (at least flags and brightness), the remaining channels stay unchanged.
+ * The characteristic accepts writes without response, so that a client can stream colours at a high rate; all writes received before the next loop
+ * collapse into a single light call with the latest value.
+ */
+class BLELightHandler : public BLEComponentHandler<LightState> {
+public:
+  BLELightHandler(LightState* component, const BLECharacteristicInfoForHandler& characteristic_info) : BLEComponentHandler(component, characteristic_info) {}
+  virtual ~BLELightHandler() {}
+
+  virtual void send_value(bool value) override;
+
+protected:
+  virtual optional<BLEPresentationFormat> get_presentation_format() override;
+
+  virtual bool can_receive_writes() override { return true; }
+  virtual bool accepts_writes_without_response() override { return true; }
+  virtual bool coalesces_writes() override { return true; }
+  virtual void on_characteristic_written() override;
+};
+
+} // namespace esp32_ble_controller
+} // namespace esphome
+
+#endif
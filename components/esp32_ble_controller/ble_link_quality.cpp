@@ -0,0 +1,161 @@
+#include "ble_link_quality.h"
+
+#include <cmath>
+#include <cstring>
+
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+static const char *TAG = "ble_link_quality";
+
+float BLELinkCounters::get_notification_success() const {
+  if (notifications == 0) {
+    return 100;
+  }
+  return 100.0f * (notifications - failed_notifications) / notifications;
+}
+
+// telemetry mailbox ///////////////////////////////////////////////////////////////////////////////////////////////
+
+BLELinkTelemetryMailbox::Slot* BLELinkTelemetryMailbox::find_slot(uint16_t conn_id) {
+  for (auto& slot : slots) {
+    if (slot.used && slot.conn_id == conn_id) {
+      return &slot;
+    }
+  }
+  return nullptr;
+}
+
+BLELinkTelemetryMailbox::Slot* BLELinkTelemetryMailbox::find_slot(const esp_bd_addr_t address) {
+  for (auto& slot : slots) {
+    if (slot.used && memcmp(slot.address, address, sizeof(esp_bd_addr_t)) == 0) {
+      return &slot;
+    }
+  }
+  return nullptr;
+}
+
+void BLELinkTelemetryMailbox::on_connected(uint16_t conn_id, const esp_bd_addr_t address, uint16_t interval, uint16_t latency, uint16_t timeout) {
+  portENTER_CRITICAL(&lock);
+  Slot* slot = find_slot(conn_id);
+  for (size_t i = 0; slot == nullptr && i < MAX_LINKS; ++i) {
+    if (!slots[i].used) {
+      slot = &slots[i];
+    }
+  }
+  if (slot != nullptr) {
+    slot->used = true;
+    slot->updated = true;
+    slot->conn_id = conn_id;
+    memcpy(slot->address, address, sizeof(esp_bd_addr_t));
+    slot->telemetry = BLELinkTelemetry{};
+    slot->telemetry.has_connection_parameters = true;
+    slot->telemetry.connection_interval = interval;
+    slot->telemetry.slave_latency = latency;
+    slot->telemetry.supervision_timeout = timeout;
+  }
+  portEXIT_CRITICAL(&lock);
+}
+
+void BLELinkTelemetryMailbox::on_disconnected(uint16_t conn_id) {
+  portENTER_CRITICAL(&lock);
+  Slot* slot = find_slot(conn_id);
+  if (slot != nullptr) {
+    slot->used = false;
+  }
+  portEXIT_CRITICAL(&lock);
+}
+
+void BLELinkTelemetryMailbox::post_congestion(uint16_t conn_id, bool congested) {
+  portENTER_CRITICAL(&lock);
+  Slot* slot = find_slot(conn_id);
+  if (slot != nullptr) {
+    if (congested && !slot->telemetry.congested && slot->telemetry.congestion_events < UINT16_MAX) {
+      ++slot->telemetry.congestion_events;
+    }
+    slot->telemetry.congested = congested;
+    slot->updated = true;
+  }
+  portEXIT_CRITICAL(&lock);
+}
+
+void BLELinkTelemetryMailbox::post_rssi(const esp_bd_addr_t address, int8_t rssi) {
+  portENTER_CRITICAL(&lock);
+  Slot* slot = find_slot(address);
+  if (slot != nullptr) {
+    slot->telemetry.has_rssi = true;
+    slot->telemetry.rssi = rssi;
+    slot->updated = true;
+  }
+  portEXIT_CRITICAL(&lock);
+}
+
+void BLELinkTelemetryMailbox::post_connection_parameters(const esp_bd_addr_t address, uint16_t interval, uint16_t latency, uint16_t timeout) {
+  portENTER_CRITICAL(&lock);
+  Slot* slot = find_slot(address);
+  if (slot != nullptr) {
+    slot->telemetry.has_connection_parameters = true;
+    slot->telemetry.connection_interval = interval;
+    slot->telemetry.slave_latency = latency;
+    slot->telemetry.supervision_timeout = timeout;
+    slot->updated = true;
+  }
+  portEXIT_CRITICAL(&lock);
+}
+
+bool BLELinkTelemetryMailbox::take(uint16_t conn_id, BLELinkTelemetry& telemetry) {
+  bool updated = false;
+  portENTER_CRITICAL(&lock);
+  Slot* slot = find_slot(conn_id);
+  if (slot != nullptr && slot->updated) {
+    updated = true;
+    telemetry = slot->telemetry;
+    slot->updated = false;
+    slot->telemetry.has_rssi = false;
+    slot->telemetry.has_connection_parameters = false;
+    slot->telemetry.congestion_events = 0;
+  }
+  portEXIT_CRITICAL(&lock);
+  return updated;
+}
+
+// throttle ///////////////////////////////////////////////////////////////////////////////////////////////
+
+void BLENotifyThrottle::update(bool congested) {
+  if (congested) {
+    quiet_periods = 0;
+    if (level < MAX_LEVEL) {
+      ++level;
+      ++widenings;
+      ESP_LOGD(TAG, "Links congested, widening the notification intervals (x%u)", 1u << level);
+    }
+  } else if (level > 0 && ++quiet_periods >= RECOVERY_PERIODS) {
+    quiet_periods = 0;
+    --level;
+    ESP_LOGD(TAG, "Links recovering, tightening the notification intervals (x%u)", 1u << level);
+  }
+}
+
+#ifdef USE_SENSOR
+static void publish_if_present(sensor::Sensor* sensor, float value) {
+  if (sensor != nullptr) {
+    sensor->publish_state(value);
+  }
+}
+
+void BLELinkQualitySensors::publish(const BLELinkQuality* link_quality, uint16_t mtu, const BLELinkCounters& counters) {
+  const bool rssi_known = link_quality != nullptr && link_quality->rssi != 0;
+  const bool parameters_known = link_quality != nullptr && link_quality->connection_interval != 0;
+  publish_if_present(rssi, rssi_known ? link_quality->rssi : NAN);
+  publish_if_present(this->mtu, link_quality != nullptr ? mtu : NAN);
+  publish_if_present(connection_interval, parameters_known ? link_quality->connection_interval * 1.25f : NAN);
+  publish_if_present(slave_latency, parameters_known ? link_quality->slave_latency : NAN);
+  publish_if_present(congestion_events, counters.congestion_events);
+  publish_if_present(notification_success, counters.get_notification_success());
+}
+#endif
+
+} // namespace esp32_ble_controller
+} // namespace esphome
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+#include <freertos/FreeRTOS.h>
+
+#include <esp_bt_defs.h>
+
+#include "esphome/core/defines.h"
+#ifdef USE_SENSOR
+#include "esphome/components/sensor/sensor.h"
+#endif
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+/// Counters of the notifications and congestion events of a link (or of all links together).
+struct BLELinkCounters {
+  uint32_t notifications{0}; // notifications sent or handed to the notification task
+  uint32_t failed_notifications{0}; // notifications the BLE stack (or the full notification task) has rejected
+  uint32_t congestion_events{0}; // times the BLE stack has reported the link as congested
+
+  /// Returns the percentage of successful notifications, 100 if none have been sent yet.
+  float get_notification_success() const;
+};
+
+/// Quality of the link to a client as reported by the BLE stack. (Only accessed from the main loop.)
+struct BLELinkQuality {
+  int8_t rssi{0}; // in dBm, 0 = not read yet
+  uint16_t connection_interval{0}; // in units of 1.25 ms, 0 = unknown
+  uint16_t slave_latency{0}; // number of connection events the peripheral may skip
+  uint16_t supervision_timeout{0}; // in units of 10 ms
+  bool congested{false};
+  BLELinkCounters counters;
+};
+
+/// Telemetry of a link that the BLE stack has reported since the main loop took it last (see BLELinkTelemetryMailbox).
+struct BLELinkTelemetry {
+  bool has_rssi{false};
+  int8_t rssi{0};
+  bool has_connection_parameters{false};
+  uint16_t connection_interval{0}; // in units of 1.25 ms
+  uint16_t slave_latency{0};
+  uint16_t supervision_timeout{0}; // in units of 10 ms
+  bool congested{false}; // current state (not reset when taken)
+  uint16_t congestion_events{0};
+};
+
+/**
+ * Passes the telemetry of the links from the BLE task to the main loop without a queue: each link has a slot with the latest values, so a burst of 
+ * telemetry events (like congestion toggling) just updates the slot and counts the congestion events, instead of crowding out the connection events.
+ * @brief Latest-value mailbox for the telemetry of the links
+ */
+class BLELinkTelemetryMailbox {
+public:
+  /// the BLE controller supports at most 9 links (see CONFIG_BTDM_CTRL_BLE_MAX_CONN), including those that are rejected
+  static constexpr size_t MAX_LINKS = 9;
+
+  // called by the BLE task
+  void on_connected(uint16_t conn_id, const esp_bd_addr_t address, uint16_t interval, uint16_t latency, uint16_t timeout);
+  void on_disconnected(uint16_t conn_id);
+  void post_congestion(uint16_t conn_id, bool congested);
+  void post_rssi(const esp_bd_addr_t address, int8_t rssi);
+  void post_connection_parameters(const esp_bd_addr_t address, uint16_t interval, uint16_t latency, uint16_t timeout);
+
+  /**
+   * Takes the telemetry of the given connection that has been reported since the last call (called by the main loop).
+   * @return false if nothing new has been reported
+   */
+  bool take(uint16_t conn_id, BLELinkTelemetry& telemetry);
+
+private:
+  struct Slot {
+    bool used{false};
+    bool updated{false};
+    uint16_t conn_id{0};
+    esp_bd_addr_t address{};
+    BLELinkTelemetry telemetry;
+  };
+
+  Slot* find_slot(uint16_t conn_id);
+  Slot* find_slot(const esp_bd_addr_t address);
+
+  portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+  Slot slots[MAX_LINKS];
+};
+
+/**
+ * Widens the minimum notification intervals of the components while the links are congested and tightens them again once the links have recovered.
+ * It is updated once per period: each congested period doubles the intervals (up to MAX_LEVEL times), each RECOVERY_PERIODS quiet periods in a row halve them again.
+ * @brief Adapts the notification intervals to congestion
+ */
+class BLENotifyThrottle {
+public:
+  static constexpr uint8_t MAX_LEVEL = 4;
+  static constexpr uint8_t RECOVERY_PERIODS = 3;
+  /// While throttled, components without minimum notification interval get this one (before it is doubled).
+  static constexpr uint32_t MIN_THROTTLED_NOTIFY_INTERVAL_MILLIS = 50;
+
+  /// Called once per period (in the main loop) telling whether any link has been congested during the period.
+  void update(bool congested);
+
+  /// Returns the given minimum notification interval of a component widened according to the current congestion.
+  uint32_t get_notify_interval(uint32_t min_notify_interval) const {
+    return level == 0 ? min_notify_interval : std::max(min_notify_interval, MIN_THROTTLED_NOTIFY_INTERVAL_MILLIS) << level;
+  }
+
+  /// Returns the number of times the intervals have been doubled (0 = not throttled).
+  uint8_t get_level() const { return level; }
+  /// Returns the number of congested periods in which the intervals have been widened.
+  uint32_t get_widenings() const { return widenings; }
+  void reset_statistics() { widenings = 0; }
+
+private:
+  uint8_t level{0};
+  uint8_t quiet_periods{0};
+  uint32_t widenings{0};
+};
+
+#ifdef USE_SENSOR
+/// Optional sensors that publish the link quality of the first connection and the counters of all connections (see sensor.py).
+struct BLELinkQualitySensors {
+  sensor::Sensor* rssi{nullptr};
+  sensor::Sensor* mtu{nullptr};
+  sensor::Sensor* connection_interval{nullptr};
+  sensor::Sensor* slave_latency{nullptr};
+  sensor::Sensor* congestion_events{nullptr};
+  sensor::Sensor* notification_success{nullptr};
+
+  /// Publishes the given link quality and MTU (nullptr if there is no connection, which publishes NAN) and the given total counters.
+  void publish(const BLELinkQuality* link_quality, uint16_t mtu, const BLELinkCounters& counters);
+};
+#endif
+
+} // namespace esp32_ble_controller
+} // namespace esphome
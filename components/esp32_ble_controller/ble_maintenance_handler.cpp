@@ -1,7 +1,11 @@
+#include <algorithm>
+#include <cstring>
+
 #include <BLE2902.h>
 
 #include "ble_maintenance_handler.h"
 
+#include "esphome/core/hal.h"
 #include "esphome/core/log.h"
 #include "esphome/core/application.h"
 #ifdef USE_LOGGER
@@ -10,47 +14,152 @@
 
 #include "esp32_ble_controller.h"
 #include "ble_command.h"
+#include "ble_object_arena.h"
 #include "automation.h"
 #include "ble_utils.h"
+#include "ble_sensor_history.h"
 
 // https://www.uuidgenerator.net
 #define SERVICE_UUID                "7b691dff-9062-4192-b46a-692e0da81d91"
 #define CHARACTERISTIC_UUID_CMD     "1d3c6498-cfdf-44a1-9038-3e757dcc449d"
 #define CHARACTERISTIC_UUID_LOGGING "a1083f3b-0ad6-49e0-8a9d-56eb5bf462ca"
+#define CHARACTERISTIC_UUID_DIAGNOSTICS "5e2a6b3c-8f1d-4c7e-9a40-2d6b1f0c8e57"
+#define CHARACTERISTIC_UUID_SNAPSHOT "c7d4e2a1-3b6f-4e58-8d91-6a0f2b7c5e34"
+#define CHARACTERISTIC_UUID_HISTORY "e3b5f1c8-2a4d-4f6b-9c7e-1d8a0b3f5e62"
+#define CHARACTERISTIC_UUID_BATCH   "4f8e2d6a-1c7b-4a93-b5e0-7d3c9a1f6b28"
 
 namespace esphome {
 namespace esp32_ble_controller {
 
 static const char *TAG = "ble_maintenance_handler";
 
+static const int MAX_COMMAND_RESULT_NOTIFICATIONS_PER_LOOP = 4;
+
+/// maximum number of tokens of a command (i.e. the sequence tag, the command name and its arguments)
+static const size_t MAX_COMMAND_TOKENS = 16;
+/// maximum number of commands in a single write
+static const size_t MAX_PIPELINED_COMMANDS = 8;
+
+static const uint32_t DIAGNOSTICS_UPDATE_INTERVAL_MILLIS = 5000;
+
+/// maximum length of an attribute value (that a client can read with long reads)
+static const size_t MAX_SNAPSHOT_LENGTH = 512;
+
+static const int MAX_HISTORY_FRAMES_PER_LOOP = 4;
+
+/// A chunk of a command result starts with its sequence number and the flags, followed by the payload.
+static const size_t CHUNK_HEADER_LENGTH = 2;
+static const uint8_t CHUNK_FLAG_LAST = 1 << 0;
+
+#ifdef USE_LOGGER
+static const size_t MAX_LOG_NOTIFICATION_LENGTH = BLE_MAX_MTU - 3;
+static const int MAX_LOG_NOTIFICATIONS_PER_LOOP = 4;
+#endif
+
+// built-in commands (static, so that they need no heap memory)
+static BLECommandHelp command_help;
+static BLECommandSwitchMaintenanceOnOrOff command_switch_maintenance;
+static BLECommandSwitchComponentServicesOnOrOff command_switch_component_services;
+static BLECommandConnectionProfile command_connection_profile;
+#ifdef USE_WIFI
+static BLECommandWifiConfiguration command_wifi_configuration;
+static BLECommandWifiScan command_wifi_scan;
+#endif
+static BLECommandPairings command_pairings;
+static BLECommandVersion command_version;
+static BLECommandStatistics command_statistics;
+static BLECommandHeap command_heap;
+#ifdef USE_LOGGER
+static BLECommandLogLevel command_log_level;
+#endif
+
 BLEMaintenanceHandler::BLEMaintenanceHandler() : ble_command_characteristic(nullptr) {
-  commands.push_back(new BLECommandHelp());
-  commands.push_back(new BLECommandSwitchMaintenanceOnOrOff());
-  commands.push_back(new BLECommandSwitchComponentServicesOnOrOff());
+  commands.reserve(16 + BLE_CONTROLLER_NUM_CUSTOM_COMMANDS); // room for the built-in and custom commands
+  commands.push_back(&command_help);
+  commands.push_back(&command_switch_maintenance);
+  commands.push_back(&command_switch_component_services);
+  commands.push_back(&command_connection_profile);
 #ifdef USE_WIFI
-  commands.push_back(new BLECommandWifiConfiguration());
+  commands.push_back(&command_wifi_configuration);
+  commands.push_back(&command_wifi_scan);
 #endif
-  commands.push_back(new BLECommandPairings());
-  commands.push_back(new BLECommandVersion());
+  commands.push_back(&command_pairings);
+  commands.push_back(&command_version);
+  commands.push_back(&command_statistics);
+  commands.push_back(&command_heap);
 
 #ifdef USE_LOGGER
   log_level = ESPHOME_LOG_LEVEL;
   logging_characteristic = nullptr;
 
-  commands.push_back(new BLECommandLogLevel());
+  commands.push_back(&command_log_level);
 #endif
 }
 
 void BLEMaintenanceHandler::setup(BLEServer* ble_server) {
   ESP_LOGCONFIG(TAG, "Setting up maintenance service");
 
-  BLEService* service = ble_server->createService(SERVICE_UUID);
+  // All commands are registered before the setup, so we sort them once for looking them up quickly.
+  std::stable_sort(commands.begin(), commands.end(), [](const BLECommand* a, const BLECommand* b) { return a->get_name() < b->get_name(); });
 
-  ble_command_characteristic = create_writeable_ble_characteristic(service, CHARACTERISTIC_UUID_CMD, this, "BLE Command Channel");
+  // Each characteristic needs handles for its declaration, its value, and its descriptors (0x2901 and maybe 0x2902), the service needs one more for its declaration.
+  uint32_t num_handles = 1 + 4;
+#ifdef USE_LOGGER
+  num_handles += 4;
+#endif
+  if (diagnostics_characteristic_exposed) {
+    num_handles += 3;
+  }
+  if (snapshot_characteristic_exposed) {
+    num_handles += 4;
+  }
+  const bool has_history = global_ble_controller->has_history();
+  if (has_history) {
+    num_handles += 4;
+  }
+  if (batch_characteristic_exposed) {
+    num_handles += 4;
+  }
+#ifdef USE_BLE_CONTROLLER_OTA
+  // The image is only checked against the hash the client sends, so the firmware may only be updated by bonded clients with MITM protection.
+  const bool ota_allowed = global_ble_controller->get_security_mode() == BLESecurityMode::SECURE;
+  if (ota_allowed) {
+    num_handles += BLEOTAHandler::NUM_HANDLES;
+  } else {
+    ESP_LOGE(TAG, "OTA requires security mode 'secure', not exposing it");
+  }
+#endif
+  maintenance_service = ble_server->createService(BLEUUID(SERVICE_UUID), num_handles);
+  BLEService* service = maintenance_service;
+
+  ble_command_characteristic = create_writeable_ble_characteristic(service, BLEUUID(CHARACTERISTIC_UUID_CMD), this, "BLE Command Channel");
   ble_command_characteristic->setValue("Send 'help' for help.");
  
 #ifdef USE_LOGGER
-  logging_characteristic = create_read_only_ble_characteristic(service, CHARACTERISTIC_UUID_LOGGING, "Log messages");
+  logging_characteristic = create_read_only_ble_characteristic(service, BLEUUID(CHARACTERISTIC_UUID_LOGGING), "Log messages");
+#endif
+
+  if (diagnostics_characteristic_exposed) {
+    diagnostics_characteristic = create_read_only_ble_characteristic(service, BLEUUID(CHARACTERISTIC_UUID_DIAGNOSTICS), "Diagnostics", false);
+  }
+
+  if (snapshot_characteristic_exposed) {
+    snapshot_characteristic = create_writeable_ble_characteristic(service, BLEUUID(CHARACTERISTIC_UUID_SNAPSHOT), this, "State snapshot");
+    snapshot.resize(MAX_SNAPSHOT_LENGTH);
+  }
+
+  if (has_history) {
+    history_characteristic = create_writeable_ble_characteristic(service, BLEUUID(CHARACTERISTIC_UUID_HISTORY), this, "History download");
+  }
+
+  if (batch_characteristic_exposed) {
+    batch_characteristic = create_writeable_ble_characteristic(service, BLEUUID(CHARACTERISTIC_UUID_BATCH), this, "Batch control");
+  }
+
+#ifdef USE_BLE_CONTROLLER_OTA
+  if (ota_allowed) {
+    ota_handler.setup(service);
+  }
 #endif
 
   service->start();
@@ -70,74 +179,384 @@ void BLEMaintenanceHandler::setup(BLEServer* ble_server) {
 #endif
 }
 
+void BLEMaintenanceHandler::loop() {
+  send_queued_command_results();
+  update_diagnostics();
+  update_snapshot();
+  send_history_frames();
+#ifdef USE_BLE_CONTROLLER_OTA
+  ota_handler.loop();
+#endif
+
+#ifdef USE_LOGGER
+  send_buffered_log_messages();
+#endif
+}
+
+/// Continuations of the snapshot are answered to the writing client only, so this write needs the connection (the other writes are handled below).
+void BLEMaintenanceHandler::onWrite(BLECharacteristic *characteristic, esp_ble_gatts_cb_param_t *param) {
+  if (characteristic != snapshot_characteristic) {
+    onWrite(characteristic);
+    return;
+  }
+
+  const uint16_t conn_id = param->write.conn_id;
+  const uint8_t first_index = characteristic->getLength() > 0 ? characteristic->getData()[0] : 0;
+  global_ble_controller->execute_in_loop([this, conn_id, first_index](){
+    on_snapshot_continuation_requested(conn_id, first_index);
+  }, BLEDeferredLane::COMMANDS);
+}
+
 void BLEMaintenanceHandler::onWrite(BLECharacteristic *characteristic) {
   if (characteristic == ble_command_characteristic) {
-    global_ble_controller->execute_in_loop([this](){ on_command_written(); });
+    const uint32_t written_micros = micros();
+    global_ble_controller->execute_in_loop([this, written_micros](){
+      statistics.write_latency.add(micros() - written_micros);
+      on_command_written();
+    }, BLEDeferredLane::COMMANDS);
+  } else if (characteristic == history_characteristic) {
+    // The request is small, so it is parsed right here and passed on by value (the BLE task may overwrite the value before the main loop runs).
+    const uint8_t* data = characteristic->getData();
+    const size_t length = characteristic->getLength();
+    if (length == 0) {
+      return;
+    }
+    const uint8_t component_index = data[0];
+    const uint32_t cursor = length >= 5 ? data[1] | (data[2] << 8) | (data[3] << 16) | (uint32_t(data[4]) << 24) : 0;
+    global_ble_controller->execute_in_loop([this, component_index, cursor](){
+      on_history_download_requested(component_index, cursor);
+    }, BLEDeferredLane::COMMANDS);
+  } else if (characteristic == batch_characteristic) {
+    const uint32_t written_micros = micros();
+    global_ble_controller->execute_in_loop([this, written_micros](){
+      statistics.write_latency.add(micros() - written_micros);
+      on_batch_written();
+    }, BLEDeferredLane::COMMANDS);
   } else {
     ESP_LOGW(TAG, "Unknown characteristic written!");
   }
 }
 
+/**
+ * Applies all records of the written batch in this loop pass, so that the components change together, then notifies one result:
+ * the number of applied records, the number of rejected records and the indices of the rejected components.
+ */
+void BLEMaintenanceHandler::on_batch_written() {
+  uint8_t batch[BLE_MAX_MTU];
+  const size_t length = std::min(batch_characteristic->getLength(), sizeof(batch));
+  memcpy(batch, batch_characteristic->getData(), length); // the BLE task may overwrite the value while the records are applied
+
+  // the rejected indices go right into the result (each record takes at least 2 bytes, so the batch has fewer records than the result has room for)
+  uint8_t result[BLE_MAX_MTU - 3];
+  size_t rejected_count;
+  const size_t applied_count = global_ble_controller->apply_batch_writes(batch, length, result + 2, sizeof(result) - 2, rejected_count);
+
+  // the counts saturate at 255, the list is cut to what fits into a notification
+  const size_t listed_count = std::min<size_t>(rejected_count, global_ble_controller->get_max_notification_length() - 2u);
+  result[0] = std::min<size_t>(applied_count, UINT8_MAX);
+  result[1] = std::min<size_t>(rejected_count, UINT8_MAX);
+  batch_characteristic->setValue(result, 2 + listed_count);
+  global_ble_controller->notify(batch_characteristic, &statistics);
+}
+
+/// A command may start with a sequence tag "#<id>", which is prepended to its results.
+static bool is_sequence_tag(string_view token) { return token.length() > 1 && token[0] == '#'; }
+
+/**
+ * Parses the written command line and executes its commands in order. Commands are separated by newlines or ';', except for commands whose arguments
+ * may contain ';' (see BLECommand::takes_rest_of_line()), which end at the end of their line. If the write contains more than MAX_PIPELINED_COMMANDS
+ * commands, none of them is executed. The command line is copied to the stack (the BLE task may overwrite the characteristic value at any time), and the
+ * tokens are views into this copy, so no memory is allocated before the commands themselves run.
+ */
 void BLEMaintenanceHandler::on_command_written() {
-  string command_line = ble_command_characteristic->getValue();
-  ESP_LOGD(TAG, "Received BLE command: %s", command_line.c_str());
-  vector<string> tokens = split(command_line);
-  if (!tokens.empty()) {
-    string command_name = tokens[0];
-    for (const auto& command : get_commands()) {
-      if (command->get_name() == command_name) {
-        ESP_LOGI(TAG, "Executing BLE command: %s", command_name.c_str());
-        tokens.erase(tokens.begin());
-        command->execute(tokens);
+  char command_line[BLE_MAX_MTU];
+  const size_t length = std::min(ble_command_characteristic->getLength(), sizeof(command_line));
+  memcpy(command_line, ble_command_characteristic->getData(), length);
+  ESP_LOGD(TAG, "Received BLE command: %.*s", (int) length, command_line);
+
+  string_view command_texts[MAX_PIPELINED_COMMANDS];
+  size_t command_count = 0;
+  string_view lines(command_line, length);
+  while (!lines.empty()) {
+    const size_t line_end = lines.find('\n');
+    string_view line = lines.substr(0, line_end);
+    lines = line_end == string_view::npos ? string_view() : lines.substr(line_end + 1);
+
+    while (!line.empty()) {
+      const string_view command_text = take_command(line);
+      if (command_text.find_first_not_of(" \r") == string_view::npos) {
+        continue;
+      }
+      if (command_count == MAX_PIPELINED_COMMANDS) {
+        send_command_result("Too many commands, at most " + to_string(MAX_PIPELINED_COMMANDS) + " per write; none executed.");
         return;
       }
+      command_texts[command_count++] = command_text;
     }
-    send_command_result("Unkown command '" + command_name + "', try 'help'.");
+  }
+
+  for (size_t i = 0; i < command_count; ++i) {
+    execute_command(command_texts[i]);
   }
 }
 
-void BLEMaintenanceHandler::send_command_result(const string& result_message) {
-  if (ble_command_characteristic != nullptr) {
-    global_ble_controller->execute_in_loop([this, result_message] { 
-      ble_command_characteristic->setValue(result_message);
-    });
+/// Returns the first command of the line (up to the next ';' or the whole line, see on_command_written()) and removes it from the line.
+string_view BLEMaintenanceHandler::take_command(string_view& line) const {
+  const size_t delimiter = line.find(';');
+  string_view words[2];
+  const size_t word_count = tokenize(line.substr(0, delimiter), words, 2, " \r");
+  const size_t name_index = word_count > 0 && is_sequence_tag(words[0]) ? 1 : 0;
+  const BLECommand* command = name_index < word_count ? find_command(words[name_index]) : nullptr;
+
+  if (delimiter == string_view::npos || (command != nullptr && command->takes_rest_of_line())) {
+    const string_view command_text = line;
+    line = {};
+    return command_text;
+  }
+  const string_view command_text = line.substr(0, delimiter);
+  line.remove_prefix(delimiter + 1);
+  return command_text;
+}
+
+void BLEMaintenanceHandler::execute_command(string_view command_text) {
+  // one more token than allowed, to detect commands with too many arguments
+  string_view tokens[MAX_COMMAND_TOKENS + 1];
+  const size_t token_count = tokenize(command_text, tokens, MAX_COMMAND_TOKENS + 1, " \r");
+
+  size_t first_token = 0;
+  current_sequence_tag = {};
+  if (token_count > 0 && is_sequence_tag(tokens[0])) {
+    current_sequence_tag = tokens[0];
+    first_token = 1;
+  }
+  if (first_token == token_count) {
+    return;
   }
 
-  // global_ble_controller->execute_in_loop([this, result_message] { 
-  //   const uint32_t delay_millis = 50;
-  //   App.scheduler.set_timeout(global_ble_controller, "command_result", delay_millis, [this, result_message]{ ble_command_characteristic->setValue(result_message); });
-  // });
+  const string_view& command_name = tokens[first_token];
+  const BLECommand* command = find_command(command_name);
+  if (token_count > MAX_COMMAND_TOKENS) {
+    send_command_result("Too many arguments for '" + string(command_name) + "', at most " + to_string(MAX_COMMAND_TOKENS) + " words per command including the sequence tag.");
+  } else if (command != nullptr) {
+    ESP_LOGI(TAG, "Executing BLE command: %s", command->get_name().data());
+    command->execute(BLECommandArguments(tokens + first_token + 1, token_count - first_token - 1));
+  } else {
+    send_command_result("Unkown command '" + string(command_name) + "', try 'help'.");
+  }
+
+  // The tag points into the command line, results sent later on (e.g. by automations) are not tagged.
+  current_sequence_tag = {};
 }
 
-bool BLEMaintenanceHandler::is_security_enabled() {
-  return global_ble_controller->get_security_enabled();
+const BLECommand* BLEMaintenanceHandler::find_command(string_view name) const {
+  auto position = std::lower_bound(commands.begin(), commands.end(), name, [](const BLECommand* command, string_view name) { return command->get_name() < name; });
+  return position != commands.end() && (*position)->get_name() == name ? *position : nullptr;
+}
+
+/// Queues the result (tagged with the sequence tag of the executing command, if any), it is notified in the main loop (see send_queued_command_results()).
+void BLEMaintenanceHandler::send_command_result(const string& result_message) {
+  if (ble_command_characteristic == nullptr) {
+    return;
+  }
+
+  if (queued_command_result_count == MAX_QUEUED_COMMAND_RESULTS) {
+    ESP_LOGW(TAG, "Command result queue full, result dropped");
+    return;
+  }
+
+  string& result = queued_command_results[(first_queued_command_result + queued_command_result_count) % MAX_QUEUED_COMMAND_RESULTS];
+  if (current_sequence_tag.empty()) {
+    result = result_message;
+  } else {
+    result.assign(current_sequence_tag.data(), current_sequence_tag.length());
+    result += ' ';
+    result += result_message;
+  }
+  ++queued_command_result_count;
 }
 
-#ifdef USE_LOGGER
 /**
- * Removes magic logger symbols from the message, e.g., sequences that mark the start or the end, or a color.
+ * Sends the queued command results in order, each as notification (or as a sequence of chunks if results are chunked).
+ * Afterwards the characteristic value is the last result, so that the client can also (long-)read it.
  */
-string remove_logger_magic(const string& message) {
-  // Note: We do not use regex replacement because it enlarges the binary by roughly 50kb!
-  string result;
-  bool within_magic = false;
-  for (string::size_type i = 0; i < message.length() - 1; ++i) {
-    if (message[i] == '\033' && message[i+1] == '[') { // log magic always starts with "\033[" see log.h
-      within_magic = true;
-      ++i;
-    } else if (within_magic) {
-      within_magic = (message[i] != 'm');
+void BLEMaintenanceHandler::send_queued_command_results() {
+  for (int i = 0; i < MAX_COMMAND_RESULT_NOTIFICATIONS_PER_LOOP && global_ble_controller->has_notification_capacity(); ++i) {
+    if (streaming_command_result) {
+      send_command_result_chunk();
+      continue;
+    }
+
+    if (queued_command_result_count == 0) {
+      return;
+    }
+
+    string& result = queued_command_results[first_queued_command_result];
+    first_queued_command_result = (first_queued_command_result + 1) % MAX_QUEUED_COMMAND_RESULTS;
+    --queued_command_result_count;
+
+    if (chunked_command_results) {
+      streamed_command_result.swap(result);
+      streamed_command_result_offset = 0;
+      streaming_command_result = true;
     } else {
-      result.push_back(message[i]);
+      ble_command_characteristic->setValue(result);
+      global_ble_controller->notify(ble_command_characteristic, &statistics);
     }
+    result.clear();
   }
-  return result;
 }
 
+/**
+ * Sends the next chunk of the current command result as notification, which fits into the MTU.
+ * Every chunk consists of a sequence number (incremented for each chunk, wrapping around), a flags byte (CHUNK_FLAG_LAST marks the last chunk of a result), and the payload.
+ * After the last chunk the characteristic value is set to the complete result.
+ */
+void BLEMaintenanceHandler::send_command_result_chunk() {
+  uint8_t chunk[BLE_MAX_MTU - 3];
+  const size_t max_payload_length = std::min<size_t>(global_ble_controller->get_max_notification_length(), sizeof(chunk)) - CHUNK_HEADER_LENGTH;
+
+  const size_t remaining_length = streamed_command_result.length() - streamed_command_result_offset;
+  const size_t payload_length = std::min(remaining_length, max_payload_length);
+  const bool last = payload_length == remaining_length;
+
+  chunk[0] = next_chunk_sequence_number++;
+  chunk[1] = last ? CHUNK_FLAG_LAST : 0;
+  memcpy(chunk + CHUNK_HEADER_LENGTH, streamed_command_result.data() + streamed_command_result_offset, payload_length);
+  streamed_command_result_offset += payload_length;
+
+  ble_command_characteristic->setValue(chunk, CHUNK_HEADER_LENGTH + payload_length);
+  global_ble_controller->notify(ble_command_characteristic, &statistics);
+
+  if (last) {
+    ble_command_characteristic->setValue(streamed_command_result);
+    streamed_command_result.clear();
+    streaming_command_result = false;
+  }
+}
+
+void BLEMaintenanceHandler::update_diagnostics() {
+  if (diagnostics_characteristic == nullptr || millis() - last_diagnostics_update_millis < DIAGNOSTICS_UPDATE_INTERVAL_MILLIS) {
+    return;
+  }
+
+  diagnostics_characteristic->setValue(global_ble_controller->get_statistics_report());
+  last_diagnostics_update_millis = millis();
+}
+
+/// Rebuilds the snapshot if a component state has changed since the last build or a client has written the characteristic (at most once per loop).
+void BLEMaintenanceHandler::update_snapshot() {
+  if (snapshot_characteristic == nullptr) {
+    return;
+  }
+
+  const uint32_t generation = global_ble_controller->get_state_generation();
+  if (generation == snapshot_generation && !snapshot_outdated) {
+    return;
+  }
+
+  const size_t length = global_ble_controller->write_state_snapshot(snapshot.data(), snapshot.size(), 0);
+  snapshot_characteristic->setValue(snapshot.data(), length);
+  snapshot_generation = generation;
+  snapshot_outdated = false;
+}
+
+/**
+ * The client asks for the entries from the given component index on, they are notified to this client only (the header echoes the index), so that
+ * clients that continue at the same time do not get each other's entries. The readable value stays the snapshot from the first component on.
+ */
+void BLEMaintenanceHandler::on_snapshot_continuation_requested(uint16_t conn_id, uint8_t first_index) {
+  snapshot_outdated = true; // the write has replaced the value
+
+  uint8_t continuation[BLE_MAX_MTU - 3];
+  const size_t max_length = std::min<size_t>(global_ble_controller->get_max_notification_length(), sizeof(continuation));
+  const size_t length = global_ble_controller->write_state_snapshot(continuation, max_length, first_index);
+  global_ble_controller->notify(conn_id, snapshot_characteristic, continuation, length, &statistics);
+  update_snapshot();
+}
+
+void BLEMaintenanceHandler::on_history_download_requested(uint8_t component_index, uint32_t cursor) {
+  if (global_ble_controller->get_history(component_index) == nullptr) {
+    ESP_LOGW(TAG, "No history for component %d", component_index);
+    return;
+  }
+  ESP_LOGD(TAG, "History download of component %d from %u", component_index, cursor);
+  history_download_index = component_index;
+  history_download_cursor = BLEHistoryCursor(cursor);
+}
+
+/**
+ * Streams the requested history as notifications, each frame fits into the MTU (see BLESensorHistory::write_frame()).
+ * The download ends with a frame without samples, which tells the client the cursor for its next download and the current time.
+ */
+void BLEMaintenanceHandler::send_history_frames() {
+  if (history_download_index < 0) {
+    return;
+  }
+
+  const BLESensorHistory* history = global_ble_controller->get_history(history_download_index);
+  uint8_t frame[BLE_MAX_MTU - 3];
+  const size_t max_length = std::min<size_t>(global_ble_controller->get_max_notification_length(), sizeof(frame));
+  for (int i = 0; i < MAX_HISTORY_FRAMES_PER_LOOP && global_ble_controller->has_notification_capacity(); ++i) {
+    const size_t length = history->write_frame(history_download_index, history_download_cursor, millis() / 1000, frame, max_length);
+    history_characteristic->setValue(frame, length);
+    global_ble_controller->notify(history_characteristic, &statistics);
+
+    if (length < BLESensorHistory::FRAME_HEADER_LENGTH || frame[2] == 0) {
+      history_download_index = -1; // the frame without samples has been sent
+      return;
+    }
+  }
+}
+
+void BLEMaintenanceHandler::reset_statistics() {
+  statistics = BLEHandlerStatistics();
+#ifdef USE_LOGGER
+  dropped_log_lines = 0;
+#endif
+}
+
+bool BLEMaintenanceHandler::is_security_enabled() {
+  return global_ble_controller->get_security_enabled();
+}
+
+#ifdef USE_LOGGER
+/// Buffers the log message; it is sent later in the main loop together with other messages (see send_buffered_log_messages()).
 void BLEMaintenanceHandler::send_log_message(int level, const char *tag, const char *message) {
   if (logging_characteristic != nullptr && level <= this->log_level) {
-    logging_characteristic->setValue(remove_logger_magic(message));
-    logging_characteristic->notify();
+    log_buffer.push_line(message);
+  }
+}
+
+/**
+ * Sends the buffered log messages, packing as many lines into each notification as fit into the MTU.
+ * If lines have been dropped because the buffer was full, this is reported first.
+ */
+void BLEMaintenanceHandler::send_buffered_log_messages() {
+  if (logging_characteristic == nullptr) {
+    return;
+  }
+
+  char chunk[MAX_LOG_NOTIFICATION_LENGTH];
+  const size_t max_length = std::min<size_t>(global_ble_controller->get_max_notification_length(), sizeof(chunk));
+
+  const uint32_t dropped_lines = log_buffer.take_dropped_lines();
+  if (dropped_lines > 0) {
+    dropped_log_lines += dropped_lines;
+    const int length = snprintf(chunk, std::min<size_t>(max_length + 1, sizeof(chunk)), "[%u log lines dropped]", dropped_lines);
+    logging_characteristic->setValue(reinterpret_cast<uint8_t*>(chunk), std::min<size_t>(length, max_length));
+    global_ble_controller->notify(logging_characteristic, &statistics);
+  }
+
+  for (int i = 0; i < MAX_LOG_NOTIFICATIONS_PER_LOOP; ++i) {
+    size_t length;
+    if (!log_buffer.pop_lines(chunk, max_length, length)) {
+      break;
+    }
+    if (length == 0) {
+      continue; // an empty line, nothing to send
+    }
+    logging_characteristic->setValue(reinterpret_cast<uint8_t*>(chunk), length);
+    global_ble_controller->notify(logging_characteristic, &statistics);
   }
 }
 #endif
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <BLEServer.h>
@@ -8,7 +9,13 @@
 
 #include "esphome/core/defines.h"
 
+#include "ble_ota_handler.h"
+#include "ble_sensor_history.h"
+#include "ble_statistics.h"
+#include "log_ring_buffer.h"
+
 using std::string;
+using std::string_view;
 using std::vector;
 
 namespace esphome {
@@ -29,34 +36,118 @@ public:
   virtual ~BLEMaintenanceHandler() {}
 
   void setup(BLEServer* ble_server);
+  /// Returns the maintenance service, nullptr if it has not been set up (yet).
+  BLEService* get_service() const { return maintenance_service; }
+
+  void loop();
 
   void add_command(BLECommand* command) { commands.push_back(command); }
+  /// Returns all commands sorted by name (once the handler is set up).
   const vector<BLECommand*>& get_commands() const { return commands; }
+  /// Returns the command with the given name, nullptr if there is none.
+  const BLECommand* find_command(string_view name) const;
   void send_command_result(const string& result_message);
 
+  /// When chunked, command results are streamed as sequences of notifications (see send_command_result_chunk()).
+  void set_chunked_command_results(bool chunked) { chunked_command_results = chunked; }
+
+  /// When exposed, a read-only characteristic provides the statistics report of the controller (refreshed periodically).
+  void set_diagnostics_characteristic_exposed(bool exposed) { diagnostics_characteristic_exposed = exposed; }
+
+  /// When exposed, a characteristic provides a snapshot of the states of all exposed components (rebuilt whenever a state changes), clients write the index to continue from if it does not fit and get the rest notified.
+  void set_snapshot_characteristic_exposed(bool exposed) { snapshot_characteristic_exposed = exposed; }
+
+  /// When exposed, clients can write several components at once with a single write to the batch characteristic (applied in a single loop pass).
+  void set_batch_characteristic_exposed(bool exposed) { batch_characteristic_exposed = exposed; }
+
+#ifdef USE_BLE_CONTROLLER_OTA
+  const BLEOTAHandler& get_ota_handler() const { return ota_handler; }
+#endif
+
+  /// Returns the statistics of the command and logging characteristics (write latency = from writing a command to its execution).
+  const BLEHandlerStatistics& get_statistics() const { return statistics; }
+  void reset_statistics();
+
 #ifdef USE_LOGGER
   int get_log_level() { return log_level; }
   void set_log_level(int level) { log_level = level; }
 
+  uint32_t get_dropped_log_lines() const { return dropped_log_lines; }
+
   void send_log_message(int level, const char *tag, const char *message);
 #endif
 
 private:
+  virtual void onWrite(BLECharacteristic *characteristic, esp_ble_gatts_cb_param_t *param) override;
   virtual void onWrite(BLECharacteristic *characteristic) override;
   void on_command_written();
+  string_view take_command(string_view& line) const;
+  void execute_command(string_view command_text);
+
+  void send_queued_command_results();
+  void send_command_result_chunk();
+  void update_diagnostics();
+  void update_snapshot();
+  void on_snapshot_continuation_requested(uint16_t conn_id, uint8_t first_index);
+  void on_history_download_requested(uint8_t component_index, uint32_t cursor);
+  void send_history_frames();
+  void on_batch_written();
+
+#ifdef USE_LOGGER
+  void send_buffered_log_messages();
+#endif
 
   bool is_security_enabled();
   
 private:
-  BLEService* maintenance_service;
+  BLEService* maintenance_service{nullptr};
 
   BLECharacteristic* ble_command_characteristic;
   vector<BLECommand*> commands;
 
+  /// sequence tag of the command that is currently executed (empty if none), points into the command line copy
+  string_view current_sequence_tag;
+
+  static const size_t MAX_QUEUED_COMMAND_RESULTS = 8;
+  string queued_command_results[MAX_QUEUED_COMMAND_RESULTS];
+  size_t first_queued_command_result{0};
+  size_t queued_command_result_count{0};
+
+  bool chunked_command_results{false};
+  string streamed_command_result;
+  size_t streamed_command_result_offset{0};
+  uint8_t next_chunk_sequence_number{0};
+  bool streaming_command_result{false};
+
+  bool diagnostics_characteristic_exposed{false};
+  BLECharacteristic* diagnostics_characteristic{nullptr};
+  uint32_t last_diagnostics_update_millis{0};
+
+  bool snapshot_characteristic_exposed{false};
+  BLECharacteristic* snapshot_characteristic{nullptr};
+  vector<uint8_t> snapshot;
+  uint32_t snapshot_generation{0};
+  bool snapshot_outdated{true};
+
+  bool batch_characteristic_exposed{false};
+  BLECharacteristic* batch_characteristic{nullptr};
+
+  BLECharacteristic* history_characteristic{nullptr};
+  int history_download_index{-1}; // index of the component whose history is being downloaded, -1 if none
+  BLEHistoryCursor history_download_cursor;
+
+#ifdef USE_BLE_CONTROLLER_OTA
+  BLEOTAHandler ota_handler;
+#endif
+
+  BLEHandlerStatistics statistics;
+
 #ifdef USE_LOGGER
   int log_level;
 
   BLECharacteristic* logging_characteristic;
+  LogRingBuffer log_buffer;
+  uint32_t dropped_log_lines{0};
 #endif
 };
 
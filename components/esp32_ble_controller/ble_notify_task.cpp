@@ -0,0 +1,114 @@
+#include "ble_notify_task.h"
+
+#ifdef USE_BLE_CONTROLLER_NOTIFY_TASK
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#include "ble_stack.h"
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+static const char *TAG = "ble_notify_task";
+
+static const uint32_t NOTIFY_TASK_STACK_SIZE = 3072;
+/// maximum time to wait for the end of a congestion, afterwards the notification is passed to the stack anyway (which queues or drops it)
+static const uint32_t MAX_CONGESTION_WAIT_MILLIS = 250;
+
+void BLENotifyTask::start() {
+  if (task != nullptr) {
+    return;
+  }
+
+  if (xTaskCreatePinnedToCore(run, "ble_notify", NOTIFY_TASK_STACK_SIZE, this, BLE_CONTROLLER_NOTIFY_TASK_PRIORITY, &task, BLE_CONTROLLER_NOTIFY_TASK_CORE) != pdPASS) {
+    ESP_LOGE(TAG, "Cannot create notification task");
+    task = nullptr;
+  }
+}
+
+bool BLENotifyTask::enqueue(uint16_t conn_id, uint16_t handle, const uint8_t* value, uint16_t length) {
+  if (task == nullptr) {
+    return false;
+  }
+
+  BLEQueuedNotification notification;
+  notification.conn_id = conn_id;
+  notification.handle = handle;
+  notification.length = std::min(length, BLEQueuedNotification::MAX_VALUE_LENGTH);
+  memcpy(notification.value, value, notification.length);
+  return queue.push(std::move(notification));
+}
+
+void BLENotifyTask::on_congestion_changed(uint16_t conn_id, bool congested) {
+  const uint32_t mask = 1u << (conn_id & 31);
+  if (congested) {
+    congested_connections.fetch_or(mask);
+  } else if ((congested_connections.fetch_and(~mask) & mask) && task != nullptr) {
+    xTaskNotifyGive(task);
+  }
+}
+
+/// Body of the task: blocks until a notification is queued, then sends it and all notifications queued in the meantime as one batch.
+void BLENotifyTask::run(void* parameter) {
+  BLENotifyTask* self = static_cast<BLENotifyTask*>(parameter);
+  BLEQueuedNotification notification;
+  while (true) {
+    if (!self->queue.take(notification, portMAX_DELAY)) {
+      continue;
+    }
+
+    uint32_t batch_size = 0;
+    do {
+      self->send(notification);
+      ++batch_size;
+    } while (self->queue.take(notification));
+
+    if (batch_size > self->max_batch_size.load()) {
+      self->max_batch_size.store(batch_size);
+    }
+  }
+}
+
+void BLENotifyTask::send(const BLEQueuedNotification& notification) {
+  if (is_congested(notification.conn_id)) {
+    ++congestion_waits;
+    // the congestion event wakes us up (notifications of other connections wait as well, which keeps their order)
+    const uint32_t start_millis = millis();
+    while (is_congested(notification.conn_id) && millis() - start_millis < MAX_CONGESTION_WAIT_MILLIS) {
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MAX_CONGESTION_WAIT_MILLIS));
+    }
+  }
+
+  const BLEStackResult result = send_ble_notification(notification.conn_id, notification.handle, notification.value, notification.length);
+  if (result == BLEStackResult::OK) {
+    ++sent_notifications;
+  } else {
+    ++failed_notifications;
+  }
+}
+
+string BLENotifyTask::get_statistics_report() const {
+  char line[128];
+  snprintf(line, sizeof(line), "notify task: %u sent, %u failed, %u dropped, %u congestion waits, max batch %u, queue max %u/%u",
+           sent_notifications.load(), failed_notifications.load(), queue.get_push_failures(), congestion_waits.load(), max_batch_size.load(),
+           queue.get_high_water_mark(), BLE_CONTROLLER_NOTIFY_QUEUE_DEPTH);
+  return line;
+}
+
+void BLENotifyTask::reset_statistics() {
+  queue.reset_statistics();
+  sent_notifications = 0;
+  failed_notifications = 0;
+  congestion_waits = 0;
+  max_batch_size = 0;
+}
+
+} // namespace esp32_ble_controller
+} // namespace esphome
+
+#endif
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_BLE_CONTROLLER_NOTIFY_TASK
+
+#include <atomic>
+#include <string>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <esp_gatts_api.h>
+
+#include "ble_utils.h"
+#include "thread_safe_bounded_queue.h"
+
+using std::string;
+
+// settings of the task (configurable via yaml)
+#ifndef BLE_CONTROLLER_NOTIFY_TASK_CORE
+#define BLE_CONTROLLER_NOTIFY_TASK_CORE 0
+#endif
+#ifndef BLE_CONTROLLER_NOTIFY_TASK_PRIORITY
+#define BLE_CONTROLLER_NOTIFY_TASK_PRIORITY 5
+#endif
+#ifndef BLE_CONTROLLER_NOTIFY_QUEUE_DEPTH
+#define BLE_CONTROLLER_NOTIFY_QUEUE_DEPTH 32
+#endif
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+/**
+ * A notification passed from the main loop to the notification task, it holds a copy of the value because the characteristic may change in the meantime.
+ * The value is stored inline (a notification carries at most MTU - 3 bytes), so that queueing a notification does not allocate.
+ */
+struct BLEQueuedNotification {
+  static constexpr uint16_t MAX_VALUE_LENGTH = BLE_MAX_MTU - 3;
+
+  uint16_t conn_id{0};
+  uint16_t handle{0};
+  uint16_t length{0};
+  uint8_t value[MAX_VALUE_LENGTH];
+};
+
+/**
+ * Sending a notification into a congested link can stall the caller for milliseconds, so with this task the main loop only queues notifications.
+ * The task is pinned to the core of the BLE stack, sends all queued notifications in a batch and waits while a connection is congested 
+ * (until the stack reports that the congestion is over, see on_congestion_changed()).
+ * @brief FreeRTOS task that sends the notifications on behalf of the main loop
+ */
+class BLENotifyTask {
+public:
+  /// Creates the task, which sends the notifications through the stack layer (see ble_stack.h).
+  void start();
+
+  /// Queues a notification with the given value (called by the main loop, values longer than an MTU are cut), returns false if the queue is full (the notification is dropped then).
+  bool enqueue(uint16_t conn_id, uint16_t handle, const uint8_t* value, uint16_t length);
+  /// Returns the number of notifications that can be queued before the queue is full.
+  uint32_t get_free_capacity() const { return queue.get_free_capacity(); }
+
+  /// Called by the BLE stack (in the BLE task) when a connection becomes congested or uncongested (also when it has been closed).
+  void on_congestion_changed(uint16_t conn_id, bool congested);
+
+  string get_statistics_report() const;
+  void reset_statistics();
+
+private:
+  static void run(void* parameter);
+  void send(const BLEQueuedNotification& notification);
+  bool is_congested(uint16_t conn_id) const { return congested_connections.load() & (1u << (conn_id & 31)); }
+
+  ThreadSafeBoundedQueue<BLEQueuedNotification, BLE_CONTROLLER_NOTIFY_QUEUE_DEPTH> queue;
+
+  TaskHandle_t task{nullptr};
+  std::atomic<uint32_t> congested_connections{0}; // bit mask of the connection ids
+
+  std::atomic<uint32_t> sent_notifications{0};
+  std::atomic<uint32_t> failed_notifications{0};
+  std::atomic<uint32_t> congestion_waits{0};
+  std::atomic<uint32_t> max_batch_size{0};
+};
+
+} // namespace esp32_ble_controller
+} // namespace esphome
+
+#endif
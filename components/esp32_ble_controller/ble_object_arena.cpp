@@ -0,0 +1,74 @@
+#include "ble_object_arena.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include <BLE2902.h>
+#include <BLE2904.h>
+
+#include "ble_command.h"
+#include "ble_component_handler.h"
+#include "ble_fan_handler.h"
+#include "ble_light_handler.h"
+#include "ble_sensor_handler.h"
+#include "ble_switch_handler.h"
+#include "ble_text_sensor_handler.h"
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+/// Returns the size of an arena slot for an object of the given type, i.e. its size rounded up to the maximum alignment.
+template <typename T>
+static constexpr size_t slot_size() {
+  return (sizeof(T) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+}
+
+/// Each component characteristic needs one handler; as the handler type is not known at compile time, each one gets a slot for the largest handler.
+static constexpr size_t MAX_HANDLER_SIZE = std::max({
+  slot_size<BLEComponentHandler<EntityBase>>(),
+#ifdef USE_FAN
+  slot_size<BLEFanHandler>(),
+#endif
+#ifdef USE_LIGHT
+  slot_size<BLELightHandler>(),
+#endif
+#ifdef USE_SENSOR
+  slot_size<BLESensorHandler>(),
+#endif
+#ifdef USE_SWITCH
+  slot_size<BLESwitchHandler>(),
+#endif
+#ifdef USE_TEXT_SENSOR
+  slot_size<BLETextSensorHandler>(),
+#endif
+});
+
+static constexpr size_t MAX_DESCRIPTOR_SIZE = std::max({ slot_size<BLEDescriptor>(), slot_size<BLE2902>(), slot_size<BLE2904>() });
+/// Each characteristic has up to three descriptors (0x2901, 0x2902 and 0x2904).
+static constexpr size_t MAX_DESCRIPTORS_PER_CHARACTERISTIC = 3;
+static constexpr size_t ARENA_SIZE = BLE_CONTROLLER_NUM_CHARACTERISTICS * MAX_HANDLER_SIZE
+                                   + (BLE_CONTROLLER_NUM_CHARACTERISTICS + NUM_MAINTENANCE_CHARACTERISTICS) * MAX_DESCRIPTORS_PER_CHARACTERISTIC * MAX_DESCRIPTOR_SIZE
+                                   + BLE_CONTROLLER_NUM_CUSTOM_COMMANDS * slot_size<BLECustomCommand>();
+
+alignas(std::max_align_t) static uint8_t arena[ARENA_SIZE];
+
+size_t BLEObjectArena::used_bytes = 0;
+size_t BLEObjectArena::heap_bytes = 0;
+
+size_t BLEObjectArena::get_capacity() {
+  return ARENA_SIZE;
+}
+
+void* BLEObjectArena::allocate(size_t size, size_t alignment) {
+  const size_t offset = (used_bytes + alignment - 1) / alignment * alignment;
+  if (offset + size > ARENA_SIZE) {
+    heap_bytes += size;
+    return ::operator new(size);
+  }
+
+  used_bytes = offset + size;
+  return &arena[offset];
+}
+
+} // namespace esp32_ble_controller
+} // namespace esphome
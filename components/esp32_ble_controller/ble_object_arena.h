@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+#include "esphome/core/defines.h"
+
+// numbers of the objects the controller creates at setup (generated from the yaml configuration)
+#ifndef BLE_CONTROLLER_NUM_CHARACTERISTICS
+#define BLE_CONTROLLER_NUM_CHARACTERISTICS 0
+#endif
+#ifndef BLE_CONTROLLER_NUM_CUSTOM_COMMANDS
+#define BLE_CONTROLLER_NUM_CUSTOM_COMMANDS 0
+#endif
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+/// command, logging, diagnostics, snapshot, history and batch characteristics of the maintenance service (plus control and data characteristics for OTA)
+#ifdef USE_BLE_CONTROLLER_OTA
+static constexpr size_t NUM_MAINTENANCE_CHARACTERISTICS = 8;
+#else
+static constexpr size_t NUM_MAINTENANCE_CHARACTERISTICS = 6;
+#endif
+
+/**
+ * The controller creates its component handlers, descriptors and custom commands once (in the main loop task) and never frees them.
+ * Allocating them one by one fragments the heap right at boot, so they are placed one after another into a static arena, which is sized at compile time 
+ * for the configured characteristics and commands. If the arena is exhausted anyway, objects are allocated on the heap as before.
+ * @brief Static memory for the objects the controller creates at setup
+ */
+class BLEObjectArena {
+public:
+  /// Creates an object of the given type in the arena, it must never be deleted.
+  template <typename T, typename... Args>
+  static T* create(Args&&... args) { return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...); }
+
+  /// Returns the size of the arena in bytes.
+  static size_t get_capacity();
+  /// Returns the number of bytes used in the arena.
+  static size_t get_used_bytes() { return used_bytes; }
+  /// Returns the number of bytes allocated on the heap because the arena was exhausted.
+  static size_t get_heap_bytes() { return heap_bytes; }
+
+private:
+  static void* allocate(size_t size, size_t alignment);
+
+  static size_t used_bytes;
+  static size_t heap_bytes;
+};
+
+} // namespace esp32_ble_controller
+} // namespace esphome
@@ -0,0 +1,398 @@
+#include "ble_ota_handler.h"
+
+#ifdef USE_BLE_CONTROLLER_OTA
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#include "esphome/core/application.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#include "esp32_ble_controller.h"
+#include "ble_stack.h"
+#include "ble_utils.h"
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+static const char *TAG = "ble_ota_handler";
+
+#define CHARACTERISTIC_UUID_OTA_CONTROL "9c4f2e71-5b3a-4d8e-a6c2-0f7e1b9d3a58"
+#define CHARACTERISTIC_UUID_OTA_DATA    "2a7d9e30-6c1b-4f85-b3e4-8d5a0c7f1e96"
+
+static const uint8_t OPCODE_BEGIN = 0x01;
+static const uint8_t OPCODE_ABORT = 0x03;
+static const uint8_t RESPONSE_BEGIN = 0x81;
+static const uint8_t RESPONSE_ACK = 0x82;
+static const uint8_t RESPONSE_ABORT = 0x83;
+static const uint8_t RESPONSE_RESULT = 0x84;
+
+static const size_t SHA256_LENGTH = 32;
+static const size_t BEGIN_LENGTH = 1 + 4 + SHA256_LENGTH;
+static const size_t CHUNK_HEADER_LENGTH = 4;
+
+/// size of each of the two buffers (one flash sector), which is also the window of unacknowledged data
+static const uint16_t BUFFER_SIZE = 4096;
+/// the client gets an ack after every half buffer, so that it can keep sending while the other half arrives
+static const uint32_t ACK_INTERVAL = BUFFER_SIZE / 2;
+/// maximum link layer payload (data length extension)
+static const uint16_t MAX_DATA_LENGTH = 251;
+
+static const uint32_t WRITER_TASK_STACK_SIZE = 4096;
+static const uint32_t WRITER_TASK_PRIORITY = 2;
+static const uint32_t REBOOT_DELAY_MILLIS = 1000;
+/// a transfer without any chunk for this long is aborted (long enough for the client to reconnect and resume)
+static const uint32_t INACTIVITY_TIMEOUT_MILLIS = 60000;
+
+static void put_uint16(uint8_t* data, uint16_t value) {
+  data[0] = value;
+  data[1] = value >> 8;
+}
+
+static void put_uint32(uint8_t* data, uint32_t value) {
+  for (int i = 0; i < 4; ++i) {
+    data[i] = value >> (8 * i);
+  }
+}
+
+static uint32_t get_uint32(const uint8_t* data) {
+  return data[0] | (data[1] << 8) | (data[2] << 16) | (uint32_t(data[3]) << 24);
+}
+
+void BLEOTAHandler::setup(BLEService* service) {
+  control_characteristic = create_writeable_ble_characteristic(service, BLEUUID(CHARACTERISTIC_UUID_OTA_CONTROL), this, "OTA control");
+  data_characteristic = create_writeable_ble_characteristic(service, BLEUUID(CHARACTERISTIC_UUID_OTA_DATA), this, "OTA data", false, {}, true);
+}
+
+string BLEOTAHandler::get_status_report() const {
+  if (!active) {
+    return "";
+  }
+
+  char line[96];
+  snprintf(line, sizeof(line), "ota: %u/%u B received, %u B written, %u.%u KB/s", received_offset.load(), image_size, written_offset.load(),
+           get_throughput() / 10, get_throughput() % 10);
+  return line;
+}
+
+void BLEOTAHandler::onWrite(BLECharacteristic* characteristic) {
+  if (characteristic == data_characteristic) {
+    // Chunks are handled right here in the BLE task, so that they do not depend on the main loop.
+    on_data_written(characteristic->getData(), characteristic->getLength());
+  } else if (characteristic == control_characteristic) {
+    global_ble_controller->execute_in_loop([this](){ on_control_written(); }, BLEDeferredLane::COMMANDS);
+  }
+}
+
+// BLE task /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Copies the chunk into the filling buffer, a buffer that is full (or holds the end of the image) is handed over to the writer task.
+void BLEOTAHandler::on_data_written(const uint8_t* data, size_t length) {
+  if (!active || length <= CHUNK_HEADER_LENGTH) {
+    return;
+  }
+  last_activity_millis = millis();
+
+  const uint32_t offset = get_uint32(data);
+  const uint8_t* payload = data + CHUNK_HEADER_LENGTH;
+  const size_t payload_length = std::min<size_t>(length - CHUNK_HEADER_LENGTH, image_size - std::min(offset, image_size));
+  const uint32_t expected_offset = received_offset.load();
+  if (offset != expected_offset || payload_length == 0) {
+    request_ack(); // tells the client where to continue
+    return;
+  }
+
+  Buffer* buffer = &buffers[filling_buffer];
+  const size_t space = BUFFER_SIZE - buffer->length;
+  if (buffer->busy || (payload_length > space && buffers[filling_buffer ^ 1].busy)) {
+    request_ack(); // flash is slower than the link, the client sends this chunk again
+    return;
+  }
+
+  const size_t first_part_length = std::min(payload_length, space);
+  memcpy(buffer->data + buffer->length, payload, first_part_length);
+  buffer->length += first_part_length;
+  received_offset = expected_offset + payload_length;
+
+  if (buffer->length == BUFFER_SIZE || received_offset == image_size) {
+    submit_filling_buffer();
+  }
+  if (first_part_length < payload_length) {
+    buffer = &buffers[filling_buffer];
+    memcpy(buffer->data, payload + first_part_length, payload_length - first_part_length);
+    buffer->length = payload_length - first_part_length;
+    if (received_offset == image_size) {
+      submit_filling_buffer();
+    }
+  }
+
+  if (received_offset - last_acked_offset >= ACK_INTERVAL || received_offset == image_size) {
+    last_acked_offset = received_offset;
+    request_ack();
+  }
+}
+
+void BLEOTAHandler::submit_filling_buffer() {
+  const uint8_t index = filling_buffer;
+  buffers[index].busy = true;
+  xQueueSend(filled_buffers, &index, 0); // never full, it has room for both buffers
+  filling_buffer ^= 1;
+}
+
+void BLEOTAHandler::request_ack() {
+  ack_requested = true;
+}
+
+// writer task //////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BLEOTAHandler::run_writer(void* parameter) {
+  BLEOTAHandler* self = static_cast<BLEOTAHandler*>(parameter);
+  uint8_t index;
+  while (true) {
+    if (xQueueReceive(self->filled_buffers, &index, portMAX_DELAY) == pdPASS) {
+      self->write_buffer(self->buffers[index]);
+    }
+  }
+}
+
+void BLEOTAHandler::write_buffer(Buffer& buffer) {
+  if (!write_failed) {
+    const esp_err_t err = esp_ota_write(ota_handle, buffer.data, buffer.length);
+    if (err == ESP_OK) {
+      mbedtls_sha256_update_ret(&sha256, buffer.data, buffer.length);
+      written_offset += buffer.length;
+    } else {
+      write_error = err; // logged by the main loop
+      write_failed = true;
+    }
+  }
+
+  const bool completed = write_failed || written_offset == image_size;
+  if (completed && !write_failed) {
+    uint8_t digest[SHA256_LENGTH];
+    mbedtls_sha256_finish_ret(&sha256, digest);
+    sha256_matches = memcmp(digest, image_sha256, SHA256_LENGTH) == 0;
+  }
+
+  buffer.length = 0;
+  buffer.busy = false;
+  if (completed) {
+    finish_requested = true;
+  }
+}
+
+// main loop ////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BLEOTAHandler::loop() {
+  if (ack_requested.exchange(false)) {
+    send_ack();
+  }
+  if (finish_requested.exchange(false)) {
+    finish();
+  }
+
+  // a client that has gone away for good would otherwise keep the update partition open until reboot
+  if (active && !is_writing() && millis() - last_activity_millis >= INACTIVITY_TIMEOUT_MILLIS) {
+    close(true);
+    ESP_LOGW(TAG, "OTA aborted, no data for %u s", INACTIVITY_TIMEOUT_MILLIS / 1000);
+  }
+}
+
+void BLEOTAHandler::on_control_written() {
+  const uint8_t* data = control_characteristic->getData();
+  const size_t length = control_characteristic->getLength();
+  if (length == 0) {
+    return;
+  }
+
+  if (data[0] == OPCODE_BEGIN && length >= BEGIN_LENGTH) {
+    uint8_t digest[SHA256_LENGTH];
+    memcpy(digest, data + 5, SHA256_LENGTH);
+    begin(get_uint32(data + 1), digest);
+  } else if (data[0] == OPCODE_ABORT) {
+    abort();
+  } else {
+    ESP_LOGW(TAG, "Unknown OTA control request %u", data[0]);
+  }
+}
+
+/// Begins a transfer of the given image, or resumes it if the same image has begun before (e.g. on a connection that has dropped).
+void BLEOTAHandler::begin(uint32_t size, const uint8_t* digest) {
+  if (is_writing()) {
+    send_status_response(RESPONSE_BEGIN, BLEOTAStatus::BUSY);
+    return;
+  }
+
+  const bool resumed = active && size == image_size && memcmp(digest, image_sha256, SHA256_LENGTH) == 0;
+  if (!resumed) {
+    if (active) {
+      close(true);
+    }
+
+    partition = esp_ota_get_next_update_partition(nullptr);
+    if (partition == nullptr || size == 0 || size > partition->size) {
+      send_status_response(RESPONSE_BEGIN, BLEOTAStatus::NO_PARTITION);
+      return;
+    }
+
+    for (Buffer& buffer : buffers) {
+      if (buffer.data == nullptr) {
+        buffer.data = new (std::nothrow) uint8_t[BUFFER_SIZE];
+      }
+    }
+    if (filled_buffers == nullptr) {
+      filled_buffers = xQueueCreate(2, sizeof(uint8_t));
+    }
+    if (writer_task == nullptr && buffers[0].data != nullptr && buffers[1].data != nullptr && filled_buffers != nullptr) {
+      if (xTaskCreatePinnedToCore(run_writer, "ble_ota", WRITER_TASK_STACK_SIZE, this, WRITER_TASK_PRIORITY, &writer_task, tskNO_AFFINITY) != pdPASS) {
+        writer_task = nullptr;
+      }
+    }
+    if (writer_task == nullptr) {
+      send_status_response(RESPONSE_BEGIN, BLEOTAStatus::OUT_OF_MEMORY);
+      return;
+    }
+
+    // sequential writes erase each sector just before it is written (by the writer task), instead of erasing the whole image size right here
+    const esp_err_t err = esp_ota_begin(partition, OTA_WITH_SEQUENTIAL_WRITES, &ota_handle);
+    if (err != ESP_OK) {
+      ESP_LOGW(TAG, "Beginning OTA failed: %d", err);
+      send_status_response(RESPONSE_BEGIN, BLEOTAStatus::FLASH_ERROR);
+      return;
+    }
+
+    mbedtls_sha256_init(&sha256);
+    mbedtls_sha256_starts_ret(&sha256, 0);
+    image_size = size;
+    memcpy(image_sha256, digest, SHA256_LENGTH);
+    filling_buffer = 0;
+    buffers[0].length = 0;
+    buffers[1].length = 0;
+    received_offset = 0;
+    written_offset = 0;
+    last_acked_offset = 0;
+    write_failed = false;
+    finish_requested = false;
+    sha256_matches = false;
+    active = true;
+    ESP_LOGI(TAG, "OTA of %u bytes begun", size);
+  } else {
+    ESP_LOGI(TAG, "OTA resumed at offset %u", received_offset.load());
+  }
+
+  session_start_millis = millis();
+  session_start_offset = received_offset;
+  last_activity_millis = session_start_millis;
+
+  // larger link layer packets carry a whole chunk (at the maximum MTU) in fewer packets
+  for (const auto& connection : global_ble_controller->get_connections()) {
+    request_ble_data_length(BLEStackAddress::from_bytes(connection.address), MAX_DATA_LENGTH);
+  }
+
+  uint8_t response[10];
+  response[0] = RESPONSE_BEGIN;
+  response[1] = static_cast<uint8_t>(BLEOTAStatus::OK);
+  put_uint32(response + 2, received_offset);
+  put_uint16(response + 6, BUFFER_SIZE);
+  put_uint16(response + 8, global_ble_controller->get_max_notification_length() - CHUNK_HEADER_LENGTH);
+  send_response(response, sizeof(response));
+}
+
+void BLEOTAHandler::abort() {
+  if (!active) {
+    send_status_response(RESPONSE_ABORT, BLEOTAStatus::NOT_STARTED);
+    return;
+  }
+  if (is_writing()) {
+    send_status_response(RESPONSE_ABORT, BLEOTAStatus::BUSY);
+    return;
+  }
+
+  close(true);
+  ESP_LOGI(TAG, "OTA aborted");
+  send_status_response(RESPONSE_ABORT, BLEOTAStatus::OK);
+}
+
+/// Called once the writer task has written the whole image (or failed to write it), activates the new firmware and reboots.
+void BLEOTAHandler::finish() {
+  if (!active) {
+    return;
+  }
+
+  const uint16_t throughput = get_throughput();
+  BLEOTAStatus status = BLEOTAStatus::OK;
+  if (write_failed) {
+    ESP_LOGW(TAG, "Writing OTA data failed: %d", write_error);
+    status = BLEOTAStatus::FLASH_ERROR;
+  } else if (!sha256_matches) {
+    status = BLEOTAStatus::HASH_MISMATCH;
+  }
+
+  if (status != BLEOTAStatus::OK) {
+    close(true);
+  } else {
+    close(false);
+    const esp_err_t err = esp_ota_end(ota_handle);
+    if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
+      status = BLEOTAStatus::INVALID_IMAGE;
+    } else if (err != ESP_OK || esp_ota_set_boot_partition(partition) != ESP_OK) {
+      status = BLEOTAStatus::FLASH_ERROR;
+    }
+  }
+
+  ESP_LOGI(TAG, "OTA finished with status %u, %u.%u KB/s", static_cast<uint8_t>(status), throughput / 10, throughput % 10);
+  uint8_t response[4];
+  response[0] = RESPONSE_RESULT;
+  response[1] = static_cast<uint8_t>(status);
+  put_uint16(response + 2, throughput);
+  send_response(response, sizeof(response));
+
+  if (status == BLEOTAStatus::OK) {
+    App.scheduler.set_timeout(global_ble_controller, "ota-reboot", REBOOT_DELAY_MILLIS, [](){ App.safe_reboot(); });
+  }
+}
+
+void BLEOTAHandler::send_ack() {
+  if (!active) {
+    return;
+  }
+
+  uint8_t response[5];
+  response[0] = RESPONSE_ACK;
+  put_uint32(response + 1, received_offset);
+  send_response(response, sizeof(response));
+}
+
+void BLEOTAHandler::send_response(const uint8_t* response, size_t length) {
+  control_characteristic->setValue(const_cast<uint8_t*>(response), length);
+  global_ble_controller->notify(control_characteristic, nullptr);
+}
+
+void BLEOTAHandler::send_status_response(uint8_t opcode, BLEOTAStatus status) {
+  const uint8_t response[2] = { opcode, static_cast<uint8_t>(status) };
+  send_response(response, sizeof(response));
+}
+
+/// Ends the transfer (no buffer must be busy), an aborted transfer is discarded. The buffers are kept for the next transfer.
+void BLEOTAHandler::close(bool aborted) {
+  active = false;
+  if (aborted) {
+    esp_ota_abort(ota_handle);
+  }
+  mbedtls_sha256_free(&sha256);
+}
+
+/// Returns the throughput of the current session in 0.1 KB/s.
+uint16_t BLEOTAHandler::get_throughput() const {
+  const uint32_t elapsed_millis = std::max<uint32_t>(millis() - session_start_millis, 1);
+  const uint64_t bytes = received_offset - session_start_offset;
+  return std::min<uint64_t>(bytes * 10000 / 1024 / elapsed_millis, UINT16_MAX);
+}
+
+} // namespace esp32_ble_controller
+} // namespace esphome
+
+#endif
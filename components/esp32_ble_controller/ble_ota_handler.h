@@ -0,0 +1,127 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_BLE_CONTROLLER_OTA
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <BLEServer.h>
+#include <BLECharacteristic.h>
+
+#include <esp_ota_ops.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <mbedtls/sha256.h>
+
+using std::string;
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+/// Status codes in the responses of the OTA control characteristic.
+enum class BLEOTAStatus : uint8_t {
+  OK = 0,
+  BUSY = 1, // a buffer is still being written, try again
+  NO_PARTITION = 2, // no update partition or the image does not fit into it
+  FLASH_ERROR = 3,
+  HASH_MISMATCH = 4,
+  INVALID_IMAGE = 5, // the image has been rejected by the bootloader checks
+  NOT_STARTED = 6,
+  OUT_OF_MEMORY = 7,
+};
+
+/**
+ * Receives a firmware image over BLE and writes it to the inactive OTA partition. The client controls the transfer with the control characteristic:
+ *  - begin: [0x01][image size u32][SHA-256 of the image, 32 bytes], response [0x81][status][offset u32][window u16][max chunk payload u16].
+ *    If the same image (size and hash) is begun again after the connection has dropped, the response contains the offset to resume from.
+ *  - abort: [0x03], response [0x83][status].
+ * The image is written without response to the data characteristic in chunks [offset u32][payload], the payload fills the chunk up to the MTU.
+ * The client must not send more than the window beyond the last acknowledged offset, acks [0x82][offset u32] are notified while the data arrives.
+ * An ack also tells the client where to continue if a chunk has been rejected (missing offset or no free buffer).
+ * Once the whole image has been written and its hash matches, the result [0x84][status][throughput in 0.1 KB/s u16] is notified and the device reboots into the new firmware.
+ * A transfer without chunks for a minute is aborted, so that an abandoned transfer does not keep the update partition open.
+ * <para>
+ * The chunks are collected in two buffers in the BLE task: while one buffer is filled, a separate task writes the other one to flash and updates the running hash.
+ * Acks and the completion are flagged for the main loop (instead of being deferred through a queue that may be full), so neither can get lost.
+ * @brief Firmware update over BLE
+ */
+class BLEOTAHandler : private BLECharacteristicCallbacks {
+public:
+  /// attribute handles of the characteristics: control (declaration, value, 0x2901, 0x2902) and data (declaration, value, 0x2901)
+  static const uint16_t NUM_HANDLES = 7;
+
+  void setup(BLEService* service);
+  /// Sends the requested ack and the result of a completed transfer (called by the main loop).
+  void loop();
+
+  /// Returns the progress and throughput of the current transfer, empty if there is none.
+  string get_status_report() const;
+
+private:
+  struct Buffer {
+    uint8_t* data{nullptr};
+    uint16_t length{0};
+    std::atomic<bool> busy{false}; // handed over to the writer task
+  };
+
+  virtual void onWrite(BLECharacteristic* characteristic) override;
+
+  // BLE task
+  void on_data_written(const uint8_t* data, size_t length);
+  void submit_filling_buffer();
+  void request_ack();
+
+  // main loop
+  void on_control_written();
+  void begin(uint32_t size, const uint8_t* digest);
+  void abort();
+  void finish();
+  void send_ack();
+  void send_response(const uint8_t* response, size_t length);
+  void send_status_response(uint8_t opcode, BLEOTAStatus status);
+  void close(bool aborted);
+  bool is_writing() const { return buffers[0].busy || buffers[1].busy; }
+  uint16_t get_throughput() const;
+
+  // writer task
+  static void run_writer(void* parameter);
+  void write_buffer(Buffer& buffer);
+
+  BLECharacteristic* control_characteristic{nullptr};
+  BLECharacteristic* data_characteristic{nullptr};
+
+  std::atomic<bool> active{false}; // a transfer has begun, chunks are accepted
+  uint32_t image_size{0};
+  uint8_t image_sha256[32];
+  const esp_partition_t* partition{nullptr};
+  esp_ota_handle_t ota_handle{0};
+  mbedtls_sha256_context sha256;
+  bool sha256_matches{false};
+
+  Buffer buffers[2];
+  uint8_t filling_buffer{0}; // index of the buffer the BLE task fills
+  std::atomic<uint32_t> received_offset{0}; // end of the data accepted into the buffers
+  std::atomic<uint32_t> written_offset{0}; // end of the data written to flash
+  uint32_t last_acked_offset{0};
+  std::atomic<bool> ack_requested{false}; // polled by the main loop, so that an ack cannot get lost in a full queue
+  std::atomic<bool> finish_requested{false}; // polled by the main loop, set by the writer task once the image is written (or writing failed)
+  std::atomic<bool> write_failed{false};
+  esp_err_t write_error{ESP_OK}; // set before write_failed
+  std::atomic<uint32_t> last_activity_millis{0}; // of the last begin or chunk, for the inactivity timeout
+
+  // of the current session (i.e. since the last begin), for the throughput
+  uint32_t session_start_millis{0};
+  uint32_t session_start_offset{0};
+
+  TaskHandle_t writer_task{nullptr};
+  QueueHandle_t filled_buffers{nullptr}; // indices of the buffers to write
+};
+
+} // namespace esp32_ble_controller
+} // namespace esphome
+
+#endif
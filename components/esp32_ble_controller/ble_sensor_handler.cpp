@@ -2,11 +2,60 @@
 
 #ifdef USE_SENSOR
 
+#include "esphome/core/hal.h"
+
 namespace esphome {
 namespace esp32_ble_controller {
 
 static const char *TAG = "ble_sensor_handler";
 
+/// exponent of the history values if the characteristic does not use a fixed-point encoding (i.e. two decimals)
+static const int8_t DEFAULT_HISTORY_EXPONENT = -2;
+
+BLESensorHandler::BLESensorHandler(Sensor* component, const BLECharacteristicInfoForHandler& characteristic_info) : BLEComponentHandler(component, characteristic_info) {
+  if (characteristic_info.history_size > 0) {
+    const bool fixed_point = get_encoding() == BLEValueEncoding::SINT16 || get_encoding() == BLEValueEncoding::SINT24;
+    history = new BLESensorHistory(characteristic_info.history_size, fixed_point ? get_exponent() : DEFAULT_HISTORY_EXPONENT);
+  }
+}
+
+void BLESensorHandler::send_value(float value) {
+  if (history != nullptr) {
+    history->add(value, millis() / 1000);
+  }
+  BLEComponentHandler::send_value(value);
+}
+
+/// Maps common units of measurement to GATT unit UUIDs, see https://www.bluetooth.com/specifications/assigned-numbers/units/
+static uint16_t get_gatt_unit(const string& unit_of_measurement) {
+  static const struct { const char* unit_of_measurement; uint16_t gatt_unit; } UNITS[] = {
+    { "°C", 0x272F },
+    { "°F", 0x27AC },
+    { "%", 0x27AD },
+    { "V", 0x2728 },
+    { "A", 0x2704 },
+    { "W", 0x2726 },
+    { "Pa", 0x2724 },
+    { "lx", 0x2731 },
+    { "m", 0x2701 },
+    { "s", 0x2703 },
+  };
+  for (const auto& unit : UNITS) {
+    if (unit_of_measurement == unit.unit_of_measurement) {
+      return unit.gatt_unit;
+    }
+  }
+  return BLE_UNIT_UNITLESS;
+}
+
+optional<BLEPresentationFormat> BLESensorHandler::get_presentation_format() {
+  auto presentation_format = BLEComponentHandler::get_presentation_format();
+  if (presentation_format.has_value()) {
+    presentation_format->unit = get_gatt_unit(get_component()->get_unit_of_measurement());
+  }
+  return presentation_format;
+}
+
 string BLESensorHandler::get_component_description() {
   string uom = get_component()->get_unit_of_measurement();
   if (uom.empty()) {
@@ -8,6 +8,7 @@
 #include "esphome/components/sensor/sensor.h"
 
 #include "ble_component_handler.h"
+#include "ble_sensor_history.h"
 
 using std::string;
 
@@ -17,15 +18,24 @@ namespace esp32_ble_controller {
 using sensor::Sensor;
 
 /**
- * Special component handler for sensors, which adds the sensor's unit of measure to the component description.
+ * Special component handler for sensors, which adds the sensor's unit of measure to the component description (and to the presentation format if the value is encoded as fixed-point number).
+ * If configured, it also keeps a history of the sensor values, which clients can download via the maintenance service.
  */
 class BLESensorHandler : public BLEComponentHandler<Sensor> {
 public:
-  BLESensorHandler(Sensor* component, const BLECharacteristicInfoForHandler& characteristic_info) : BLEComponentHandler(component, characteristic_info) {}
-  virtual ~BLESensorHandler() {}
+  BLESensorHandler(Sensor* component, const BLECharacteristicInfoForHandler& characteristic_info);
+  virtual ~BLESensorHandler() { delete history; }
+
+  virtual void send_value(float value) override;
+
+  virtual const BLESensorHistory* get_history() const override { return history; }
 
 protected:
   virtual string get_component_description();
+  virtual optional<BLEPresentationFormat> get_presentation_format() override;
+
+private:
+  BLESensorHistory* history{nullptr};
 };
 
 } // namespace esp32_ble_controller
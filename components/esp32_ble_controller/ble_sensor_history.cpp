@@ -0,0 +1,132 @@
+#include "ble_sensor_history.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+#include "value_utils.h"
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+static const char *TAG = "ble_sensor_history";
+
+static void put_uint32(uint8_t* buffer, uint32_t value) {
+  buffer[0] = value;
+  buffer[1] = value >> 8;
+  buffer[2] = value >> 16;
+  buffer[3] = value >> 24;
+}
+
+BLESensorHistory::BLESensorHistory(uint16_t capacity, int8_t exponent) : capacity(std::max<uint16_t>(capacity, 2)), exponent(exponent) {
+  ExternalRAMAllocator<BLEHistoryRecord> allocator(ExternalRAMAllocator<BLEHistoryRecord>::ALLOW_FAILURE);
+  records = allocator.allocate(this->capacity - 1);
+  if (records == nullptr) {
+    ESP_LOGE(TAG, "Could not allocate history of %u samples", this->capacity);
+  }
+}
+
+BLESensorHistory::~BLESensorHistory() {
+  if (records != nullptr) {
+    ExternalRAMAllocator<BLEHistoryRecord> allocator(ExternalRAMAllocator<BLEHistoryRecord>::ALLOW_FAILURE);
+    allocator.deallocate(records, capacity - 1);
+  }
+}
+
+/// Adds a sample (unknown values are skipped); if the history is full, the oldest sample is dropped.
+void BLESensorHistory::add(float value, uint32_t time_seconds) {
+  if (records == nullptr || std::isnan(value)) {
+    return;
+  }
+
+  const int32_t fixed_point = to_fixed_point(value, exponent, INT32_MIN, INT32_MAX);
+  ++next_sequence_number;
+
+  if (size == 0) {
+    base_time = last_time = time_seconds;
+    base_value = last_value = fixed_point;
+    size = 1;
+    return;
+  }
+
+  if (size == capacity) {
+    const BLEHistoryRecord& oldest = get_record(0);
+    base_time += oldest.time_delta;
+    base_value += oldest.value_delta;
+    first_record = (first_record + 1) % (capacity - 1);
+    --size;
+  }
+
+  // The deltas refer to the reconstructed previous sample, so a clamped delta is caught up with the following samples.
+  BLEHistoryRecord& record = records[(first_record + size - 1) % (capacity - 1)];
+  record.time_delta = clamp<int64_t>(int64_t(time_seconds) - last_time, 0, UINT16_MAX);
+  record.value_delta = clamp<int64_t>(int64_t(fixed_point) - last_value, INT16_MIN, INT16_MAX);
+  last_time += record.time_delta;
+  last_value += record.value_delta;
+  ++size;
+}
+
+size_t BLESensorHistory::write_frame(uint8_t component_index, BLEHistoryCursor& cursor, uint32_t now_seconds, uint8_t* buffer, size_t max_length) const {
+  if (max_length < FRAME_HEADER_LENGTH) {
+    return 0;
+  }
+
+  const uint32_t first_sequence_number = std::max(cursor.sequence_number, get_first_sequence_number());
+  const size_t available = first_sequence_number < next_sequence_number ? next_sequence_number - first_sequence_number : 0;
+  const size_t count = std::min<size_t>({ available, 1 + (max_length - FRAME_HEADER_LENGTH) / sizeof(BLEHistoryRecord), UINT8_MAX });
+
+  buffer[0] = component_index;
+  buffer[1] = exponent;
+  buffer[2] = count;
+  if (count == 0) {
+    put_uint32(buffer + 3, next_sequence_number);
+    put_uint32(buffer + 7, now_seconds);
+    put_uint32(buffer + 11, 0);
+    cursor.sequence_number = next_sequence_number;
+    return FRAME_HEADER_LENGTH;
+  }
+
+  const size_t first_position = first_sequence_number - get_first_sequence_number();
+  uint32_t time;
+  int32_t value;
+  if (cursor.has_last_sample && first_sequence_number == cursor.sequence_number && first_position > 0) {
+    // the sample sent last is still in the history, the first sample of this frame is one record after it
+    const BLEHistoryRecord& record = get_record(first_position - 1);
+    time = cursor.last_time + record.time_delta;
+    value = cursor.last_value + record.value_delta;
+  } else {
+    // reconstruct the first sample of the frame from the oldest one
+    time = base_time;
+    value = base_value;
+    for (size_t position = 0; position < first_position; ++position) {
+      time += get_record(position).time_delta;
+      value += get_record(position).value_delta;
+    }
+  }
+  put_uint32(buffer + 3, first_sequence_number);
+  put_uint32(buffer + 7, time);
+  put_uint32(buffer + 11, value);
+
+  uint8_t* next = buffer + FRAME_HEADER_LENGTH;
+  for (size_t i = 1; i < count; ++i) {
+    const BLEHistoryRecord& record = get_record(first_position + i - 1);
+    next[0] = uint16_t(record.value_delta);
+    next[1] = uint16_t(record.value_delta) >> 8;
+    next[2] = record.time_delta;
+    next[3] = record.time_delta >> 8;
+    next += sizeof(BLEHistoryRecord);
+    time += record.time_delta;
+    value += record.value_delta;
+  }
+
+  cursor.sequence_number = first_sequence_number + count;
+  cursor.has_last_sample = true;
+  cursor.last_time = time;
+  cursor.last_value = value;
+  return next - buffer;
+}
+
+} // namespace esp32_ble_controller
+} // namespace esphome
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "esphome/core/defines.h"
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+/// A sample relative to its predecessor; deltas that do not fit are clamped and carried over to the next sample.
+struct BLEHistoryRecord {
+  int16_t value_delta; // in units of 10^exponent
+  uint16_t time_delta; // in seconds
+} PACKED;  // NOLINT
+
+/**
+ * Position of a history download: the sequence number of the next sample to send and the reconstructed time and value of the sample sent last,
+ * so that the next frame continues from there instead of summing up all records from the oldest sample again.
+ */
+struct BLEHistoryCursor {
+  explicit BLEHistoryCursor(uint32_t sequence_number = 0) : sequence_number(sequence_number) {}
+
+  uint32_t sequence_number;
+  bool has_last_sample{false}; // false until a frame with samples has been written
+  uint32_t last_time{0};
+  int32_t last_value{0};
+};
+
+/**
+ * Ring buffer of the latest samples of a sensor, kept as fixed-point values with timestamps (seconds since boot).
+ * The oldest sample is stored absolutely, every later sample as 4-byte delta record to its predecessor, which halves the memory compared to float and timestamp.
+ * The records are allocated in PSRAM if available (internal RAM otherwise).
+ * <para>
+ * Every sample has a sequence number (counting all samples ever added), which a client uses as cursor for downloading the history in frames (see write_frame()).
+ * @brief Delta-compressed history of sensor samples
+ */
+class BLESensorHistory {
+public:
+  /// Frame header: component index, exponent, sample count, sequence number, time and value of the first sample.
+  static const size_t FRAME_HEADER_LENGTH = 15;
+
+  BLESensorHistory(uint16_t capacity, int8_t exponent);
+  ~BLESensorHistory();
+
+  /// Returns false if the records could not be allocated (the history stays empty then).
+  bool is_allocated() const { return records != nullptr; }
+
+  void add(float value, uint32_t time_seconds);
+
+  uint16_t get_capacity() const { return capacity; }
+  uint16_t get_size() const { return size; }
+  uint32_t get_first_sequence_number() const { return next_sequence_number - size; }
+  uint32_t get_next_sequence_number() const { return next_sequence_number; }
+
+  /**
+   * Writes a frame with the samples starting at the given cursor (sequence number) into the buffer, as many as fit into max_length.
+   * A frame consists of the header (see FRAME_HEADER_LENGTH, all values little-endian) followed by a BLEHistoryRecord for each further sample.
+   * A frame without samples marks the end of the history, it contains the next sequence number and the current time instead.
+   * Continuing from the cursor of the previous frame takes time proportional to the frame, only the first frame of a download starting in the middle
+   * of the history reconstructs its first sample from the oldest one.
+   * @return the length of the frame; the cursor is advanced to the sequence number after the last sample in the frame
+   */
+  size_t write_frame(uint8_t component_index, BLEHistoryCursor& cursor, uint32_t now_seconds, uint8_t* buffer, size_t max_length) const;
+
+private:
+  const BLEHistoryRecord& get_record(size_t position) const { return records[(first_record + position) % (capacity - 1)]; }
+
+  const uint16_t capacity;
+  const int8_t exponent;
+
+  BLEHistoryRecord* records; // capacity - 1 records, the oldest sample is kept in the base values
+  uint16_t first_record{0};
+  uint16_t size{0};
+  uint32_t next_sequence_number{0};
+
+  uint32_t base_time{0};
+  int32_t base_value{0};
+  uint32_t last_time{0};
+  int32_t last_value{0};
+};
+
+} // namespace esp32_ble_controller
+} // namespace esphome
@@ -0,0 +1,22 @@
+#include "ble_stack.h"
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+const char* get_ble_stack_result_name(BLEStackResult result) {
+  switch (result) {
+    case BLEStackResult::OK:
+      return "ok";
+    case BLEStackResult::INVALID_STATE:
+      return "invalid state";
+    case BLEStackResult::INVALID_ARGUMENT:
+      return "invalid argument";
+    case BLEStackResult::NO_MEMORY:
+      return "no memory";
+    default:
+      return "failed";
+  }
+}
+
+} // namespace esp32_ble_controller
+} // namespace esphome
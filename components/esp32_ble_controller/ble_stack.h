@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "esphome/core/defines.h"
+
+// The host stack the BLE controller runs on is selected by the 'stack' option in yaml (see __init__.py), which defines USE_BLE_CONTROLLER_STACK_<STACK>.
+// Without any of these defines no backend is compiled, the host build of tests/host links its own.
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+/**
+ * These functions wrap all calls into the BLE host stack that are not covered by the Arduino BLE library. They only use the types below, so that a backend for another
+ * host stack (like NimBLE) can implement them; the backend for Bluedroid is ble_stack_bluedroid.cpp. Each backend has its own header for binding it to the server (see
+ * ble_stack_bluedroid.h).
+ * @brief Host stack independent layer for the raw BLE stack calls
+ */
+
+/// Address of a peer device, most significant byte first (like it is printed).
+struct BLEStackAddress {
+  static constexpr size_t LENGTH = 6;
+
+  uint8_t bytes[LENGTH];
+
+  static BLEStackAddress from_bytes(const uint8_t* bytes) {
+    BLEStackAddress address;
+    memcpy(address.bytes, bytes, LENGTH);
+    return address;
+  }
+};
+
+/// A bonded device.
+struct BLEStackBond {
+  BLEStackAddress address;
+  bool public_address; // identity address is public (otherwise random static)
+};
+
+/// Outcome of a host stack call.
+enum class BLEStackResult : uint8_t {
+  OK,
+  INVALID_STATE, // e.g. the stack is not initialized or the connection is gone
+  INVALID_ARGUMENT,
+  NO_MEMORY,
+  FAILED, // any other error of the host stack
+};
+
+/// Returns a short name of the given result for logging.
+const char* get_ble_stack_result_name(BLEStackResult result);
+
+/// Returns true if the Bluetooth controller has been started (e.g. by another component).
+bool is_ble_stack_started();
+
+/// Starts the Bluetooth controller and the host stack for BLE only (the memory of classic Bluetooth is returned to the heap).
+BLEStackResult start_ble_stack();
+
+/// Sends a notification with the given value of the attribute with the given handle to the given connection (safe to call from any task).
+BLEStackResult send_ble_notification(uint16_t conn_id, uint16_t attribute_handle, const uint8_t* value, uint16_t length);
+
+/// Starts the service with the given handle again that has been stopped before (BLEService::start() would create its characteristics again).
+BLEStackResult restart_ble_service(uint16_t service_handle);
+
+/// Tells the client with the given address that the GATT database has changed.
+BLEStackResult send_ble_service_changed_indication(const BLEStackAddress& address);
+
+/// Asks the client with the given address to use the given connection parameters (in BLE units).
+BLEStackResult request_ble_connection_parameters(const BLEStackAddress& address, uint16_t min_interval, uint16_t max_interval, uint16_t latency, uint16_t timeout);
+
+/// Lets the BLE stack accept only pairings with the configured authentication requirements (i.e. no fallback to weaker pairing methods).
+BLEStackResult set_ble_only_accept_specified_authentication(bool enabled);
+
+/// Loads the bonded devices from the BLE stack into the given list.
+void load_bonded_devices(std::vector<BLEStackBond>& bonded_devices);
+
+/// Removes the bond with the device with the given address from the BLE stack (asynchronously).
+BLEStackResult remove_ble_bond(const BLEStackAddress& address);
+
+/// Clears the accept list of the BLE controller (which must not be used by advertising at the moment).
+BLEStackResult clear_ble_accept_list();
+
+/// Adds the device with the given address to the accept list of the BLE controller.
+BLEStackResult add_to_ble_accept_list(const BLEStackAddress& address, bool public_address);
+
+/// Returns the memory of the Bluetooth controller (BLE and classic) to the heap. This cannot be undone, Bluetooth can only be used again after a reboot.
+BLEStackResult release_bt_controller_memory();
+
+/// Asks the controller to read the RSSI of the connection to the client with the given address, the result is passed to the GAP event handler.
+BLEStackResult read_ble_rssi(const BLEStackAddress& address);
+
+/// Asks the controller to send link layer packets of up to the given number of bytes to the client with the given address (data length extension, 27 to 251).
+BLEStackResult request_ble_data_length(const BLEStackAddress& address, uint16_t tx_octets);
+
+} // namespace esp32_ble_controller
+} // namespace esphome
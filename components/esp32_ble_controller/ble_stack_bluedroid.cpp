@@ -0,0 +1,141 @@
+#include "ble_stack_bluedroid.h"
+
+#ifdef USE_BLE_CONTROLLER_STACK_BLUEDROID
+
+#include <algorithm>
+
+#include <esp_bt.h>
+#include <esp_bt_main.h>
+#include <esp_gap_ble_api.h>
+#include <esp_gatts_api.h>
+#include <esp32-hal-bt.h>
+
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+static const char *TAG = "ble_stack";
+
+static esp_gatt_if_t server_gatts_if = ESP_GATT_IF_NONE;
+
+void bind_bluedroid_gatts_interface(esp_gatt_if_t gatts_if) {
+  server_gatts_if = gatts_if;
+}
+
+static BLEStackResult to_result(esp_err_t err) {
+  switch (err) {
+    case ESP_OK:
+      return BLEStackResult::OK;
+    case ESP_ERR_INVALID_STATE:
+      return BLEStackResult::INVALID_STATE;
+    case ESP_ERR_INVALID_ARG:
+      return BLEStackResult::INVALID_ARGUMENT;
+    case ESP_ERR_NO_MEM:
+      return BLEStackResult::NO_MEMORY;
+    default:
+      return BLEStackResult::FAILED;
+  }
+}
+
+/// Bluedroid takes the addresses as non-const pointers, although it does not modify them.
+static uint8_t* to_bd_address(const BLEStackAddress& address) {
+  return const_cast<uint8_t*>(address.bytes);
+}
+
+bool is_ble_stack_started() {
+  return btStarted();
+}
+
+BLEStackResult start_ble_stack() {
+  esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT);
+
+  // Initialize the bluetooth controller with the default configuration
+  if (!btStart()) {
+    ESP_LOGE(TAG, "btStart failed: %d", esp_bt_controller_get_status());
+    return BLEStackResult::INVALID_STATE;
+  }
+
+  esp_err_t err = esp_bluedroid_init();
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "esp_bluedroid_init failed: %d", err);
+    return to_result(err);
+  }
+
+  err = esp_bluedroid_enable();
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "esp_bluedroid_enable failed: %d", err);
+  }
+  return to_result(err);
+}
+
+BLEStackResult send_ble_notification(uint16_t conn_id, uint16_t attribute_handle, const uint8_t* value, uint16_t length) {
+  return to_result(esp_ble_gatts_send_indicate(server_gatts_if, conn_id, attribute_handle, length, const_cast<uint8_t*>(value), false));
+}
+
+BLEStackResult restart_ble_service(uint16_t service_handle) {
+  return to_result(esp_ble_gatts_start_service(service_handle));
+}
+
+BLEStackResult send_ble_service_changed_indication(const BLEStackAddress& address) {
+  return to_result(esp_ble_gatts_send_service_change_indication(server_gatts_if, to_bd_address(address)));
+}
+
+BLEStackResult request_ble_connection_parameters(const BLEStackAddress& address, uint16_t min_interval, uint16_t max_interval, uint16_t latency, uint16_t timeout) {
+  esp_ble_conn_update_params_t params;
+  memcpy(params.bda, address.bytes, sizeof(esp_bd_addr_t));
+  params.min_int = min_interval;
+  params.max_int = max_interval;
+  params.latency = latency;
+  params.timeout = timeout;
+  return to_result(esp_ble_gap_update_conn_params(&params));
+}
+
+BLEStackResult set_ble_only_accept_specified_authentication(bool enabled) {
+  uint8_t auth_option = enabled ? ESP_BLE_ONLY_ACCEPT_SPECIFIED_AUTH_ENABLE : ESP_BLE_ONLY_ACCEPT_SPECIFIED_AUTH_DISABLE;
+  return to_result(esp_ble_gap_set_security_param(ESP_BLE_SM_ONLY_ACCEPT_SPECIFIED_SEC_AUTH, &auth_option, sizeof(uint8_t)));
+}
+
+void load_bonded_devices(std::vector<BLEStackBond>& bonded_devices) {
+  bonded_devices.clear();
+  int dev_num = esp_ble_get_bond_device_num();
+  if (dev_num <= 0) {
+    return;
+  }
+
+  std::vector<esp_ble_bond_dev_t> devices(dev_num);
+  esp_ble_get_bond_device_list(&dev_num, devices.data());
+  bonded_devices.reserve(dev_num);
+  for (int i = 0; i < dev_num; ++i) {
+    bonded_devices.push_back(BLEStackBond{ BLEStackAddress::from_bytes(devices[i].bd_addr), devices[i].bond_key.pid_key.addr_type == BLE_ADDR_TYPE_PUBLIC });
+  }
+}
+
+BLEStackResult remove_ble_bond(const BLEStackAddress& address) {
+  return to_result(esp_ble_remove_bond_device(to_bd_address(address)));
+}
+
+BLEStackResult clear_ble_accept_list() {
+  return to_result(esp_ble_gap_clear_whitelist());
+}
+
+BLEStackResult add_to_ble_accept_list(const BLEStackAddress& address, bool public_address) {
+  return to_result(esp_ble_gap_update_whitelist(true, to_bd_address(address), public_address ? BLE_WL_ADDR_TYPE_PUBLIC : BLE_WL_ADDR_TYPE_RANDOM));
+}
+
+BLEStackResult release_bt_controller_memory() {
+  return to_result(esp_bt_controller_mem_release(ESP_BT_MODE_BTDM));
+}
+
+BLEStackResult read_ble_rssi(const BLEStackAddress& address) {
+  return to_result(esp_ble_gap_read_rssi(to_bd_address(address)));
+}
+
+BLEStackResult request_ble_data_length(const BLEStackAddress& address, uint16_t tx_octets) {
+  return to_result(esp_ble_gap_set_pkt_data_len(to_bd_address(address), tx_octets));
+}
+
+} // namespace esp32_ble_controller
+} // namespace esphome
+
+#endif
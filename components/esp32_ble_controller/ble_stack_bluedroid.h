@@ -0,0 +1,18 @@
+#pragma once
+
+#include "ble_stack.h"
+
+#ifdef USE_BLE_CONTROLLER_STACK_BLUEDROID
+
+#include <esp_gatt_defs.h>
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+/// Binds the Bluedroid backend of the stack layer to the GATT server interface of the BLE library, must be called once the server has been created.
+void bind_bluedroid_gatts_interface(esp_gatt_if_t gatts_if);
+
+} // namespace esp32_ble_controller
+} // namespace esphome
+
+#endif
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+/**
+ * Number, average, maximum and percentiles of measured latencies in microseconds.
+ * The percentiles come from a histogram with power-of-two buckets, so they are upper bounds that are at most twice the exact value.
+ */
+struct BLELatencyStatistics {
+  static constexpr size_t NUM_BUCKETS = 24; // the last bucket holds all latencies from 2^22 us (about 4 s) on
+
+  uint32_t count{0};
+  uint32_t max_micros{0};
+  uint64_t total_micros{0};
+  uint16_t buckets[NUM_BUCKETS]{}; // bucket i counts the latencies below 2^i us (and not below 2^(i-1) us), saturated
+
+  void add(uint32_t micros) {
+    ++count;
+    total_micros += micros;
+    if (micros > max_micros) {
+      max_micros = micros;
+    }
+    const size_t bucket = std::min<size_t>(micros == 0 ? 0 : 32 - __builtin_clz(micros), NUM_BUCKETS - 1);
+    if (buckets[bucket] < UINT16_MAX) {
+      ++buckets[bucket];
+    }
+  }
+
+  uint32_t get_average_micros() const { return count == 0 ? 0 : total_micros / count; }
+
+  /// Returns the upper bound of the given percentile (like 50 or 99) of the latencies, capped at the maximum latency.
+  uint32_t get_percentile_micros(uint8_t percentile) const {
+    uint32_t counted = 0;
+    for (size_t bucket = 0; bucket < NUM_BUCKETS; ++bucket) {
+      counted += buckets[bucket];
+    }
+    const uint32_t rank = (counted * percentile + 99) / 100; // the rank-th smallest latency (rounded up)
+    uint32_t seen = 0;
+    for (size_t bucket = 0; bucket < NUM_BUCKETS; ++bucket) {
+      seen += buckets[bucket];
+      if (seen >= rank && seen > 0) {
+        return std::min(max_micros, bucket == NUM_BUCKETS - 1 ? max_micros : (1u << bucket) - 1);
+      }
+    }
+    return 0;
+  }
+};
+
+/**
+ * Lightweight counters of a handler for a characteristic (or for several characteristics of a service).
+ * All counters are updated in the main loop only, so they do not need to be synchronized.
+ * @brief Statistics of notifications, updates and latencies
+ */
+struct BLEHandlerStatistics {
+  uint32_t notifications{0}; // notifications sent (one per subscribed connection)
+  uint32_t notified_bytes{0}; // payload bytes of those notifications
+  uint32_t coalesced_updates{0}; // updates replaced by a later value before they were notified
+  uint32_t suppressed_updates{0}; // updates that did not trigger a notification (e.g. below the delta threshold)
+  BLELatencyStatistics notify_latency; // from the first unsent state change to the notification
+  BLELatencyStatistics write_latency; // from the write by the client to its execution in the main loop
+};
+
+} // namespace esp32_ble_controller
+} // namespace esphome
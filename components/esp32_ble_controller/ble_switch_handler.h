@@ -26,6 +26,7 @@ public:
 
 protected:
   virtual bool can_receive_writes() { return true; }
+  virtual bool accepts_writes_without_response() override { return true; }
   virtual void on_characteristic_written() override;
 };
 
@@ -0,0 +1,94 @@
+#include "ble_text_sensor_handler.h"
+
+#ifdef USE_TEXT_SENSOR
+
+#include <algorithm>
+#include <cstring>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#include "esp32_ble_controller.h"
+#include "ble_utils.h"
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+static const char *TAG = "ble_text_sensor_handler";
+
+static const size_t CHUNK_HEADER_LENGTH = 2;
+static const int MAX_CHUNKS_PER_LOOP = 4;
+/// maximum length of an attribute value (that a client can read with long reads)
+static const size_t MAX_VALUE_LENGTH = 512;
+
+void BLETextSensorHandler::loop() {
+  BLEComponentHandler::loop();
+
+  if (value_pending && is_notification_due()) {
+    start_stream();
+  }
+  // without congestion the interval between chunks is 0, i.e. only the notification capacity limits the stream
+  for (int i = 0; i < MAX_CHUNKS_PER_LOOP && streaming && global_ble_controller->has_notification_capacity() 
+       && millis() - last_chunk_millis >= global_ble_controller->get_notify_interval(0); ++i) {
+    send_chunk();
+  }
+}
+
+/**
+ * Sets the given value of the characteristic and streams it in chunks (see send_chunk()) once the minimum notification interval has passed.
+ * A value that is still being streamed is replaced then, i.e. the client gets a new first chunk.
+ */
+void BLETextSensorHandler::send_value(const string& value) {
+  if (get_encoding() != BLEValueEncoding::CHUNKED) {
+    BLEComponentHandler::send_value(value);
+    return;
+  }
+
+  ESP_LOGD(TAG, "Update component %s to %s", get_component()->get_object_id().c_str(), value.c_str());
+  const size_t value_length = std::min(value.length(), MAX_VALUE_LENGTH);
+  get_characteristic()->setValue(reinterpret_cast<uint8_t*>(const_cast<char*>(value.data())), value_length);
+
+  if (value_pending) {
+    count_coalesced_update();
+  } else {
+    pending_value_micros = micros();
+  }
+  pending_value = value;
+  value_pending = true;
+  if (is_notification_due()) {
+    start_stream();
+  }
+}
+
+void BLETextSensorHandler::start_stream() {
+  streamed_value.swap(pending_value);
+  streamed_value_offset = 0;
+  streaming = true;
+  value_pending = false;
+  on_value_notified(pending_value_micros);
+}
+
+void BLETextSensorHandler::send_chunk() {
+  uint8_t chunk[BLE_MAX_MTU - 3];
+  const size_t max_payload_length = std::min<size_t>(global_ble_controller->get_max_notification_length(), sizeof(chunk)) - CHUNK_HEADER_LENGTH;
+
+  const size_t remaining_length = streamed_value.length() - streamed_value_offset;
+  const size_t payload_length = std::min(remaining_length, max_payload_length);
+  const bool last = payload_length == remaining_length;
+
+  chunk[0] = next_chunk_sequence_number++;
+  chunk[1] = (streamed_value_offset == 0 ? FLAG_FIRST : 0) | (last ? FLAG_LAST : 0);
+  memcpy(chunk + CHUNK_HEADER_LENGTH, streamed_value.data() + streamed_value_offset, payload_length);
+  streamed_value_offset += payload_length;
+  notify_raw_value(chunk, CHUNK_HEADER_LENGTH + payload_length);
+
+  last_chunk_millis = millis();
+  if (last) {
+    streaming = false;
+  }
+}
+
+} // namespace esp32_ble_controller
+} // namespace esphome
+
+#endif
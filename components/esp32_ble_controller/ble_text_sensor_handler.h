@@ -0,0 +1,58 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+#ifdef USE_TEXT_SENSOR
+
+#include <string>
+
+#include "esphome/components/text_sensor/text_sensor.h"
+
+#include "ble_component_handler.h"
+
+using std::string;
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+using text_sensor::TextSensor;
+
+/**
+ * Special component handler for text sensors, which can stream values longer than the MTU.
+ * <para>
+ * With the chunked encoding each value is notified as a sequence of chunks that fit into the MTU. Every chunk starts with a sequence number 
+ * (incremented for each chunk, wrapping around) and a flags byte (FLAG_FIRST and FLAG_LAST mark the first and the last chunk of a value), followed by the 
+ * next part of the UTF-8 value. The chunks are only notified, the characteristic always holds the complete latest value (up to 512 bytes), which clients can 
+ * fetch with a long read. A stream starts once the minimum notification interval has passed (values in between are coalesced, only the latest is streamed), 
+ * and while the links are congested the chunks are spaced by the widened notification interval.
+ */
+class BLETextSensorHandler : public BLEComponentHandler<TextSensor> {
+public:
+  static const uint8_t FLAG_LAST = 1 << 0;
+  static const uint8_t FLAG_FIRST = 1 << 1;
+
+  BLETextSensorHandler(TextSensor* component, const BLECharacteristicInfoForHandler& characteristic_info) : BLEComponentHandler(component, characteristic_info) {}
+  virtual ~BLETextSensorHandler() {}
+
+  virtual void loop() override;
+
+  virtual void send_value(const string& value) override;
+
+private:
+  void start_stream();
+  void send_chunk();
+
+  string pending_value; // waits for the minimum notification interval
+  bool value_pending{false};
+  uint32_t pending_value_micros{0};
+  uint32_t last_chunk_millis{0};
+
+  string streamed_value;
+  size_t streamed_value_offset{0};
+  bool streaming{false};
+  uint8_t next_chunk_sequence_number{0};
+};
+
+} // namespace esp32_ble_controller
+} // namespace esphome
+
+#endif
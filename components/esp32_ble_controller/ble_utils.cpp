@@ -1,50 +1,64 @@
 #include "ble_utils.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
 #include <BLE2902.h>
+#include <BLE2904.h>
 
 #include "esphome/core/log.h"
 
 #include "esp32_ble_controller.h"
+#include "ble_object_arena.h"
 
 namespace esphome {
 namespace esp32_ble_controller {
 
 static const char *TAG = "ble_utils";
 
-vector<string> get_bonded_devices() {
-  vector<string> paired_devices;
-
-  int dev_num = esp_ble_get_bond_device_num();
-
-  esp_ble_bond_dev_t *dev_list = (esp_ble_bond_dev_t*) malloc(sizeof(esp_ble_bond_dev_t) * dev_num);
-  esp_ble_get_bond_device_list(&dev_num, dev_list);
-
-  for (int i = 0; i < dev_num; i++) {
-    char bd_address_str[18];
-    esp_bd_addr_t& bd_address = dev_list[i].bd_addr;
-    snprintf(bd_address_str, sizeof(bd_address_str), "%X:%X:%X:%X:%X:%X", bd_address[0], bd_address[1], bd_address[2], bd_address[3], bd_address[4], bd_address[5]);
-    paired_devices.push_back(bd_address_str);
+/// Each characteristic has at most one 0x2902 descriptor.
+static constexpr size_t MAX_CCCDS = BLE_CONTROLLER_NUM_CHARACTERISTICS + NUM_MAINTENANCE_CHARACTERISTICS;
+/// The 0x2902 descriptors are registered by the main loop (while creating characteristics) and looked up by the BLE task: each descriptor is stored before the count is increased.
+static BLEDescriptor* cccds[MAX_CCCDS];
+static std::atomic<size_t> cccd_count{0};
+
+static void register_cccd(BLEDescriptor* cccd, BLECharacteristic* characteristic) {
+  const size_t count = cccd_count.load();
+  if (count == MAX_CCCDS) {
+    ESP_LOGE(TAG, "Too many 0x2902 descriptors, subscriptions of %s are not tracked", characteristic->getUUID().toString().c_str());
+    return;
   }
-
-  free(dev_list);
-
-  return paired_devices;
+  cccds[count] = cccd;
+  cccd_count.store(count + 1);
 }
 
-void remove_all_bonded_devices()
-{
-  int dev_num = esp_ble_get_bond_device_num();
-
-  esp_ble_bond_dev_t *dev_list = (esp_ble_bond_dev_t*) malloc(sizeof(esp_ble_bond_dev_t) * dev_num);
-  esp_ble_get_bond_device_list(&dev_num, dev_list);
-  for (int i = 0; i < dev_num; i++) {
-      esp_ble_remove_bond_device(dev_list[i].bd_addr);
+bool is_cccd_handle(uint16_t handle) {
+  const size_t count = cccd_count.load();
+  for (size_t i = 0; i < count; ++i) {
+    // the handles are assigned when the service starts, before that no client can write the descriptor anyway
+    if (cccds[i]->getHandle() == handle) {
+      return true;
+    }
   }
+  return false;
+}
 
-  free(dev_list);
+string format_bd_address(const esp_bd_addr_t address) {
+  char text[18];
+  snprintf(text, sizeof(text), "%02X:%02X:%02X:%02X:%02X:%02X", address[0], address[1], address[2], address[3], address[4], address[5]);
+  return text;
 }
 
-BLECharacteristic* create_ble_characteristic(BLEService* service, const string& characteristic_uuid, uint32_t properties, BLECharacteristicCallbacks* callbacks, const string& description, bool with2902) {
+BLEUUID to_ble_uuid(const uint8_t* uuid128) {
+  esp_bt_uuid_t uuid;
+  uuid.len = ESP_UUID_LEN_128;
+  memcpy(uuid.uuid.uuid128, uuid128, BLE_UUID128_LENGTH);
+  return BLEUUID(uuid);
+}
+
+BLECharacteristic* create_ble_characteristic(BLEService* service, const BLEUUID& characteristic_uuid, uint32_t properties, BLECharacteristicCallbacks* callbacks, const string& description, bool with2902, const optional<BLEPresentationFormat>& presentation_format) {
   BLECharacteristic* characteristic = service->createCharacteristic(characteristic_uuid, properties);
 
   // Set access permissions.
@@ -57,18 +71,33 @@ BLECharacteristic* create_ble_characteristic(BLEService* service, const string&
   characteristic->setAccessPermissions(access_permissions);
 
   // Add a 2901 descriptor to the characteristic, which sets a user-friendly description.
-  BLEDescriptor* descriptor_2901 = new BLEDescriptor(BLEUUID((uint16_t)0x2901));
+  // Its value buffer only gets the length of the description (instead of the default 100 bytes) because the description is never changed.
+  BLEDescriptor* descriptor_2901 = BLEObjectArena::create<BLEDescriptor>(BLEUUID((uint16_t)0x2901), std::max<size_t>(description.length(), 1));
   descriptor_2901->setAccessPermissions(access_permissions);
   descriptor_2901->setValue(description);
   characteristic->addDescriptor(descriptor_2901);
 
+  // If the value is encoded in a specific binary format, add a 2904 descriptor to the characteristic, which tells the client how to decode the value.
+  // https://www.bluetooth.com/specifications/assigned-numbers/format-types/
+  if (presentation_format.has_value()) {
+    BLE2904* descriptor_2904 = BLEObjectArena::create<BLE2904>();
+    descriptor_2904->setAccessPermissions(access_permissions);
+    descriptor_2904->setFormat(presentation_format->format);
+    descriptor_2904->setExponent(presentation_format->exponent);
+    descriptor_2904->setUnit(presentation_format->unit);
+    descriptor_2904->setNamespace(1); // Bluetooth SIG
+    descriptor_2904->setDescription(0); // unknown
+    characteristic->addDescriptor(descriptor_2904);
+  }
+
   // If requested, add a 2902 descriptor to the characteristic, which lets the client control if it wants to receive new values (and notifications) for this characteristic.
   if (with2902) {
-    // With this descriptor clients can switch notifications on and off, but we want to send notifications anyway as long as we are connected. The homebridge plug-in cannot turn notifications on and off.
+    // With this descriptor each client can switch notifications on and off (see ESP32BLEController::notify()). Clients that cannot turn notifications on, like the homebridge plug-in, need characteristics without it.
     // https://www.bluetooth.com/specifications/gatt/viewer?attributeXmlFile=org.bluetooth.descriptor.gatt.client_characteristic_configuration.xml
-    BLEDescriptor* descriptor_2902 = new BLE2902();
+    BLEDescriptor* descriptor_2902 = BLEObjectArena::create<BLE2902>();
     descriptor_2902->setAccessPermissions(access_permissions);
     characteristic->addDescriptor(descriptor_2902);
+    register_cccd(descriptor_2902, characteristic);
   }
 
   if (callbacks != nullptr) {
@@ -78,32 +107,18 @@ BLECharacteristic* create_ble_characteristic(BLEService* service, const string&
   return characteristic;
 }
 
-BLECharacteristic* create_read_only_ble_characteristic(BLEService* service, const string& characteristic_uuid, const string& description, bool with2902) {
+BLECharacteristic* create_read_only_ble_characteristic(BLEService* service, const BLEUUID& characteristic_uuid, const string& description, bool with2902, const optional<BLEPresentationFormat>& presentation_format) {
   uint32_t properties = BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY;
-  return create_ble_characteristic(service, characteristic_uuid, properties, nullptr, description, with2902);
+  return create_ble_characteristic(service, characteristic_uuid, properties, nullptr, description, with2902, presentation_format);
 }
 
-BLECharacteristic* create_writeable_ble_characteristic(BLEService* service, const string& characteristic_uuid, BLECharacteristicCallbacks* callbacks, const string& description, bool with2902) {
+BLECharacteristic* create_writeable_ble_characteristic(BLEService* service, const BLEUUID& characteristic_uuid, BLECharacteristicCallbacks* callbacks, const string& description, bool with2902, const optional<BLEPresentationFormat>& presentation_format,
+                                                      bool write_without_response) {
   uint32_t properties = BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY | BLECharacteristic::PROPERTY_WRITE;
-  return create_ble_characteristic(service, characteristic_uuid, properties, callbacks, description, with2902);
-}
-
-vector<string> split(string text, char delimiter) {
-  vector<string> result;
-  int j = 0;
-  for (int i = 0; i < text.length(); i ++) {
-    if (text[i] == delimiter) {
-      string token = text.substr(j, i - j);
-      if (token.length()) {
-        result.push_back(token);
-      }
-      j = i + 1;
-    }
-  }
-  if (j < text.length()) {
-    result.push_back(text.substr(j));
+  if (write_without_response) {
+    properties |= BLECharacteristic::PROPERTY_WRITE_NR;
   }
-  return result;
+  return create_ble_characteristic(service, characteristic_uuid, properties, callbacks, description, with2902, presentation_format);
 }
 
 } // namespace esp32_ble_controller
@@ -1,24 +1,56 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <BLECharacteristic.h>
 
+#include "esphome/core/optional.h"
+
+#include "value_utils.h"
+
 using std::string;
+using std::string_view;
 using std::vector;
 
 namespace esphome {
 namespace esp32_ble_controller {
 
-vector<string> get_bonded_devices();
-void remove_all_bonded_devices();
+/// Content of a characteristic presentation format descriptor (0x2904), which tells clients how a binary value is encoded.
+struct BLEPresentationFormat {
+  uint8_t format; // format type, e.g. BLE2904::FORMAT_SINT16
+  int8_t exponent; // actual value = encoded value * 10^exponent
+  uint16_t unit; // GATT unit UUID, e.g. 0x272F for degree Celsius
+};
+
+/// default ATT MTU (before the client negotiates a larger one)
+static const uint16_t BLE_DEFAULT_MTU = 23;
+/// maximum ATT MTU
+static const uint16_t BLE_MAX_MTU = 517;
+
+/// GATT unit UUID for values without unit
+static const uint16_t BLE_UNIT_UNITLESS = 0x2700;
+
+/// length of a 128-bit UUID in bytes
+static const size_t BLE_UUID128_LENGTH = 16;
+
+/// Returns the UUID for the given 128-bit UUID constant, whose bytes are ordered like in the BLE stack (least significant byte first) as generated from the yaml configuration.
+BLEUUID to_ble_uuid(const uint8_t* uuid128);
+
+/// Formats the given device address like "0A:1B:2C:3D:4E:5F".
+string format_bd_address(const esp_bd_addr_t address);
 
-BLECharacteristic* create_read_only_ble_characteristic(BLEService* service, const string& characteristic_uuid, const string& description, bool with2902 = true);
+BLECharacteristic* create_read_only_ble_characteristic(BLEService* service, const BLEUUID& characteristic_uuid, const string& description, bool with2902 = true, const optional<BLEPresentationFormat>& presentation_format = {});
 
-BLECharacteristic* create_writeable_ble_characteristic(BLEService* service, const string& characteristic_uuid, BLECharacteristicCallbacks* callbacks, const string& description, bool with2902 = true);
+BLECharacteristic* create_writeable_ble_characteristic(BLEService* service, const BLEUUID& characteristic_uuid, BLECharacteristicCallbacks* callbacks, const string& description, bool with2902 = true, const optional<BLEPresentationFormat>& presentation_format = {},
+                                                      bool write_without_response = false);
 
-vector<string> split(string text, char delimiter = ' ');
+/**
+ * Returns true if the given attribute handle belongs to one of the client characteristic configuration descriptors (0x2902) that have been created by the functions above.
+ * Can be called from the BLE task (e.g. to tell subscriptions from other writes), it never blocks.
+ */
+bool is_cccd_handle(uint16_t handle);
 
 } // namespace esp32_ble_controller
 } // namespace esphome
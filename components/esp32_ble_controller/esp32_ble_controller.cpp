@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <cstdarg>
+#include <cstring>
+
 #include <BLEDevice.h>
 #include <BLEServer.h>
 #include <BLESecurity.h>
@@ -5,41 +9,60 @@
 #include "esphome/core/application.h"
 #include "esphome/core/log.h"
 
-#include <esp_bt_main.h>
-#include <esp32-hal-bt.h>
+#include <esp_heap_caps.h>
+#include <esp_gatts_api.h>
 
 #include "esp32_ble_controller.h"
 
 #include "ble_maintenance_handler.h"
 #include "ble_utils.h"
+#include "ble_stack.h"
+#include "ble_stack_bluedroid.h"
 #include "ble_command.h"
 #include "automation.h"
 #include "ble_component_handler_factory.h"
+#include "ble_object_arena.h"
 
 namespace esphome {
 namespace esp32_ble_controller {
 
 static const char *TAG = "esp32_ble_controller";
 
-ESP32BLEController::ESP32BLEController() : maintenance_handler(new BLEMaintenanceHandler()) {}
+ESP32BLEController::ESP32BLEController() {}
 
 /// pre-setup configuration ///////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void ESP32BLEController::register_component(EntityBase* component, const string& serviceUUID, const string& characteristic_UUID, bool use_BLE2902) {
+void ESP32BLEController::register_component(EntityBase* component, const uint8_t* service_UUID, const uint8_t* characteristic_UUID, bool use_BLE2902, uint32_t min_notify_interval, float notify_delta,
+                                            BLEValueEncoding encoding, int8_t exponent, uint16_t history_size) {
   BLECharacteristicInfoForHandler info;
-  info.service_UUID = serviceUUID;
+  info.service_UUID = service_UUID;
   info.characteristic_UUID = characteristic_UUID;
   info.use_BLE2902 = use_BLE2902;
+  info.min_notify_interval = min_notify_interval;
+  info.notify_delta = notify_delta;
+  info.encoding = encoding;
+  info.exponent = exponent;
+  info.history_size = history_size;
+
+  registered_components.push_back(component);
+  characteristic_info_for_components.push_back(info);
+  handler_for_component.push_back(nullptr);
+}
 
-  info_for_component[component->get_object_id()] = info;
+void ESP32BLEController::register_service(const uint8_t* service_UUID, uint16_t num_handles) {
+  service_handle_counts.push_back(std::make_pair(service_UUID, num_handles));
 }
 
-void ESP32BLEController::ESP32BLEController::register_command(const string& name, const string& description, BLEControllerCustomCommandExecutionTrigger* trigger) {
-  maintenance_handler->add_command(new BLECustomCommand(name, description, trigger));
+void ESP32BLEController::ESP32BLEController::register_command(const char* name, const char* description, BLEControllerCustomCommandExecutionTrigger* trigger) {
+  maintenance_handler.add_command(BLEObjectArena::create<BLECustomCommand>(name, description, trigger));
 }
 
 const vector<BLECommand*>& ESP32BLEController::get_commands() const {
-  return maintenance_handler->get_commands();
+  return maintenance_handler.get_commands();
+}
+
+const BLECommand* ESP32BLEController::find_command(string_view name) const {
+  return maintenance_handler.find_command(name);
 }
 
 void ESP32BLEController::add_on_show_pass_key_callback(std::function<void(string)>&& trigger_function) {
@@ -71,6 +94,11 @@ void ESP32BLEController::set_maintenance_service_exposed_after_flash(bool expose
   initial_ble_mode_after_flashing = set_feature(initial_ble_mode_after_flashing, BLEMaintenanceMode::MAINTENANCE_SERVICE, exposed);    
 }
 
+void ESP32BLEController::add_connection_profile(const string& name, uint16_t min_advertising_interval, uint16_t max_advertising_interval, uint16_t min_connection_interval, uint16_t max_connection_interval,
+                                                uint16_t slave_latency, uint16_t supervision_timeout) {
+  connection_profiles.push_back(BLEConnectionProfile{ name, min_advertising_interval, max_advertising_interval, min_connection_interval, max_connection_interval, slave_latency, supervision_timeout });
+}
+
 void ESP32BLEController::set_security_enabled(bool enabled) {
   set_security_mode(BLESecurityMode::SECURE);
 }
@@ -84,6 +112,11 @@ void ESP32BLEController::setup() {
 
   if (ble_mode == BLEMaintenanceMode::NONE) {
     ESP_LOGCONFIG(TAG, "BLE inactive");
+    // BLE is only started again after a reboot (see switch_ble_mode()), so the controller memory can go back to the heap - if nothing else uses Bluetooth.
+    if (release_bt_memory_when_off) {
+      ESP_LOGCONFIG(TAG, "Releasing the memory of the Bluetooth controller");
+      release_bt_controller_memory();
+    }
     return;
   }
 
@@ -104,46 +137,38 @@ void ESP32BLEController::setup() {
   // Create the BLE Device
   BLEDevice::init(App.get_name());
 
+  // Offer a larger MTU, the client negotiates the actual MTU per connection (see onMtuChanged()).
+  BLEDevice::setMTU(mtu);
+
   configure_ble_security();
+  refresh_bonded_devices();
+
+  // Observe writes of the client characteristic configuration descriptors, which the BLE library only tracks for all clients together.
+  BLEDevice::setCustomGattsHandler(on_gatts_event);
+  // Observe the RSSI readings and connection parameter updates, which the BLE library does not pass on.
+  BLEDevice::setCustomGapHandler(on_gap_event);
 
   setup_ble_server_and_services();
 
   // Start advertising
-  // BLEAdvertising* advertising = BLEDevice::getAdvertising();
-  // advertising->setMinInterval(0x800); // suggested default: 1.28s
-  // advertising->setMaxInterval(0x800);
-  // advertising->setMinPreferred(80); // = 100 ms, see https://www.novelbits.io/ble-connection-intervals/, https://www.novelbits.io/bluetooth-low-energy-advertisements-part-1/
-  // advertising->setMaxPreferred(800); // = 1000 ms
+  apply_advertising_parameters();
   BLEDevice::startAdvertising();
+  schedule_idle_timeout();
+
+  set_interval("link_quality", LINK_QUALITY_PERIOD_MILLIS, [this]{ update_link_quality(); });
 }
 
 bool ESP32BLEController::setup_ble() {
-  if (btStarted()) {
+  if (is_ble_stack_started()) {
     ESP_LOGI(TAG, "BLE already started");
     return true;
   }
 
   ESP_LOGI(TAG, "  Setting up BLE ...");
 
-  esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT);
-
-  // Initialize the bluetooth controller with the default configuration
-  if (!btStart()) {
-    ESP_LOGE(TAG, "btStart failed: %d", esp_bt_controller_get_status());
-    mark_failed();
-    return false;
-  }
-
-  esp_err_t err = esp_bluedroid_init();
-  if (err != ESP_OK) {
-    ESP_LOGE(TAG, "esp_bluedroid_init failed: %d", err);
-    mark_failed();
-    return false;
-  }
-
-  err = esp_bluedroid_enable();
-  if (err != ESP_OK) {
-    ESP_LOGE(TAG, "esp_bluedroid_enable failed: %d", err);
+  const BLEStackResult result = start_ble_stack();
+  if (result != BLEStackResult::OK) {
+    ESP_LOGE(TAG, "Starting the BLE stack failed: %s", get_ble_stack_result_name(result));
     mark_failed();
     return false;
   }
@@ -154,9 +179,15 @@ bool ESP32BLEController::setup_ble() {
 void ESP32BLEController::setup_ble_server_and_services() {
   ble_server = BLEDevice::createServer();
   ble_server->setCallbacks(this);
+#ifdef USE_BLE_CONTROLLER_STACK_BLUEDROID
+  bind_bluedroid_gatts_interface(ble_server->getGattsIf());
+#endif
+#ifdef USE_BLE_CONTROLLER_NOTIFY_TASK
+  notify_task.start();
+#endif
 
   if (get_maintenance_service_exposed()) {
-    maintenance_handler->setup(ble_server);
+    maintenance_handler.setup(ble_server);
   }
 
   if (get_component_services_exposed()) {
@@ -166,115 +197,168 @@ void ESP32BLEController::setup_ble_server_and_services() {
 
 void ESP32BLEController::setup_ble_services_for_components() {
 #ifdef USE_BINARY_SENSOR
-  setup_ble_services_for_components(App.get_binary_sensors(), BLEComponentHandlerFactory::create_binary_sensor_handler);
+  setup_ble_services_for_components(App.get_binary_sensors(), BLEComponentType::BINARY_SENSOR, BLEComponentHandlerFactory::create_binary_sensor_handler);
 #endif
 #ifdef USE_COVER
   //setup_ble_services_for_components(App.get_covers());
 #endif
 #ifdef USE_FAN
-  setup_ble_services_for_components(App.get_fans(), BLEComponentHandlerFactory::create_fan_handler);
+  setup_ble_services_for_components(App.get_fans(), BLEComponentType::FAN, BLEComponentHandlerFactory::create_fan_handler);
 #endif
 #ifdef USE_LIGHT
-  //setup_ble_services_for_components(App.get_lights());
+  setup_ble_services_for_components(App.get_lights(), BLEComponentType::LIGHT, BLEComponentHandlerFactory::create_light_handler);
 #endif
 #ifdef USE_SENSOR
-  setup_ble_services_for_components(App.get_sensors(), BLEComponentHandlerFactory::create_sensor_handler);
+  setup_ble_services_for_components(App.get_sensors(), BLEComponentType::SENSOR, BLEComponentHandlerFactory::create_sensor_handler);
 #endif
 #ifdef USE_SWITCH
-  setup_ble_services_for_components(App.get_switches(), BLEComponentHandlerFactory::create_switch_handler);
+  setup_ble_services_for_components(App.get_switches(), BLEComponentType::SWITCH, BLEComponentHandlerFactory::create_switch_handler);
 #endif
 #ifdef USE_TEXT_SENSOR
-  setup_ble_services_for_components(App.get_text_sensors(), BLEComponentHandlerFactory::create_text_sensor_handler);
+  setup_ble_services_for_components(App.get_text_sensors(), BLEComponentType::TEXT_SENSOR, BLEComponentHandlerFactory::create_text_sensor_handler);
 #endif
 #ifdef USE_CLIMATE
   //setup_ble_services_for_components(App.get_climates());
 #endif
 
-  for (auto const& entry : handler_for_component) {
-    auto* handler = entry.second;
-    handler->setup(ble_server);
+  // Create each service once with the required number of handles and add all its characteristics, then start each service once.
+  component_services_created = true;
+  vector<BLEService*>& services = component_services;
+  for (size_t index = 0; index < handler_for_component.size(); ++index) {
+    BLEComponentHandlerBase* handler = handler_for_component[index];
+    if (handler == nullptr) {
+      continue;
+    }
+
+    const uint8_t* service_UUID = characteristic_info_for_components[index].service_UUID;
+    BLEService* service = ble_server->getServiceByUUID(to_ble_uuid(service_UUID));
+    if (service == nullptr) {
+      service = ble_server->createService(to_ble_uuid(service_UUID), get_service_handle_count(service_UUID));
+      services.push_back(service);
+    }
+    handler->setup(service);
+  }
+
+  for (BLEService* service : services) {
+    service->start();
   }
 
   register_state_change_callbacks_and_send_initial_states();
 }
 
+/// Returns the number of handles the given service needs, the default of the BLE library if the service has not been registered.
+uint16_t ESP32BLEController::get_service_handle_count(const uint8_t* service_UUID) const {
+  for (const auto& service_handle_count : service_handle_counts) {
+    if (memcmp(service_handle_count.first, service_UUID, BLE_UUID128_LENGTH) == 0) {
+      return service_handle_count.second;
+    }
+  }
+  return 15;
+}
+
 template <typename C> 
-void ESP32BLEController::setup_ble_services_for_components(const vector<C*>& components, BLEComponentHandlerBase* (*handler_creator)(C*, const BLECharacteristicInfoForHandler&)) {
+void ESP32BLEController::setup_ble_services_for_components(const vector<C*>& components, BLEComponentType type, BLEComponentHandlerBase* (*handler_creator)(C*, const BLECharacteristicInfoForHandler&)) {
   for (C* component: components) {
-    setup_ble_service_for_component(component, handler_creator);
+    setup_ble_service_for_component(component, type, handler_creator);
   }
 }
 
 template <typename C> 
-void ESP32BLEController::setup_ble_service_for_component(C* component, BLEComponentHandlerBase* (*handler_creator)(C*, const BLECharacteristicInfoForHandler&)) {
+void ESP32BLEController::setup_ble_service_for_component(C* component, BLEComponentType type, BLEComponentHandlerBase* (*handler_creator)(C*, const BLECharacteristicInfoForHandler&)) {
   static_assert(std::is_base_of<EntityBase, C>::value, "EntityBase subclasses expected");
 
-  auto object_id = component->get_object_id();
-  if (info_for_component.count(object_id)) {
-    auto info = info_for_component[object_id];
-    handler_for_component[object_id] = handler_creator(component, info);
+  const int index = get_component_index(component);
+  if (index >= 0) {
+    characteristic_info_for_components[index].component_type = type;
+    handler_for_component[index] = handler_creator(component, characteristic_info_for_components[index]);
   }
 }
 
+int ESP32BLEController::get_component_index(EntityBase* component) const {
+  for (size_t index = 0; index < registered_components.size(); ++index) {
+    if (registered_components[index] == component) {
+      return index;
+    }
+  }
+  return -1;
+}
+
+BLEComponentHandlerBase* ESP32BLEController::get_handler(EntityBase* component) const {
+  const int index = get_component_index(component);
+  return index >= 0 ? handler_for_component[index] : nullptr;
+}
+
+/**
+ * Registers the state change callbacks for all components exposed via BLE.
+ * The handler of each component is resolved once here and bound to the callback, so that state changes do not need to look it up.
+ */
 void ESP32BLEController::register_state_change_callbacks_and_send_initial_states() {
 #ifdef USE_BINARY_SENSOR
   for (auto *obj : App.get_binary_sensors()) {
-    if (info_for_component.count(obj->get_object_id())) {
-      obj->add_on_state_callback([this, obj](bool state) { this->on_binary_sensor_update(obj, state); });
+    auto* handler = get_handler(obj);
+    if (handler != nullptr) {
+      obj->add_on_state_callback([this, handler](bool state) { this->update_component_state(handler, state); });
       if (obj->has_state())
-        update_component_state(obj, obj->state);
+        update_component_state(handler, obj->state);
     }
   }
 #endif
 #ifdef USE_CLIMATE
   // for (auto *obj : App.get_climates()) {
-  //   if (info_for_component.count(obj->get_object_id()))
+  //   if (get_handler(obj) != nullptr)
   //     obj->add_on_state_callback([this, obj]() { this->on_climate_update(obj); });
   // }
 #endif
 #ifdef USE_COVER
   // for (auto *obj : App.get_covers()) {
-  //   if (info_for_component.count(obj->get_object_id()))
+  //   if (get_handler(obj) != nullptr)
   //     obj->add_on_state_callback([this, obj]() { this->on_cover_update(obj); });
   // }
 #endif
 #ifdef USE_FAN
   for (auto *obj : App.get_fans()) {
-    if (info_for_component.count(obj->get_object_id())) {
-      obj->add_on_state_callback([this, obj]() { this->on_fan_update(obj); });
-      update_component_state(obj, obj->state);
+    auto* handler = get_handler(obj);
+    if (handler != nullptr) {
+      obj->add_on_state_callback([this, handler, obj]() { this->update_component_state(handler, obj->state); });
+      update_component_state(handler, obj->state);
     }
   }
 #endif
 #ifdef USE_LIGHT
-  // for (auto *obj : App.get_lights()) {
-  //   if (info_for_component.count(obj->get_object_id()))
-  //     obj->add_new_remote_values_callback([this, obj]() { this->on_light_update(obj); });
-  // }
+  for (auto *obj : App.get_lights()) {
+    auto* handler = get_handler(obj);
+    if (handler != nullptr) {
+      obj->add_new_remote_values_callback([this, handler, obj]() { this->update_component_state(handler, obj->remote_values.is_on()); });
+      update_component_state(handler, obj->remote_values.is_on());
+    }
+  }
 #endif
 #ifdef USE_SENSOR
   for (auto *obj : App.get_sensors()) {
-    if (info_for_component.count(obj->get_object_id())) {
-      obj->add_on_state_callback([this, obj](float state) { this->on_sensor_update(obj, state); });
+    auto* handler = get_handler(obj);
+    if (handler != nullptr) {
+      obj->add_on_state_callback([this, handler](float state) { this->update_component_state(handler, state); });
       if (obj->has_state())
-        update_component_state(obj, obj->state);
+        update_component_state(handler, obj->state);
     }
   }
 #endif
 #ifdef USE_SWITCH
   for (auto *obj : App.get_switches()) {
-    if (info_for_component.count(obj->get_object_id())) {
-      obj->add_on_state_callback([this, obj](bool state) { this->on_switch_update(obj, state); });
-      update_component_state(obj, obj->state);
+    auto* handler = get_handler(obj);
+    if (handler != nullptr) {
+      obj->add_on_state_callback([this, handler](bool state) { this->update_component_state(handler, state); });
+      update_component_state(handler, obj->state);
     }
   }
 #endif
 #ifdef USE_TEXT_SENSOR
   for (auto *obj : App.get_text_sensors()) {
-    if (info_for_component.count(obj->get_object_id())) {
-      obj->add_on_state_callback([this, obj](std::string state) { this->on_text_sensor_update(obj, state); });
+    auto* handler = get_handler(obj);
+    if (handler != nullptr) {
+      obj->add_on_state_callback([this, handler](const std::string& state) { this->update_component_state(handler, state); });
       if (obj->has_state())
-        update_component_state(obj, obj->state);
+        update_component_state(handler, obj->state);
     }
   }
 #endif
@@ -291,14 +375,69 @@ void ESP32BLEController::initialize_ble_mode() {
   ESP_LOGCONFIG(TAG, "BLE mode: %d", static_cast<uint8_t>(ble_mode));
 }
 
+/**
+ * Switches the BLE mode and persists it. If BLE is running and stays active, the services are started or stopped right away (see apply_ble_mode_change()),
+ * otherwise the device reboots to (de-)initialize the BLE stack.
+ */
 void ESP32BLEController::switch_ble_mode(BLEMaintenanceMode newMode) {
   if (ble_mode != newMode) {
-    ESP_LOGI(TAG, "Switching BLE mode to %d and rebooting", static_cast<uint8_t>(newMode));
-
+    const BLEMaintenanceMode previous_mode = ble_mode;
     ble_mode = newMode;
     ble_mode_preference.save(&ble_mode);
 
-    App.safe_reboot();
+    if (ble_server == nullptr || newMode == BLEMaintenanceMode::NONE) {
+      ESP_LOGI(TAG, "Switching BLE mode to %d and rebooting", static_cast<uint8_t>(newMode));
+      App.safe_reboot();
+      return;
+    }
+
+    ESP_LOGI(TAG, "Switching BLE mode to %d", static_cast<uint8_t>(newMode));
+    apply_ble_mode_change(previous_mode);
+  }
+}
+
+/**
+ * Starts or stops the services whose exposure has changed with the new BLE mode.
+ * Services that have not been created during setup are created now; services are never deleted, just stopped, so that they can be started again quickly.
+ */
+void ESP32BLEController::apply_ble_mode_change(BLEMaintenanceMode previous_mode) {
+  const bool maintenance_service_was_exposed = static_cast<uint8_t>(previous_mode) & static_cast<uint8_t>(BLEMaintenanceMode::MAINTENANCE_SERVICE);
+  if (maintenance_service_was_exposed != get_maintenance_service_exposed()) {
+    BLEService* service = maintenance_handler.get_service();
+    if (!get_maintenance_service_exposed()) {
+      service->stop();
+    } else if (service == nullptr) {
+      maintenance_handler.setup(ble_server);
+    } else {
+      restart_ble_service(service->getHandle());
+    }
+  }
+
+  const bool component_services_were_exposed = static_cast<uint8_t>(previous_mode) & static_cast<uint8_t>(BLEMaintenanceMode::COMPONENT_SERVICES);
+  if (component_services_were_exposed != get_component_services_exposed()) {
+    if (!get_component_services_exposed()) {
+      for (BLEService* service : component_services) {
+        service->stop();
+      }
+    } else if (!component_services_created) {
+      setup_ble_services_for_components();
+    } else {
+      for (BLEService* service : component_services) {
+        restart_ble_service(service->getHandle());
+      }
+    }
+  }
+
+  send_service_changed_indications();
+}
+
+/// Tells the connected clients that the GATT database has changed, so that they discover the services again.
+void ESP32BLEController::send_service_changed_indications() {
+  for (auto& connection : connections) {
+    const BLEStackResult result = send_ble_service_changed_indication(BLEStackAddress::from_bytes(connection.address));
+    if (result != BLEStackResult::OK) {
+      ESP_LOGW(TAG, "Service changed indication for connection %d failed: %s", connection.conn_id, get_ble_stack_result_name(result));
+    }
   }
 }
 
@@ -318,6 +457,21 @@ void ESP32BLEController::dump_config() {
   ESP_LOGCONFIG(TAG, "Bluetooth Low Energy Controller:");
   ESP_LOGCONFIG(TAG, "  BLE device address: %s", BLEDevice::getAddress().toString().c_str());
   ESP_LOGCONFIG(TAG, "  BLE mode: %d", (uint8_t) ble_mode);
+  ESP_LOGCONFIG(TAG, "  MTU: %d", mtu);
+  ESP_LOGCONFIG(TAG, "  max. connections: %d", max_connections);
+  if (idle_timeout_millis > 0) {
+    ESP_LOGCONFIG(TAG, "  idle timeout: %u ms", idle_timeout_millis);
+  }
+  const BLEConnectionProfile* profile = get_connection_profile();
+  ESP_LOGCONFIG(TAG, "  connection profile: %s", profile != nullptr ? profile->name.c_str() : "BLE stack defaults");
+
+  // clients address components by these indices (in the order of the yaml configuration) in the snapshot, the history download and batch writes
+  ESP_LOGCONFIG(TAG, "  component indices:");
+  for (size_t index = 0; index < registered_components.size(); ++index) {
+    const BLEComponentHandlerBase* handler = handler_for_component[index];
+    ESP_LOGCONFIG(TAG, "    %u) %s (type %u)", static_cast<unsigned>(index), registered_components[index]->get_object_id().c_str(),
+                  handler != nullptr ? static_cast<uint8_t>(handler->get_component_type()) : 0);
+  }
 
   if (get_security_mode() != BLESecurityMode::NONE) {
     if (get_security_mode() == BLESecurityMode::BOND) {
@@ -326,14 +480,17 @@ void ESP32BLEController::dump_config() {
       ESP_LOGCONFIG(TAG, "  security enabled (secure connections, MITM protection)");
     }
 
-    vector<string> bonded_devices = get_bonded_devices();
+    if (accept_list_only) {
+      ESP_LOGCONFIG(TAG, "  only bonded devices can connect (accept list)");
+    }
+
     if (bonded_devices.empty()) {
       ESP_LOGCONFIG(TAG, "  no bonded BLE devices");
     } else {
-      ESP_LOGCONFIG(TAG, "  bonded BLE devices (%d):", bonded_devices.size());
+      ESP_LOGCONFIG(TAG, "  bonded BLE devices (%u):", static_cast<unsigned>(bonded_devices.size()));
       int i = 0;
-      for (const auto& bd_address : bonded_devices) {
-        ESP_LOGCONFIG(TAG, "    %d) BD address %s", ++i, bd_address.c_str());
+      for (const auto& bonded_device : bonded_devices) {
+        ESP_LOGCONFIG(TAG, "    %d) BD address %s", ++i, format_bd_address(bonded_device.address.bytes).c_str());
       }
     }
   } else {
@@ -348,6 +505,10 @@ void ESP32BLEController::ESP32BLEController::set_wifi_configuration(const string
   wifi_configuration_handler.set_credentials(ssid, password, hidden_network);
 }
 
+void ESP32BLEController::test_wifi_configuration(const string& ssid, const string& password, bool hidden_network) {
+  wifi_configuration_handler.test_credentials(ssid, password, hidden_network);
+}
+
 void ESP32BLEController::ESP32BLEController::clear_wifi_configuration_and_reboot() {
   wifi_configuration_handler.clear_credentials();
 
@@ -360,67 +521,435 @@ const optional<string> ESP32BLEController::ESP32BLEController::get_current_ssid_
 #endif
 
 void ESP32BLEController::send_command_result(const string& result_message) {
-  maintenance_handler->send_command_result(result_message);
+  maintenance_handler.send_command_result(result_message);
 }
 
 void ESP32BLEController::send_command_result(const char* format, ...) {
   char buffer[128];
   va_list arg;
   va_start(arg, format);
-  vsnprintf(buffer, sizeof(buffer), format, arg);
+  const int length = vsnprintf(buffer, sizeof(buffer), format, arg);
   va_end(arg);
-  
-  maintenance_handler->send_command_result(buffer);
+
+  if (length < 0) {
+    return;
+  }
+  if (static_cast<size_t>(length) < sizeof(buffer)) {
+    maintenance_handler.send_command_result(string(buffer, length));
+    return;
+  }
+
+  // The result does not fit into the buffer, so we format it again into a string of the required size.
+  string result(length, '\0');
+  va_start(arg, format);
+  vsnprintf(&result[0], length + 1, format, arg);
+  va_end(arg);
+
+  maintenance_handler.send_command_result(result);
 }
 
-#ifdef USE_BINARY_SENSOR
-  void ESP32BLEController::on_binary_sensor_update(binary_sensor::BinarySensor *obj, bool state) { update_component_state(obj, state); }
+/// Returns the maximum notification length for the connection with the smallest MTU because notifications are sent to all connections.
+uint16_t ESP32BLEController::get_max_notification_length() const {
+  uint16_t mtu = BLE_DEFAULT_MTU;
+  for (size_t i = 0; i < connections.size(); ++i) {
+    mtu = i == 0 ? connections[i].mtu : std::min(mtu, connections[i].mtu);
+  }
+  return std::max(mtu, BLE_DEFAULT_MTU) - 3;
+}
+
+bool ESP32BLEController::has_notification_capacity() const {
+#ifdef USE_BLE_CONTROLLER_NOTIFY_TASK
+  return notify_task.get_free_capacity() >= connections.size();
+#else
+  return true;
 #endif
-#ifdef USE_COVER
-  void ESP32BLEController::on_cover_update(cover::Cover *obj) {}
+}
+
+void ESP32BLEController::notify(BLECharacteristic* characteristic, BLEHandlerStatistics* statistics) {
+  notify(characteristic, characteristic->getData(), characteristic->getLength(), statistics);
+}
+
+void ESP32BLEController::notify(BLECharacteristic* characteristic, const uint8_t* value, size_t length, BLEHandlerStatistics* statistics) {
+  BLEDescriptor* cccd = characteristic->getDescriptorByUUID(BLEUUID((uint16_t) 0x2902));
+  const uint16_t cccd_handle = cccd != nullptr ? cccd->getHandle() : 0;
+
+  for (auto& connection : connections) {
+    if (cccd == nullptr || connection.is_subscribed(cccd_handle)) {
+      send_notification(connection, characteristic, value, length, statistics);
+    }
+  }
+}
+
+void ESP32BLEController::notify(uint16_t conn_id, BLECharacteristic* characteristic, const uint8_t* value, size_t length, BLEHandlerStatistics* statistics) {
+  BLEClientConnection* connection = get_connection(conn_id);
+  BLEDescriptor* cccd = characteristic->getDescriptorByUUID(BLEUUID((uint16_t) 0x2902));
+  if (connection != nullptr && (cccd == nullptr || connection->is_subscribed(cccd->getHandle()))) {
+    send_notification(*connection, characteristic, value, length, statistics);
+  }
+}
+
+void ESP32BLEController::send_notification(BLEClientConnection& connection, BLECharacteristic* characteristic, const uint8_t* value, size_t length, BLEHandlerStatistics* statistics) {
+  const uint16_t notified_length = std::min<size_t>(length, connection.mtu - 3);
+#ifdef USE_BLE_CONTROLLER_NOTIFY_TASK
+  // the task sends the notification, its statistics report the failures
+  const bool sent = notify_task.enqueue(connection.conn_id, characteristic->getHandle(), value, notified_length);
+  count_notification(connection, sent);
+  if (sent && statistics != nullptr) {
+#else
+  const BLEStackResult result = send_ble_notification(connection.conn_id, characteristic->getHandle(), value, notified_length);
+  count_notification(connection, result == BLEStackResult::OK);
+  if (result != BLEStackResult::OK) {
+    ESP_LOGW(TAG, "Notification to connection %d failed: %s", connection.conn_id, get_ble_stack_result_name(result));
+  } else if (statistics != nullptr) {
 #endif
-#ifdef USE_FAN
-  void ESP32BLEController::on_fan_update(fan::Fan *fan) { update_component_state(fan, fan->state); }
+    ++statistics->notifications;
+    statistics->notified_bytes += notified_length;
+  }
+}
+
+static void append_statistics(string& report, const char* name, const BLEHandlerStatistics& statistics) {
+  char line[256];
+  snprintf(line, sizeof(line), "\n%s: %u notif, %u B, %u coalesced, %u suppressed, notify avg %uus p50 %uus p99 %uus max %uus, write avg %uus p50 %uus p99 %uus max %uus", name,
+           statistics.notifications, statistics.notified_bytes, statistics.coalesced_updates, statistics.suppressed_updates,
+           statistics.notify_latency.get_average_micros(), statistics.notify_latency.get_percentile_micros(50), statistics.notify_latency.get_percentile_micros(99),
+           statistics.notify_latency.max_micros,
+           statistics.write_latency.get_average_micros(), statistics.write_latency.get_percentile_micros(50), statistics.write_latency.get_percentile_micros(99),
+           statistics.write_latency.max_micros);
+  report += line;
+}
+
+string ESP32BLEController::get_statistics_report() const {
+  char line[256];
+  const uint32_t coalesced_writes = coalesced_component_writes.load();
+  snprintf(line, sizeof(line), "queues: events max %u/%u, %u rejected; subscriptions max %u/%u, %u rejected; commands max %u/%u, %u rejected; "
+           "writes max %u/%u, %u coalesced, %u rejected",
+           deferred_events.get_high_water_mark(), BLE_CONTROLLER_EVENTS_QUEUE_CAPACITY, deferred_events.get_push_failures(),
+           deferred_subscriptions.get_high_water_mark(), BLE_CONTROLLER_SUBSCRIPTIONS_QUEUE_CAPACITY, deferred_subscriptions.get_push_failures(),
+           deferred_commands.get_high_water_mark(), BLE_CONTROLLER_COMMANDS_QUEUE_CAPACITY, deferred_commands.get_push_failures(),
+           deferred_component_writes.get_high_water_mark(), BLE_CONTROLLER_COMPONENT_WRITES_QUEUE_CAPACITY, coalesced_writes,
+           deferred_component_writes.get_push_failures() - coalesced_writes);
+  string report(line);
+#ifdef USE_BLE_CONTROLLER_NOTIFY_TASK
+  report += "\n" + notify_task.get_statistics_report();
 #endif
-#ifdef USE_LIGHT
-  void ESP32BLEController::on_light_update(light::LightState *obj) {}
+
+  for (const auto& connection : connections) {
+    const BLELinkQuality& link = connection.link_quality;
+    snprintf(line, sizeof(line), "\nconnection %d: rssi %d dBm, mtu %u, interval %u.%02u ms, latency %u, timeout %u ms, %u notif, %u failed, %u congested%s",
+             connection.conn_id, link.rssi, connection.mtu, link.connection_interval * 5 / 4, link.connection_interval * 125 % 100, link.slave_latency, link.supervision_timeout * 10,
+             link.counters.notifications, link.counters.failed_notifications, link.counters.congestion_events, link.congested ? " (now)" : "");
+    report += line;
+  }
+  snprintf(line, sizeof(line), "\nlinks: %u notif, %u failed, %u congested; notify intervals x%u, %u widenings",
+           link_counters.notifications, link_counters.failed_notifications, link_counters.congestion_events, 1u << notify_throttle.get_level(), notify_throttle.get_widenings());
+  report += line;
+#ifdef USE_BLE_CONTROLLER_OTA
+  const string ota_status = maintenance_handler.get_ota_handler().get_status_report();
+  if (!ota_status.empty()) {
+    report += "\n" + ota_status;
+  }
 #endif
-#ifdef USE_SENSOR
-  void ESP32BLEController::on_sensor_update(sensor::Sensor *component, float state) { update_component_state(component, state); }
+
+  if (get_maintenance_service_exposed()) {
+    append_statistics(report, "maintenance", maintenance_handler.get_statistics());
+#ifdef USE_LOGGER
+    snprintf(line, sizeof(line), ", %u log lines dropped", maintenance_handler.get_dropped_log_lines());
+    report += line;
 #endif
-#ifdef USE_SWITCH
-  void ESP32BLEController::on_switch_update(switch_::Switch *obj, bool state) { update_component_state(obj, state); }
+  }
+
+  for (size_t index = 0; index < handler_for_component.size(); ++index) {
+    const auto* handler = handler_for_component[index];
+    if (handler != nullptr) {
+      append_statistics(report, registered_components[index]->get_object_id().c_str(), handler->get_statistics());
+    }
+  }
+
+  return report;
+}
+
+string ESP32BLEController::get_heap_report() const {
+  char report[160];
+  snprintf(report, sizeof(report), "controller: %zu B, arena %zu/%zu B (%zu B on heap); heap: %zu B free, %zu B largest block, %zu B min free",
+           sizeof(ESP32BLEController), BLEObjectArena::get_used_bytes(), BLEObjectArena::get_capacity(), BLEObjectArena::get_heap_bytes(),
+           heap_caps_get_free_size(MALLOC_CAP_DEFAULT), heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT), heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT));
+  return report;
+}
+
+void ESP32BLEController::reset_statistics() {
+  deferred_events.reset_statistics();
+  deferred_subscriptions.reset_statistics();
+  deferred_commands.reset_statistics();
+  deferred_component_writes.reset_statistics();
+  coalesced_component_writes.store(0);
+  link_counters = {};
+  link_counters_at_last_period = {};
+  for (auto& connection : connections) {
+    connection.link_quality.counters = {};
+  }
+  notify_throttle.reset_statistics();
+#ifdef USE_BLE_CONTROLLER_NOTIFY_TASK
+  notify_task.reset_statistics();
 #endif
-#ifdef USE_TEXT_SENSOR
-  void ESP32BLEController::on_text_sensor_update(text_sensor::TextSensor *obj, std::string state) { update_component_state(obj, state); }
+  maintenance_handler.reset_statistics();
+  for (auto* handler : handler_for_component) {
+    if (handler != nullptr) {
+      handler->reset_statistics();
+    }
+  }
+}
+
+bool BLEClientConnection::is_subscribed(uint16_t cccd_handle) const {
+  return std::find(subscribed_cccd_handles.begin(), subscribed_cccd_handles.end(), cccd_handle) != subscribed_cccd_handles.end();
+}
+
+BLEClientConnection* ESP32BLEController::get_connection(uint16_t conn_id) {
+  for (auto& connection : connections) {
+    if (connection.conn_id == conn_id) {
+      return &connection;
+    }
+  }
+  return nullptr;
+}
+
+const BLEConnectionProfile* ESP32BLEController::get_connection_profile() const {
+  return connection_profile_index >= 0 ? &connection_profiles[connection_profile_index] : nullptr;
+}
+
+bool ESP32BLEController::set_connection_profile(const string& name) {
+  for (size_t index = 0; index < connection_profiles.size(); ++index) {
+    if (connection_profiles[index].name == name) {
+      connection_profile_index = index;
+      if (ble_server != nullptr) {
+        ESP_LOGI(TAG, "Switching to connection profile %s", name.c_str());
+        apply_advertising_parameters();
+        if (!dormant && connections.size() < max_connections) {
+          // restart advertising because the new advertising parameters are only applied on start
+          BLEDevice::getAdvertising()->stop();
+          BLEDevice::startAdvertising();
+        }
+        for (const auto& connection : connections) {
+          request_connection_parameters(connection);
+        }
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Sets the advertising interval and the preferred connection interval (which is announced in the advertising data) of the active connection profile.
+void ESP32BLEController::apply_advertising_parameters() {
+  const BLEConnectionProfile* profile = get_connection_profile();
+  if (profile == nullptr) {
+    return;
+  }
+
+  // see https://www.novelbits.io/ble-connection-intervals/, https://www.novelbits.io/bluetooth-low-energy-advertisements-part-1/
+  BLEAdvertising* advertising = BLEDevice::getAdvertising();
+  advertising->setMinInterval(profile->min_advertising_interval);
+  advertising->setMaxInterval(profile->max_advertising_interval);
+  advertising->setMinPreferred(profile->min_connection_interval);
+  advertising->setMaxPreferred(profile->max_connection_interval);
+}
+
+void ESP32BLEController::request_connection_parameters(const BLEClientConnection& connection) {
+  const BLEConnectionProfile* profile = get_connection_profile();
+  if (profile == nullptr) {
+    return;
+  }
+
+  const BLEStackResult result = request_ble_connection_parameters(BLEStackAddress::from_bytes(connection.address), profile->min_connection_interval,
+                                                                  profile->max_connection_interval, profile->slave_latency, profile->supervision_timeout);
+  if (result != BLEStackResult::OK) {
+    ESP_LOGW(TAG, "Connection parameter update for connection %d failed: %s", connection.conn_id, get_ble_stack_result_name(result));
+  }
+}
+
+#ifdef USE_COVER
+  void ESP32BLEController::on_cover_update(cover::Cover *obj) {}
+#endif
+#ifdef USE_LIGHT
+  void ESP32BLEController::on_light_update(light::LightState *obj) {}
 #endif
 #ifdef USE_CLIMATE
   void ESP32BLEController::on_climate_update(climate::Climate *obj) {}
 #endif
 
-template <typename C, typename S> 
-void ESP32BLEController::update_component_state(C* component, S state) {
-  static_assert(std::is_base_of<EntityBase, C>::value, "EntityBase subclasses expected");
+template <typename S> 
+void ESP32BLEController::update_component_state(BLEComponentHandlerBase* handler, const S& state) {
+  handler->send_value(state);
+  ++state_generation;
+}
+
+/**
+ * The snapshot starts with a header: the state generation (uint32, little-endian) and a flags byte (SNAPSHOT_FLAG_TRUNCATED if entries have been omitted).
+ * Each entry consists of the component index (in order of registration), the component type, the length of the value and the value itself (as in the component's characteristic).
+ */
+size_t ESP32BLEController::write_state_snapshot(uint8_t* buffer, size_t max_length, uint8_t first_index) {
+  static const size_t HEADER_LENGTH = 7;
+  static const size_t ENTRY_HEADER_LENGTH = 3;
+  static const uint8_t SNAPSHOT_FLAG_TRUNCATED = 1 << 0;
+  static const uint8_t SNAPSHOT_FLAG_VALUE_CUT = 1 << 1;
+
+  if (max_length < HEADER_LENGTH) {
+    return 0;
+  }
+
+  uint8_t flags = 0;
+  uint8_t next_index = 0;
+  size_t length = HEADER_LENGTH;
+  for (size_t index = first_index; index < handler_for_component.size() && index <= UINT8_MAX; ++index) {
+    BLEComponentHandlerBase* handler = handler_for_component[index];
+    if (handler == nullptr) {
+      continue;
+    }
+
+    BLECharacteristic* characteristic = handler->get_characteristic();
+    const size_t value_length = std::min<size_t>(characteristic->getLength(), UINT8_MAX);
+    if (length + ENTRY_HEADER_LENGTH + value_length > max_length) {
+      // the entries stay in index order, so the client continues with a snapshot from this index on
+      flags |= SNAPSHOT_FLAG_TRUNCATED;
+      next_index = index;
+      break;
+    }
+    if (characteristic->getLength() > UINT8_MAX) {
+      flags |= SNAPSHOT_FLAG_VALUE_CUT; // only for entries in this snapshot, a continuation reports its own
+    }
+
+    buffer[length++] = index;
+    buffer[length++] = static_cast<uint8_t>(handler->get_component_type());
+    buffer[length++] = value_length;
+    memcpy(buffer + length, characteristic->getData(), value_length);
+    length += value_length;
+  }
+
+  buffer[0] = state_generation;
+  buffer[1] = state_generation >> 8;
+  buffer[2] = state_generation >> 16;
+  buffer[3] = state_generation >> 24;
+  buffer[4] = flags;
+  buffer[5] = first_index;
+  buffer[6] = next_index;
+  return length;
+}
+
+bool ESP32BLEController::has_history() const {
+  for (const auto& info : characteristic_info_for_components) {
+    if (info.history_size > 0) {
+      return true;
+    }
+  }
+  return false;
+}
 
-  auto object_id = component->get_object_id();
-  BLEComponentHandlerBase* handler = handler_for_component[object_id];
-  if (handler != nullptr) {
-    handler->send_value(state);
+size_t ESP32BLEController::apply_batch_writes(const uint8_t* batch, size_t length, uint8_t* rejected_indices, size_t max_rejected_indices, size_t& rejected_count) {
+  auto reject = [&](uint8_t component_index) {
+    if (rejected_count < max_rejected_indices) {
+      rejected_indices[rejected_count] = component_index;
+    }
+    ++rejected_count;
+  };
+
+  size_t applied_count = 0;
+  size_t position = 0;
+  rejected_count = 0;
+  while (position + 2 <= length) {
+    const uint8_t component_index = batch[position];
+    const uint8_t value_length = batch[position + 1];
+    position += 2;
+    if (position + value_length > length) {
+      reject(component_index); // truncated record
+      break;
+    }
+
+    BLEComponentHandlerBase* handler = component_index < handler_for_component.size() ? handler_for_component[component_index] : nullptr;
+    if (handler != nullptr && handler->apply_written_value(batch + position, value_length)) {
+      ++applied_count;
+    } else {
+      reject(component_index);
+    }
+    position += value_length;
   }
+
+  if (applied_count > 0) {
+    on_client_write_handled();
+  }
+  return applied_count;
 }
 
-void ESP32BLEController::execute_in_loop(std::function<void()>&& deferred_function) {
-  bool ok = deferred_functions_for_loop.push(std::move(deferred_function));
-  if (!ok) {
-    ESP_LOGW(TAG, "Deferred functions queue full");
+const BLESensorHistory* ESP32BLEController::get_history(size_t component_index) const {
+  if (component_index >= handler_for_component.size() || handler_for_component[component_index] == nullptr) {
+    return nullptr;
   }
+  return handler_for_component[component_index]->get_history();
+}
+
+bool ESP32BLEController::execute_in_loop(DeferredFunction&& deferred_function, BLEDeferredLane lane, bool coalescable) {
+  switch (lane) {
+    case BLEDeferredLane::EVENTS:
+      return deferred_events.push(std::move(deferred_function));
+    case BLEDeferredLane::SUBSCRIPTIONS:
+      return deferred_subscriptions.push(std::move(deferred_function));
+    case BLEDeferredLane::COMMANDS:
+      return deferred_commands.push(std::move(deferred_function));
+    case BLEDeferredLane::COMPONENT_WRITES:
+    default:
+      if (deferred_component_writes.push(std::move(deferred_function))) {
+        return true;
+      }
+      if (coalescable) {
+        coalesced_component_writes.fetch_add(1);
+      }
+      return false;
+  }
+}
+
+/**
+ * The main loop normally sleeps up to the loop interval between two passes, which delays deferred writes. While a client is writing (e.g. toggling a switch 
+ * or streaming colours), the loop runs at high frequency instead, so that each write is handled right in the next pass.
+ * The first write of a burst still waits for the current delay of the loop: the loop task sleeps in vTaskDelay(), which a task notification (xTaskNotifyGive) 
+ * does not end, and waking it from the BLE task with xTaskAbortDelay is not an option, since it would also abort semaphore waits of the loop task. 
+ * Starting the requester from the BLE task would not help either: it only affects the delays after the current one (and it is not thread-safe).
+ */
+void ESP32BLEController::on_client_write_handled() {
+  last_client_write_millis = millis();
+  high_frequency_loop_requester.start();
 }
 
 void ESP32BLEController::loop() {
-  std::function<void()> deferred_function;
-  while (deferred_functions_for_loop.take(deferred_function)) {
+  DeferredFunction deferred_function;
+  while (deferred_events.take(deferred_function)) {
+    deferred_function();
+  }
+  while (deferred_subscriptions.take(deferred_function)) {
+    deferred_function();
+  }
+  while (deferred_commands.take(deferred_function)) {
     deferred_function();
   }
+  while (deferred_component_writes.take(deferred_function)) {
+    deferred_function();
+  }
+  take_link_telemetry();
+
+  if (millis() - last_client_write_millis >= HIGH_FREQUENCY_LOOP_AFTER_WRITE_MILLIS) {
+    high_frequency_loop_requester.stop();
+  }
+
+  if (get_maintenance_service_exposed()) {
+    maintenance_handler.loop();
+  }
+
+#ifdef USE_WIFI
+  wifi_configuration_handler.loop();
+#endif
+
+  for (auto* handler : handler_for_component) {
+    if (handler != nullptr) {
+      handler->loop();
+    }
+  }
 }
 
 void ESP32BLEController::configure_ble_security() {
@@ -441,28 +970,72 @@ void ESP32BLEController::configure_ble_security() {
   security.setRespEncryptionKey(ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK);
   security.setKeySize(16);
 
-  uint8_t auth_option = ESP_BLE_ONLY_ACCEPT_SPECIFIED_AUTH_ENABLE;
-  esp_ble_gap_set_security_param(ESP_BLE_SM_ONLY_ACCEPT_SPECIFIED_SEC_AUTH, &auth_option, sizeof(uint8_t));
+  set_ble_only_accept_specified_authentication(true);
 }
 
-void ESP32BLEController::onPassKeyNotify(uint32_t pass_key) {
-  char pass_key_digits[6 + 1];
-  snprintf(pass_key_digits, sizeof(pass_key_digits), "%06d", pass_key);
-  string pass_key_str(pass_key_digits);
+void ESP32BLEController::refresh_bonded_devices() {
+  load_bonded_devices(bonded_devices);
+  update_accept_list();
+}
+
+void ESP32BLEController::remove_all_bonded_devices() {
+  for (auto& bonded_device : bonded_devices) {
+    remove_ble_bond(bonded_device.address);
+  }
+  // The removal is asynchronous, so we do not reload the bonded devices from the stack here.
+  bonded_devices.clear();
+  update_accept_list();
+}
+
+/**
+ * Loads the addresses of the bonded devices into the accept list of the BLE controller and lets advertising accept connections only from those devices.
+ * Without any bonded device, every device may connect, so that the first device can be bonded.
+ */
+void ESP32BLEController::update_accept_list() {
+  if (!accept_list_only) {
+    return;
+  }
+
+  // The accept list cannot be changed while advertising uses it.
+  BLEAdvertising* advertising = BLEDevice::getAdvertising();
+  const bool restart_advertising = ble_server != nullptr;
+  if (restart_advertising) {
+    advertising->stop();
+  }
+
+  clear_ble_accept_list();
+  for (auto& bonded_device : bonded_devices) {
+    const BLEStackResult result = add_to_ble_accept_list(bonded_device.address, bonded_device.public_address);
+    if (result != BLEStackResult::OK) {
+      ESP_LOGW(TAG, "Adding %s to the accept list failed: %s", format_bd_address(bonded_device.address.bytes).c_str(), get_ble_stack_result_name(result));
+    }
+  }
+  advertising->setScanFilter(false, !bonded_devices.empty());
 
+  if (restart_advertising) {
+    update_advertising();
+  }
+}
+
+void ESP32BLEController::onPassKeyNotify(uint32_t pass_key) {
   auto& callbacks = on_show_pass_key_callbacks;
-  global_ble_controller->execute_in_loop([&callbacks, pass_key_str](){ 
+  global_ble_controller->execute_in_loop([&callbacks, pass_key](){ 
     ESP_LOGI(TAG, "BLE authentication - pass received");
-    callbacks.call(pass_key_str);
+
+    // Note: The pass key is formatted in the loop in order to keep the deferred function small.
+    char pass_key_digits[6 + 1];
+    snprintf(pass_key_digits, sizeof(pass_key_digits), "%06d", pass_key);
+    callbacks.call(string(pass_key_digits));
   });
 }
 
 void ESP32BLEController::onAuthenticationComplete(esp_ble_auth_cmpl_t result) {
   auto& callbacks = on_authentication_complete_callbacks;
   bool success=result.success;
-  global_ble_controller->execute_in_loop([&callbacks, success](){
+  global_ble_controller->execute_in_loop([this, &callbacks, success](){
     if (success) {
       ESP_LOGD(TAG, "BLE authentication - completed succesfully");
+      refresh_bonded_devices();
     } else {
       ESP_LOGD(TAG, "BLE authentication - failed");
     }
@@ -485,27 +1058,233 @@ bool ESP32BLEController::onConfirmPIN(uint32_t pin) {
   return true;
 }
 
-void ESP32BLEController::ESP32BLEController::onConnect(BLEServer* server) {
-  auto& callbacks = on_connected_callbacks;
-  global_ble_controller->execute_in_loop([&callbacks](){ 
-    ESP_LOGD(TAG, "BLE server - connected");
-    callbacks.call();
+void ESP32BLEController::onConnect(BLEServer* server, esp_ble_gatts_cb_param_t* param) {
+  const uint16_t conn_id = param->connect.conn_id;
+  esp_bd_addr_t address;
+  memcpy(address, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+  global_ble_controller->execute_in_loop([this, conn_id, address](){ 
+    ESP_LOGD(TAG, "BLE server - connected (connection %d)", conn_id);
+    if (connections.size() >= max_connections) {
+      // The rejected connection is kept out of the connections, so that it is never notified and does not limit the MTU.
+      ESP_LOGW(TAG, "BLE server - too many connections, disconnecting connection %d", conn_id);
+      rejected_conn_ids.push_back(conn_id);
+      ble_server->disconnect(conn_id);
+      return;
+    }
+
+    BLEClientConnection connection;
+    connection.conn_id = conn_id;
+    memcpy(connection.address, address, sizeof(esp_bd_addr_t));
+    connection.mtu = BLE_DEFAULT_MTU;
+    connections.push_back(connection);
+
+    cancel_timeout("idle");
+    request_connection_parameters(connection);
+    update_advertising();
+
+    on_connected_callbacks.call();
   });
 }
 
-void ESP32BLEController::ESP32BLEController::onDisconnect(BLEServer* server) {
+void ESP32BLEController::onDisconnect(BLEServer* server, esp_ble_gatts_cb_param_t* param) {
+  const uint16_t conn_id = param->disconnect.conn_id;
   auto& callbacks = on_disconnected_callbacks;
-  global_ble_controller->execute_in_loop([&callbacks, this](){ 
-    ESP_LOGD(TAG, "BLE server - disconnected");
+  global_ble_controller->execute_in_loop([&callbacks, this, conn_id](){ 
+    ESP_LOGD(TAG, "BLE server - disconnected (connection %d)", conn_id);
+    auto rejected = std::find(rejected_conn_ids.begin(), rejected_conn_ids.end(), conn_id);
+    if (rejected != rejected_conn_ids.end()) {
+      rejected_conn_ids.erase(rejected);
+      return; // the callbacks have not been called on connect either
+    }
+    auto connection = std::find_if(connections.begin(), connections.end(), [conn_id](const BLEClientConnection& connection) { return connection.conn_id == conn_id; });
+    if (connection == connections.end()) {
+      return;
+    }
+    connections.erase(connection);
 
     // after 500ms start advertising again
     const uint32_t delay_millis = 500;
-    App.scheduler.set_timeout(this, "", delay_millis, []{ BLEDevice::startAdvertising(); });
+    App.scheduler.set_timeout(this, "advertising", delay_millis, [this]{ update_advertising(); });
+    if (connections.empty()) {
+      schedule_idle_timeout();
+    }
 
     callbacks.call(); 
   });
 }
 
+void ESP32BLEController::onMtuChanged(BLEServer* server, esp_ble_gatts_cb_param_t* param) {
+  const uint16_t conn_id = param->mtu.conn_id;
+  const uint16_t mtu = param->mtu.mtu;
+  global_ble_controller->execute_in_loop([this, conn_id, mtu](){ 
+    ESP_LOGD(TAG, "BLE server - MTU of connection %d is %d", conn_id, mtu);
+    BLEClientConnection* connection = get_connection(conn_id);
+    if (connection != nullptr) {
+      connection->mtu = mtu;
+    }
+  });
+}
+
+/// The controller stops advertising on each new connection, so we restart it as long as there are free connection slots.
+void ESP32BLEController::update_advertising() {
+  if (!dormant && connections.size() < max_connections) {
+    BLEDevice::startAdvertising();
+  }
+}
+
+/// Stops advertising once no client has connected for the idle timeout.
+void ESP32BLEController::schedule_idle_timeout() {
+  if (idle_timeout_millis > 0) {
+    set_timeout("idle", idle_timeout_millis, [this]{ enter_dormancy(); });
+  }
+}
+
+void ESP32BLEController::enter_dormancy() {
+  if (dormant || !connections.empty()) {
+    return;
+  }
+  ESP_LOGI(TAG, "No connection for %u ms, stopping advertising", idle_timeout_millis);
+  dormant = true;
+  BLEDevice::getAdvertising()->stop();
+}
+
+void ESP32BLEController::wake() {
+  if (ble_server == nullptr) {
+    return; // BLE is switched off
+  }
+  if (dormant) {
+    ESP_LOGI(TAG, "Waking up, starting advertising");
+    dormant = false;
+    update_advertising();
+  }
+  if (connections.empty()) {
+    schedule_idle_timeout();
+  }
+}
+
+/**
+ * Called by the BLE library for each GATT server event (in the BLE task), we are only interested in writes of client characteristic configuration descriptors 
+ * and in the telemetry of the links (which goes to the telemetry mailbox, not to the deferred functions).
+ */
+void ESP32BLEController::on_gatts_event(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t* param) {
+  if (event == ESP_GATTS_CONNECT_EVT) {
+    const auto& connect = param->connect;
+    global_ble_controller->link_telemetry.on_connected(connect.conn_id, connect.remote_bda, connect.conn_params.interval, connect.conn_params.latency, connect.conn_params.timeout);
+    return;
+  }
+  if (event == ESP_GATTS_CONGEST_EVT) {
+#ifdef USE_BLE_CONTROLLER_NOTIFY_TASK
+    global_ble_controller->notify_task.on_congestion_changed(param->congest.conn_id, param->congest.congested);
+#endif
+    global_ble_controller->link_telemetry.post_congestion(param->congest.conn_id, param->congest.congested);
+    return;
+  }
+  if (event == ESP_GATTS_DISCONNECT_EVT) {
+#ifdef USE_BLE_CONTROLLER_NOTIFY_TASK
+    global_ble_controller->notify_task.on_congestion_changed(param->disconnect.conn_id, false);
+#endif
+    global_ble_controller->link_telemetry.on_disconnected(param->disconnect.conn_id);
+    return;
+  }
+  // writes of other attributes (e.g. a 2-byte switch value) must not take room in the subscriptions lane
+  if (event != ESP_GATTS_WRITE_EVT || param->write.is_prep || param->write.len != 2 || !is_cccd_handle(param->write.handle)) {
+    return;
+  }
+
+  const uint16_t conn_id = param->write.conn_id;
+  const uint16_t handle = param->write.handle;
+  const bool subscribed = param->write.value[0] & 0x01; // notifications enabled
+  global_ble_controller->execute_in_loop([conn_id, handle, subscribed](){
+    global_ble_controller->on_subscription_changed(conn_id, handle, subscribed);
+  }, BLEDeferredLane::SUBSCRIPTIONS);
+}
+
+/// Called by the BLE library for each GAP event (in the BLE task), we are only interested in RSSI readings and connection parameter updates.
+void ESP32BLEController::on_gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param) {
+  if (event == ESP_GAP_BLE_READ_RSSI_COMPLETE_EVT && param->read_rssi_cmpl.status == ESP_BT_STATUS_SUCCESS) {
+    global_ble_controller->link_telemetry.post_rssi(param->read_rssi_cmpl.remote_addr, param->read_rssi_cmpl.rssi);
+  } else if (event == ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT && param->update_conn_params.status == ESP_BT_STATUS_SUCCESS) {
+    const auto& update = param->update_conn_params;
+    global_ble_controller->link_telemetry.post_connection_parameters(update.bda, update.conn_int, update.latency, update.timeout);
+  }
+}
+
+/// Takes the telemetry the BLE stack has reported for the connections since the last loop pass.
+void ESP32BLEController::take_link_telemetry() {
+  BLELinkTelemetry telemetry;
+  for (auto& connection : connections) {
+    if (!link_telemetry.take(connection.conn_id, telemetry)) {
+      continue;
+    }
+    BLELinkQuality& link = connection.link_quality;
+    if (telemetry.has_rssi) {
+      link.rssi = telemetry.rssi;
+    }
+    if (telemetry.has_connection_parameters) {
+      ESP_LOGD(TAG, "BLE server - connection %d uses interval %u.%02u ms, latency %u, timeout %u ms", connection.conn_id, telemetry.connection_interval * 5 / 4, 
+               telemetry.connection_interval * 125 % 100, telemetry.slave_latency, telemetry.supervision_timeout * 10);
+      link.connection_interval = telemetry.connection_interval;
+      link.slave_latency = telemetry.slave_latency;
+      link.supervision_timeout = telemetry.supervision_timeout;
+    }
+    link.congested = telemetry.congested;
+    link.counters.congestion_events += telemetry.congestion_events;
+    link_counters.congestion_events += telemetry.congestion_events;
+  }
+}
+
+void ESP32BLEController::count_notification(BLEClientConnection& connection, bool sent) {
+  BLELinkCounters& counters = connection.link_quality.counters;
+  ++counters.notifications;
+  ++link_counters.notifications;
+  if (!sent) {
+    ++counters.failed_notifications;
+    ++link_counters.failed_notifications;
+  }
+}
+
+/**
+ * Called periodically: adapts the notification intervals to the congestion during the last period and, every few periods, reads the RSSI of all 
+ * connections and publishes the link quality sensors.
+ */
+void ESP32BLEController::update_link_quality() {
+  // a link counts as congested if it still is or if it has been congested or has rejected notifications in the meantime
+  bool congested = link_counters.congestion_events != link_counters_at_last_period.congestion_events
+      || link_counters.failed_notifications != link_counters_at_last_period.failed_notifications;
+  for (const auto& connection : connections) {
+    congested |= connection.link_quality.congested;
+  }
+  link_counters_at_last_period = link_counters;
+  notify_throttle.update(congested);
+
+  if (++link_quality_periods % LINK_QUALITY_SENSOR_PERIODS != 0) {
+    return;
+  }
+  for (const auto& connection : connections) {
+    read_ble_rssi(BLEStackAddress::from_bytes(connection.address));
+  }
+#ifdef USE_SENSOR
+  // the RSSI readings arrive later, so the sensors publish those of the previous reading
+  const BLEClientConnection* connection = connections.empty() ? nullptr : &connections.front();
+  link_quality_sensors.publish(connection != nullptr ? &connection->link_quality : nullptr, connection != nullptr ? connection->mtu : 0, link_counters);
+#endif
+}
+
+void ESP32BLEController::on_subscription_changed(uint16_t conn_id, uint16_t cccd_handle, bool subscribed) {
+  BLEClientConnection* connection = get_connection(conn_id);
+  if (connection == nullptr) {
+    return;
+  }
+
+  auto& handles = connection->subscribed_cccd_handles;
+  auto position = std::find(handles.begin(), handles.end(), cccd_handle);
+  if (subscribed && position == handles.end()) {
+    handles.push_back(cccd_handle);
+  } else if (!subscribed && position != handles.end()) {
+    handles.erase(position);
+  }
+}
+
 ESP32BLEController* global_ble_controller = nullptr;
 
 } // namespace esp32_ble_controller
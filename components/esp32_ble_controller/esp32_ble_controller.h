@@ -1,7 +1,7 @@
 #pragma once
 
+#include <atomic>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 #include <BLEServer.h>
@@ -9,17 +9,24 @@
 #include "esphome/core/entity_base.h"
 #include "esphome/core/controller.h"
 #include "esphome/core/defines.h"
+#include "esphome/core/helpers.h"
 #include "esphome/core/preferences.h"
 
 #include "ble_component_handler_base.h"
+#include "ble_link_quality.h"
 #include "ble_maintenance_handler.h"
+#include "ble_notify_task.h"
+#include "ble_sensor_history.h"
+#include "ble_stack.h"
+#include "ble_statistics.h"
+#include "ble_utils.h"
+#include "inline_function.h"
 #include "thread_safe_bounded_queue.h"
 #ifdef USE_WIFI
 #include "wifi_configuration_handler.h"
 #endif
 
 using std::string;
-using std::unordered_map;
 using std::vector;
 
 namespace esphome {
@@ -31,6 +38,63 @@ enum class BLESecurityMode : uint8_t { NONE, SECURE, BOND };
 
 class BLEControllerCustomCommandExecutionTrigger;
 
+/// State of a connection to a BLE client. (Only accessed from the main loop.)
+struct BLEClientConnection {
+  uint16_t conn_id;
+  esp_bd_addr_t address;
+  uint16_t mtu; // negotiated MTU
+  BLELinkQuality link_quality;
+  vector<uint16_t> subscribed_cccd_handles; // handles of the client characteristic configuration descriptors (0x2902) this client has enabled
+
+  bool is_subscribed(uint16_t cccd_handle) const;
+};
+
+/**
+ * Named set of advertising and connection parameters, which trades latency for power consumption.
+ * The connection parameters are requested from each client after connecting, but the client has the final say.
+ */
+struct BLEConnectionProfile {
+  string name;
+  uint16_t min_advertising_interval; // in units of 0.625 ms
+  uint16_t max_advertising_interval; // in units of 0.625 ms
+  uint16_t min_connection_interval; // in units of 1.25 ms
+  uint16_t max_connection_interval; // in units of 1.25 ms
+  uint16_t slave_latency; // number of connection events the peripheral may skip
+  uint16_t supervision_timeout; // in units of 10 ms
+};
+
+/// Function that is deferred to the main loop; its captures must fit into the inline storage (i.e. at most four pointers).
+using DeferredFunction = InlineFunction<4 * sizeof(void*)>;
+
+/**
+ * Lanes of the functions deferred from the BLE task to the main loop, each with its own bounded queue; the main loop executes them in this order (i.e. by priority).
+ * A full lane rejects new functions (and counts them). Only the client-driven lanes can lose work that way: the events lane has room for all events of each 
+ * possible connection (see BLE_CONTROLLER_EVENTS_PER_CONNECTION), whereas the number of subscriptions, commands and writes is up to the clients.
+ */
+enum class BLEDeferredLane : uint8_t {
+  EVENTS, // connection and security events
+  SUBSCRIPTIONS, // writes of client characteristic configuration descriptors
+  COMMANDS, // writes of the maintenance service
+  COMPONENT_WRITES, // writes of component characteristics
+};
+
+/// Maximum number of events a single connection defers: connect, MTU, disconnect and up to five security callbacks.
+#define BLE_CONTROLLER_EVENTS_PER_CONNECTION 8
+
+// capacities of the lanes (configurable via yaml), the events lane has room for one connection more than allowed (which is rejected right away)
+#ifndef BLE_CONTROLLER_EVENTS_QUEUE_CAPACITY
+#define BLE_CONTROLLER_EVENTS_QUEUE_CAPACITY (2 * BLE_CONTROLLER_EVENTS_PER_CONNECTION)
+#endif
+#ifndef BLE_CONTROLLER_SUBSCRIPTIONS_QUEUE_CAPACITY
+#define BLE_CONTROLLER_SUBSCRIPTIONS_QUEUE_CAPACITY 16
+#endif
+#ifndef BLE_CONTROLLER_COMMANDS_QUEUE_CAPACITY
+#define BLE_CONTROLLER_COMMANDS_QUEUE_CAPACITY 8
+#endif
+#ifndef BLE_CONTROLLER_COMPONENT_WRITES_QUEUE_CAPACITY
+#define BLE_CONTROLLER_COMPONENT_WRITES_QUEUE_CAPACITY 16
+#endif
+
 /**
  * Bluetooth Low Energy controller for ESP32.
  * It provides a BLE server that can BLE clients like mobile phones can connect to and access components (like reading sensor values and control switches).
@@ -46,10 +110,17 @@ public:
 
   // pre-setup configurations
 
-  void register_component(EntityBase* component, const string& service_UUID, const string& characteristic_UUID, bool use_BLE2902 = true);
+  /// Registers a component to expose, the UUIDs are 128-bit constants (see to_ble_uuid()) that must outlive the controller.
+  void register_component(EntityBase* component, const uint8_t* service_UUID, const uint8_t* characteristic_UUID, bool use_BLE2902 = true, uint32_t min_notify_interval = 0, float notify_delta = 0,
+                          BLEValueEncoding encoding = BLEValueEncoding::DEFAULT, int8_t exponent = 0, uint16_t history_size = 0);
 
-  void register_command(const string& name, const string& description, BLEControllerCustomCommandExecutionTrigger* trigger);
+  /// Registers a service of the components with the number of attribute handles it needs (for all its characteristics and their descriptors).
+  void register_service(const uint8_t* service_UUID, uint16_t num_handles);
+
+  /// Registers a custom command, name and description must be null-terminated constants.
+  void register_command(const char* name, const char* description, BLEControllerCustomCommandExecutionTrigger* trigger);
   const vector<BLECommand*>& get_commands() const;
+  const BLECommand* find_command(string_view name) const;
 
   void add_on_show_pass_key_callback(std::function<void(string)>&& trigger_function);
   void add_on_authentication_complete_callback(std::function<void(bool)>&& trigger_function);
@@ -58,11 +129,43 @@ public:
 
   void set_maintenance_service_exposed_after_flash(bool exposed);
 
+  void set_mtu(uint16_t mtu) { this->mtu = mtu; }
+  void set_max_connections(uint8_t max_connections) { this->max_connections = max_connections; }
+
+  /// Sets the time without any connection after which advertising stops (0 = advertise forever).
+  void set_idle_timeout(uint32_t idle_timeout_millis) { this->idle_timeout_millis = idle_timeout_millis; }
+  bool is_dormant() const { return dormant; }
+  /**
+   * When enabled, the memory of the Bluetooth controller goes back to the heap at boot if BLE is switched off (all BLE services disabled).
+   * This cannot be undone until the next boot, so it must only be enabled if no other component uses Bluetooth (which is validated by the yaml configuration).
+   */
+  void set_release_bt_memory_when_off(bool release) { release_bt_memory_when_off = release; }
+  /// Starts advertising again after the idle timeout has stopped it.
+  void wake();
+
+  void add_connection_profile(const string& name, uint16_t min_advertising_interval, uint16_t max_advertising_interval, uint16_t min_connection_interval, uint16_t max_connection_interval,
+                              uint16_t slave_latency, uint16_t supervision_timeout);
+  const vector<BLEConnectionProfile>& get_connection_profiles() const { return connection_profiles; }
+  /// Returns the active connection profile, nullptr if the defaults of the BLE stack are used.
+  const BLEConnectionProfile* get_connection_profile() const;
+  /// Selects the connection profile with the given name (and applies it when the controller is set up already).
+  bool set_connection_profile(const string& name);
+  void set_chunked_command_results(bool chunked) { maintenance_handler.set_chunked_command_results(chunked); }
+  void set_diagnostics_characteristic_exposed(bool exposed) { maintenance_handler.set_diagnostics_characteristic_exposed(exposed); }
+  void set_snapshot_characteristic_exposed(bool exposed) { maintenance_handler.set_snapshot_characteristic_exposed(exposed); }
+  void set_batch_characteristic_exposed(bool exposed) { maintenance_handler.set_batch_characteristic_exposed(exposed); }
+
   void set_security_mode(BLESecurityMode mode) { security_mode = mode; }
   inline BLESecurityMode get_security_mode() const { return security_mode; }
 
   // deprecated
   void set_security_enabled(bool enabled);
+
+  /// When enabled (and devices are bonded), only bonded devices can connect; the filtering happens in the BLE controller using its accept list.
+  void set_accept_list_only(bool accept_list_only) { this->accept_list_only = accept_list_only; }
+  /// Returns the bonded devices, which are cached and refreshed after each authentication.
+  const vector<BLEStackBond>& get_bonded_devices() const { return bonded_devices; }
+  void remove_all_bonded_devices();
   inline bool get_security_enabled() const { return security_mode != BLESecurityMode::NONE; }
 
   // setup
@@ -85,55 +188,116 @@ public:
   void switch_component_services_exposed(bool exposed);
 
 #ifdef USE_LOGGER
-  int get_log_level() { return maintenance_handler->get_log_level(); }
-  void set_log_level(int level) { maintenance_handler->set_log_level(level); }
+  int get_log_level() { return maintenance_handler.get_log_level(); }
+  void set_log_level(int level) { maintenance_handler.set_log_level(level); }
 #endif
 
 #ifdef USE_WIFI
   void set_wifi_configuration(const string& ssid, const string& password, bool hidden_network);
   void clear_wifi_configuration_and_reboot();
+  /// Tries the given WIFI configuration and saves it only once the device has connected (without reboot), the outcome is sent as command result.
+  void test_wifi_configuration(const string& ssid, const string& password, bool hidden_network);
+  bool is_testing_wifi_configuration() const { return wifi_configuration_handler.is_testing_credentials(); }
+  /// Scans the WIFI channels, the found access points are sent as command results while the scan runs.
+  void start_wifi_scan() { wifi_configuration_handler.start_scan(); }
+  bool is_scanning_wifi() const { return wifi_configuration_handler.is_scanning(); }
   const optional<string> get_current_ssid_in_wifi_configuration();
 #endif
 
   void send_command_result(const string& result_message);
   void send_command_result(const char* result_msg_format, ...);
 
-  /// Executes a given function in the main loop of the app. (Can be called from another RTOS task.)
-  void execute_in_loop(std::function<void()>&& deferred_function);
+  const vector<BLEClientConnection>& get_connections() const { return connections; }
+  /// Returns the maximum number of bytes that fit into a single notification to the connected clients (i.e. MTU - 3).
+  uint16_t get_max_notification_length() const;
+  /// Returns the given minimum notification interval of a component, widened while the links are congested (see BLENotifyThrottle).
+  uint32_t get_notify_interval(uint32_t min_notify_interval) const { return notify_throttle.get_notify_interval(min_notify_interval); }
+
+#ifdef USE_SENSOR
+  void set_rssi_sensor(sensor::Sensor* sensor) { link_quality_sensors.rssi = sensor; }
+  void set_mtu_sensor(sensor::Sensor* sensor) { link_quality_sensors.mtu = sensor; }
+  void set_connection_interval_sensor(sensor::Sensor* sensor) { link_quality_sensors.connection_interval = sensor; }
+  void set_slave_latency_sensor(sensor::Sensor* sensor) { link_quality_sensors.slave_latency = sensor; }
+  void set_congestion_events_sensor(sensor::Sensor* sensor) { link_quality_sensors.congestion_events = sensor; }
+  void set_notification_success_sensor(sensor::Sensor* sensor) { link_quality_sensors.notification_success = sensor; }
+#endif
+
+  /// Returns true if another notification can be sent to all connections right now; streams (e.g. of chunks) pause otherwise, so that no part gets dropped.
+  bool has_notification_capacity() const;
+
+  /**
+   * Notifies the connected clients about the current value of the given characteristic.
+   * If the characteristic has a 0x2902 descriptor, only clients that enabled notifications via this descriptor are notified, otherwise all clients.
+   * The sent notifications are counted in the given statistics (if any).
+   */
+  void notify(BLECharacteristic* characteristic, BLEHandlerStatistics* statistics = nullptr);
+  /// Notifies the connected clients (like above) about the given value instead of the current value of the characteristic, which remains unchanged (e.g. a chunk of it).
+  void notify(BLECharacteristic* characteristic, const uint8_t* value, size_t length, BLEHandlerStatistics* statistics = nullptr);
+  /// Notifies only the client of the given connection (if subscribed, like above) about the given value, e.g. the response to a request of this client.
+  void notify(uint16_t conn_id, BLECharacteristic* characteristic, const uint8_t* value, size_t length, BLEHandlerStatistics* statistics = nullptr);
+
+  /// Returns a human-readable report of the statistics of the deferred functions queue and all handlers, one line each.
+  string get_statistics_report() const;
+  void reset_statistics();
+  /// Returns the memory used by the controller (its object and the arena of its handlers, descriptors and commands) compared to the free heap.
+  string get_heap_report() const;
+
+  /// Returns the generation of the component states, which is incremented on each state change.
+  uint32_t get_state_generation() const { return state_generation; }
+  /**
+   * Writes the states of the exposed components from the given component index on as snapshot into the given buffer (see README for the format).
+   * Once an entry does not fit into the buffer, it and all further entries are omitted; the header flags this and tells the index to continue from.
+   * Values longer than 255 bytes are cut, which is flagged as well.
+   * @return the length of the snapshot
+   */
+  size_t write_state_snapshot(uint8_t* buffer, size_t max_length, uint8_t first_index = 0);
+
+  /// Returns true if any registered component keeps a history (which needs the history download characteristic).
+  bool has_history() const;
+  /// Returns the history of the component with the given index (in the order of registration), nullptr if it does not keep one.
+  const BLESensorHistory* get_history(size_t component_index) const;
+
+  /**
+   * Applies the writes of a batch (see README for the format) to the components in one go, like separate writes to their characteristics.
+   * The indices of the rejected records are stored in the given array (up to its size) and counted in rejected_count.
+   * @return the number of records that have been applied
+   */
+  size_t apply_batch_writes(const uint8_t* batch, size_t length, uint8_t* rejected_indices, size_t max_rejected_indices, size_t& rejected_count);
+
+  /**
+   * Executes a given function in the main loop of the app. (Can be called from another RTOS task, it never blocks.)
+   * If the lane is full, the function is rejected and counted (see BLEDeferredLane); a rejected component write that can be coalesced with a queued write of 
+   * the same characteristic (which reads the latest value anyway) is counted as coalesced.
+   * @return false if the function has been rejected
+   */
+  bool execute_in_loop(DeferredFunction&& deferred_function, BLEDeferredLane lane = BLEDeferredLane::EVENTS, bool coalescable = false);
+  /// Keeps the main loop running without delays for a while after a client write, so that further writes are handled within one loop pass.
+  void on_client_write_handled();
 
 private:
   void initialize_ble_mode();
+  void apply_ble_mode_change(BLEMaintenanceMode previous_mode);
+  void send_service_changed_indications();
 
   bool setup_ble();
   void setup_ble_server_and_services();
   void setup_ble_services_for_components();
-  template <typename C> void setup_ble_services_for_components(const vector<C*>& components, BLEComponentHandlerBase* (*handler_creator)(C*, const BLECharacteristicInfoForHandler&));
-  template <typename C> void setup_ble_service_for_component(C* component, BLEComponentHandlerBase* (*handler_creator)(C*, const BLECharacteristicInfoForHandler&));
-  template <typename C, typename S> void update_component_state(C* component, S state);
+  template <typename C> void setup_ble_services_for_components(const vector<C*>& components, BLEComponentType type, BLEComponentHandlerBase* (*handler_creator)(C*, const BLECharacteristicInfoForHandler&));
+  template <typename C> void setup_ble_service_for_component(C* component, BLEComponentType type, BLEComponentHandlerBase* (*handler_creator)(C*, const BLECharacteristicInfoForHandler&));
+  uint16_t get_service_handle_count(const uint8_t* service_UUID) const;
+  int get_component_index(EntityBase* component) const;
+  BLEComponentHandlerBase* get_handler(EntityBase* component) const;
+  template <typename S> void update_component_state(BLEComponentHandlerBase* handler, const S& state);
 
-  // Controller methods:
   void register_state_change_callbacks_and_send_initial_states();
-#ifdef USE_BINARY_SENSOR
-  void on_binary_sensor_update(binary_sensor::BinarySensor *obj, bool state);
-#endif
-#ifdef USE_FAN
-  void on_fan_update(fan::Fan *obj);
-#endif
+
+  // Controller methods (for components that are not supported yet):
 #ifdef USE_LIGHT
   void on_light_update(light::LightState *obj);
 #endif
-#ifdef USE_SENSOR
-  void on_sensor_update(sensor::Sensor *obj, float state);
-#endif
-#ifdef USE_SWITCH
-  void on_switch_update(switch_::Switch *obj, bool state);
-#endif
 #ifdef USE_COVER
   void on_cover_update(cover::Cover *obj);
 #endif
-#ifdef USE_TEXT_SENSOR
-  void on_text_sensor_update(text_sensor::TextSensor *obj, std::string state);
-#endif
 #ifdef USE_CLIMATE
   void on_climate_update(climate::Climate *obj);
 #endif
@@ -145,29 +309,90 @@ private:
   virtual void onAuthenticationComplete(esp_ble_auth_cmpl_t); // inherited from BLESecurityCallbacks
   virtual bool onConfirmPIN(uint32_t pin); // inherited from BLESecurityCallbacks
   
-  virtual void onConnect(BLEServer* server); // inherited from BLEServerCallbacks
-  virtual void onDisconnect(BLEServer* server); // inherited from BLEServerCallbacks
+  virtual void onConnect(BLEServer* server, esp_ble_gatts_cb_param_t* param); // inherited from BLEServerCallbacks
+  virtual void onDisconnect(BLEServer* server, esp_ble_gatts_cb_param_t* param); // inherited from BLEServerCallbacks
+  virtual void onMtuChanged(BLEServer* server, esp_ble_gatts_cb_param_t* param); // inherited from BLEServerCallbacks
+
+  static void on_gatts_event(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t* param);
+  static void on_gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param);
+  void on_subscription_changed(uint16_t conn_id, uint16_t cccd_handle, bool subscribed);
+  void take_link_telemetry();
+  void send_notification(BLEClientConnection& connection, BLECharacteristic* characteristic, const uint8_t* value, size_t length, BLEHandlerStatistics* statistics);
+  void count_notification(BLEClientConnection& connection, bool sent);
+  void update_link_quality();
+  BLEClientConnection* get_connection(uint16_t conn_id);
+  void update_advertising();
+  void apply_advertising_parameters();
+  void schedule_idle_timeout();
+  void refresh_bonded_devices();
+  void update_accept_list();
+  void enter_dormancy();
+  void request_connection_parameters(const BLEClientConnection& connection);
 
 private:
-  BLEServer* ble_server;
+  BLEServer* ble_server{nullptr};
+  uint16_t mtu{BLE_MAX_MTU};
+  uint8_t max_connections{1};
+  vector<BLEClientConnection> connections;
+  vector<uint16_t> rejected_conn_ids; // connections beyond max_connections that are being disconnected
+
+  uint32_t idle_timeout_millis{0};
+  bool release_bt_memory_when_off{false};
+  bool dormant{false};
+
+  static const uint32_t LINK_QUALITY_PERIOD_MILLIS = 1000;
+  static const uint32_t LINK_QUALITY_SENSOR_PERIODS = 10; // the RSSI is read and the sensors are published every that many periods
+  uint32_t link_quality_periods{0};
+  BLELinkCounters link_counters; // of all connections since the statistics have been reset
+  BLELinkCounters link_counters_at_last_period;
+  BLENotifyThrottle notify_throttle;
+  BLELinkTelemetryMailbox link_telemetry; // filled by the BLE task
+#ifdef USE_SENSOR
+  BLELinkQualitySensors link_quality_sensors;
+#endif
+
+  vector<BLEConnectionProfile> connection_profiles;
+  int connection_profile_index{-1};
 
   BLEMaintenanceMode initial_ble_mode_after_flashing{BLEMaintenanceMode::ALL};
   BLEMaintenanceMode ble_mode;
   ESPPreferenceObject ble_mode_preference;
 
   BLESecurityMode security_mode{BLESecurityMode::SECURE};
+  bool accept_list_only{false};
+  vector<BLEStackBond> bonded_devices;
   bool can_show_pass_key{false};
 
-  BLEMaintenanceHandler* maintenance_handler;
+  BLEMaintenanceHandler maintenance_handler;
 
 #ifdef USE_WIFI
   WifiConfigurationHandler wifi_configuration_handler;
 #endif
 
-  unordered_map<string, BLECharacteristicInfoForHandler> info_for_component;
-  unordered_map<string, BLEComponentHandlerBase*> handler_for_component;
+  // registered services of the components with the number of attribute handles they need (computed during code generation)
+  vector<std::pair<const uint8_t*, uint16_t>> service_handle_counts;
+
+  // registered components, their characteristic infos and their handlers (created during setup) share the same index (the order of registration)
+  vector<EntityBase*> registered_components;
+  vector<BLECharacteristicInfoForHandler> characteristic_info_for_components;
+  vector<BLEComponentHandlerBase*> handler_for_component;
+  vector<BLEService*> component_services;
+  bool component_services_created{false};
+  uint32_t state_generation{0};
+
+  static const uint32_t HIGH_FREQUENCY_LOOP_AFTER_WRITE_MILLIS = 2000;
+  HighFrequencyLoopRequester high_frequency_loop_requester;
+  uint32_t last_client_write_millis{0};
+
+#ifdef USE_BLE_CONTROLLER_NOTIFY_TASK
+  BLENotifyTask notify_task;
+#endif
 
-  ThreadSafeBoundedQueue<std::function<void()>> deferred_functions_for_loop{16};
+  ThreadSafeBoundedQueue<DeferredFunction, BLE_CONTROLLER_EVENTS_QUEUE_CAPACITY> deferred_events;
+  ThreadSafeBoundedQueue<DeferredFunction, BLE_CONTROLLER_SUBSCRIPTIONS_QUEUE_CAPACITY> deferred_subscriptions;
+  ThreadSafeBoundedQueue<DeferredFunction, BLE_CONTROLLER_COMMANDS_QUEUE_CAPACITY> deferred_commands;
+  ThreadSafeBoundedQueue<DeferredFunction, BLE_CONTROLLER_COMPONENT_WRITES_QUEUE_CAPACITY> deferred_component_writes;
+  std::atomic<uint32_t> coalesced_component_writes{0};
 
   CallbackManager<void(string)> on_show_pass_key_callbacks;
   CallbackManager<void(bool)>   on_authentication_complete_callbacks;
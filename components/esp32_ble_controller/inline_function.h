@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+/**
+ * Move-only wrapper for a callable without arguments and without result (like a lambda), which stores the callable inline.
+ * In contrast to std::function it never allocates memory on the heap: the maximum size of the callable (i.e. of its captures) is fixed at compile time,
+ * and assigning a larger callable results in a compilation error.
+ * @brief Allocation-free replacement for std::function<void()>
+ */
+template <size_t CAPACITY>
+class InlineFunction {
+public:
+  InlineFunction() : operations(nullptr) {}
+
+  template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, InlineFunction>::value>::type>
+  InlineFunction(F&& function) {
+    using Callable = typename std::decay<F>::type;
+    static_assert(sizeof(Callable) <= CAPACITY, "Callable too large for inline storage, capture fewer or smaller values");
+    static_assert(alignof(Callable) <= alignof(Storage), "Alignment of callable not supported by inline storage");
+
+    new (&storage) Callable(std::forward<F>(function));
+    operations = CallableOperations<Callable>::get();
+  }
+
+  InlineFunction(InlineFunction&& other) : operations(nullptr) { move_from(other); }
+
+  InlineFunction& operator=(InlineFunction&& other) {
+    if (this != &other) {
+      reset();
+      move_from(other);
+    }
+    return *this;
+  }
+
+  InlineFunction(const InlineFunction&) = delete;
+  InlineFunction& operator=(const InlineFunction&) = delete;
+
+  ~InlineFunction() { reset(); }
+
+  void operator()() { operations->invoke(&storage); }
+
+  explicit operator bool() const { return operations != nullptr; }
+
+  /// Destroys the stored callable (if any).
+  void reset() {
+    if (operations != nullptr) {
+      operations->destroy(&storage);
+      operations = nullptr;
+    }
+  }
+
+private:
+  using Storage = typename std::aligned_storage<CAPACITY, alignof(std::max_align_t)>::type;
+
+  /// Type-erased operations on the stored callable.
+  struct Operations {
+    void (*invoke)(void* callable);
+    void (*move)(void* destination, void* source);
+    void (*destroy)(void* callable);
+  };
+
+  template <typename C>
+  struct CallableOperations {
+    static void invoke(void* callable) { (*static_cast<C*>(callable))(); }
+    static void move(void* destination, void* source) { new (destination) C(std::move(*static_cast<C*>(source))); }
+    static void destroy(void* callable) { static_cast<C*>(callable)->~C(); }
+
+    static const Operations* get() {
+      static const Operations operations = { invoke, move, destroy };
+      return &operations;
+    }
+  };
+
+  void move_from(InlineFunction& other) {
+    if (other.operations != nullptr) {
+      other.operations->move(&storage, &other.storage);
+      operations = other.operations;
+      other.reset();
+    }
+  }
+
+  Storage storage;
+  const Operations* operations;
+};
+
+} // namespace esp32_ble_controller
+} // namespace esphome
@@ -0,0 +1,85 @@
+#include "log_ring_buffer.h"
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+static_assert((LogRingBuffer::CAPACITY & (LogRingBuffer::CAPACITY - 1)) == 0, "Capacity must be a power of two");
+
+/**
+ * Calls the given function for each character of the message that is not part of the logger magic, e.g., sequences that mark a color.
+ * Note: We do not use regex replacement because it enlarges the binary by roughly 50kb!
+ */
+template <typename F>
+static void for_each_visible_character(const char* message, F&& function) {
+  bool within_magic = false;
+  for (const char* c = message; *c != '\0'; ++c) {
+    if (*c == '\033' && *(c + 1) == '[') { // log magic always starts with "\033[" see log.h
+      within_magic = true;
+      ++c;
+    } else if (within_magic) {
+      within_magic = (*c != 'm');
+    } else {
+      function(*c);
+    }
+  }
+}
+
+bool LogRingBuffer::push_line(const char* message) {
+  if (appending.test_and_set(std::memory_order_acquire)) {
+    // another task is appending right now, we do not wait for it
+    dropped_lines.fetch_add(1);
+    return false;
+  }
+
+  uint32_t length = 0;
+  for_each_visible_character(message, [&length](char) { ++length; });
+
+  const uint32_t write_position = head.load(std::memory_order_relaxed);
+  const uint32_t free_space = CAPACITY - (write_position - tail.load(std::memory_order_acquire));
+  const bool fits = length + 1 <= free_space;
+  if (fits) {
+    uint32_t position = write_position;
+    for_each_visible_character(message, [this, &position](char c) { at(position++) = c; });
+    at(position++) = '\n';
+    head.store(position, std::memory_order_release);
+  } else {
+    dropped_lines.fetch_add(1);
+  }
+
+  appending.clear(std::memory_order_release);
+  return fits;
+}
+
+bool LogRingBuffer::pop_lines(char* destination, size_t max_length, size_t& length) {
+  length = 0;
+  const uint32_t read_position = tail.load(std::memory_order_relaxed);
+  const uint32_t available = head.load(std::memory_order_acquire) - read_position;
+  if (available == 0 || max_length == 0) {
+    return false;
+  }
+
+  // Find the end of the last complete line that fits, i.e. the last newline (which itself may just exceed max_length).
+  const uint32_t scan_length = available < max_length + 1 ? available : max_length + 1;
+  bool ends_with_newline = false;
+  for (uint32_t i = scan_length; i > 0; --i) {
+    if (at(read_position + i - 1) == '\n') {
+      length = i - 1;
+      ends_with_newline = true;
+      break;
+    }
+  }
+  if (!ends_with_newline) {
+    // the first line is longer than max_length, so we split it
+    length = max_length;
+  }
+
+  for (uint32_t i = 0; i < length; ++i) {
+    destination[i] = at(read_position + i);
+  }
+
+  tail.store(read_position + length + (ends_with_newline ? 1 : 0), std::memory_order_release);
+  return true;
+}
+
+} // namespace esp32_ble_controller
+} // namespace esphome
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+/**
+ * Lock-free byte ring buffer for log lines, which are appended by any Free RTOS task and consumed by the main loop.
+ * <para>
+ * Appending never blocks and never allocates: the logger magic (ANSI escape sequences for colors etc.) is stripped while the line is copied into the buffer.
+ * If the buffer is full (or another task is appending concurrently), the line is dropped and counted instead.
+ * @brief Buffers log lines for sending them in batches over BLE
+ */
+class LogRingBuffer {
+public:
+  /// capacity in bytes, must be a power of two
+  static const uint32_t CAPACITY = 1024;
+
+  /**
+   * Appends the given log message as a line, stripping the logger magic. (Can be called from any RTOS task.)
+   * @return true if successful, false if the line has been dropped
+   */
+  bool push_line(const char* message);
+
+  /**
+   * Moves as many complete lines as fit into the given buffer, separated by newlines (without trailing newline).
+   * A single line that is longer than the given buffer is split into several chunks.
+   * @param length set to the number of bytes written to the given buffer (0 for an empty line)
+   * @return false if no line is available
+   */
+  bool pop_lines(char* destination, size_t max_length, size_t& length);
+
+  /// Returns the number of lines dropped since the last call and resets the counter.
+  uint32_t take_dropped_lines() { return dropped_lines.exchange(0); }
+
+private:
+  char& at(uint32_t position) { return buffer[position & (CAPACITY - 1)]; }
+
+  char buffer[CAPACITY];
+
+  std::atomic<uint32_t> head{0}; // next position to write to (only advanced by the appending task)
+  std::atomic<uint32_t> tail{0}; // next position to read from (only advanced by the consuming task)
+  std::atomic_flag appending = ATOMIC_FLAG_INIT;
+  std::atomic<uint32_t> dropped_lines{0};
+};
+
+} // namespace esp32_ble_controller
+} // namespace esphome
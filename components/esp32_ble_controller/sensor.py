@@ -0,0 +1,58 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import sensor
+from esphome.const import (
+    DEVICE_CLASS_SIGNAL_STRENGTH,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
+    UNIT_DECIBEL_MILLIWATT,
+    UNIT_MILLISECOND,
+    UNIT_PERCENT,
+)
+from . import ESP32BLEController
+
+DEPENDENCIES = ['esp32_ble_controller']
+
+### Configuration validation ############################################################################################
+
+CONF_BLE_CONTROLLER_ID = "esp32_ble_controller_id"
+CONF_RSSI = "rssi"
+CONF_MTU = "mtu"
+CONF_CONNECTION_INTERVAL = "connection_interval"
+CONF_SLAVE_LATENCY = "slave_latency"
+CONF_CONGESTION_EVENTS = "congestion_events"
+CONF_NOTIFICATION_SUCCESS = "notification_success"
+
+# link quality sensors with the setters of the BLE controller
+LINK_QUALITY_SENSORS = {
+    CONF_RSSI: "set_rssi_sensor",
+    CONF_MTU: "set_mtu_sensor",
+    CONF_CONNECTION_INTERVAL: "set_connection_interval_sensor",
+    CONF_SLAVE_LATENCY: "set_slave_latency_sensor",
+    CONF_CONGESTION_EVENTS: "set_congestion_events_sensor",
+    CONF_NOTIFICATION_SUCCESS: "set_notification_success_sensor",
+}
+
+CONFIG_SCHEMA = cv.Schema({
+    cv.GenerateID(CONF_BLE_CONTROLLER_ID): cv.use_id(ESP32BLEController),
+    cv.Optional(CONF_RSSI): sensor.sensor_schema(unit_of_measurement=UNIT_DECIBEL_MILLIWATT, accuracy_decimals=0, device_class=DEVICE_CLASS_SIGNAL_STRENGTH,
+                                                 state_class=STATE_CLASS_MEASUREMENT, entity_category=ENTITY_CATEGORY_DIAGNOSTIC),
+    cv.Optional(CONF_MTU): sensor.sensor_schema(accuracy_decimals=0, state_class=STATE_CLASS_MEASUREMENT, entity_category=ENTITY_CATEGORY_DIAGNOSTIC),
+    cv.Optional(CONF_CONNECTION_INTERVAL): sensor.sensor_schema(unit_of_measurement=UNIT_MILLISECOND, accuracy_decimals=2, state_class=STATE_CLASS_MEASUREMENT,
+                                                                entity_category=ENTITY_CATEGORY_DIAGNOSTIC),
+    cv.Optional(CONF_SLAVE_LATENCY): sensor.sensor_schema(accuracy_decimals=0, state_class=STATE_CLASS_MEASUREMENT, entity_category=ENTITY_CATEGORY_DIAGNOSTIC),
+    cv.Optional(CONF_CONGESTION_EVENTS): sensor.sensor_schema(accuracy_decimals=0, state_class=STATE_CLASS_TOTAL_INCREASING, entity_category=ENTITY_CATEGORY_DIAGNOSTIC),
+    cv.Optional(CONF_NOTIFICATION_SUCCESS): sensor.sensor_schema(unit_of_measurement=UNIT_PERCENT, accuracy_decimals=1, state_class=STATE_CLASS_MEASUREMENT,
+                                                                 entity_category=ENTITY_CATEGORY_DIAGNOSTIC),
+})
+
+### Code generation ############################################################################################
+
+def to_code(config):
+    """Generates the C++ code for the link quality sensors of the BLE controller"""
+    ble_controller_var = yield cg.get_variable(config[CONF_BLE_CONTROLLER_ID])
+    for key, setter in LINK_QUALITY_SENSORS.items():
+        if key in config:
+            sensor_var = yield sensor.new_sensor(config[key])
+            cg.add(getattr(ble_controller_var, setter)(sensor_var))
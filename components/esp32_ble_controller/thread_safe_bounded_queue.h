@@ -1,5 +1,11 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
 
@@ -8,58 +14,125 @@ namespace esp32_ble_controller {
 
 /**
  * Thread-safe non-blocking bounded queue to pass values between Free RTOS tasks.
+ * <para>
+ * The queued objects are stored inline in a fixed ring of slots, so pushing and taking objects never allocates memory on the heap.
+ * Two statically allocated Free RTOS queues pass the indices of free and filled slots between the tasks.
+ * Pushing never blocks the calling task: if the queue is full, the pushed object is rejected (and counted).
+ * Taking may block (e.g. in a worker task) until an object has been pushed.
  */
-template <typename T>
+template <typename T, unsigned int CAPACITY>
 class ThreadSafeBoundedQueue {
+  static_assert(CAPACITY > 0 && CAPACITY <= UINT8_MAX, "Capacity must fit into a slot index");
+
 public:
-  /// Creates a bounded queue with the given size (i.e. maximum number of objects that can be queued).
-  ThreadSafeBoundedQueue(unsigned int size);
+  /// Creates a bounded queue for at most CAPACITY objects.
+  ThreadSafeBoundedQueue();
+  ~ThreadSafeBoundedQueue();
+
+  ThreadSafeBoundedQueue(const ThreadSafeBoundedQueue&) = delete;
+  ThreadSafeBoundedQueue& operator=(const ThreadSafeBoundedQueue&) = delete;
 
   /**
    * Pushes the given object into the queue, the queue takes over ownership.
    * @param object object to append to the queue (treated as r-value)
-   * @return true if successful, false if queue is full
+   * @return true if successful, false if queue is full (and the object has been rejected)
    */
   bool push(T&& object);
 
   /**
    * Takes the first queued element from the queue (if any) and moves it to the given object.
    * @param object object to store the dequeued value
+   * @param ticks_to_wait maximum time to wait for an element if the queue is empty (0 = do not block)
    * @return true if successful, false if queue was empty
    */
-  bool take(T& object);
+  bool take(T& object, TickType_t ticks_to_wait = 0);
+
+  /// Returns the number of objects that can be pushed before the queue is full.
+  uint32_t get_free_capacity() const { return uxQueueMessagesWaiting(free_slots); }
+
+  /// Returns the maximum number of objects that have been queued at the same time.
+  uint32_t get_high_water_mark() const { return high_water_mark.load(); }
+  /// Returns the number of objects that could not be pushed because the queue was full.
+  uint32_t get_push_failures() const { return push_failures.load(); }
+  void reset_statistics();
 
 private:
-  QueueHandle_t queue;
+  using Slot = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+  T* slot_at(uint8_t index) { return reinterpret_cast<T*>(&slots[index]); }
+
+  Slot slots[CAPACITY];
+
+  QueueHandle_t free_slots;
+  StaticQueue_t free_slots_control;
+  uint8_t free_slots_storage[CAPACITY];
+
+  QueueHandle_t filled_slots;
+  StaticQueue_t filled_slots_control;
+  uint8_t filled_slots_storage[CAPACITY];
+
+  std::atomic<uint32_t> high_water_mark{0};
+  std::atomic<uint32_t> push_failures{0};
 };
 
-template <typename T>
-ThreadSafeBoundedQueue<T>::ThreadSafeBoundedQueue(unsigned int size) {
-  queue = xQueueCreate( size, sizeof( void* ) );
+template <typename T, unsigned int CAPACITY>
+ThreadSafeBoundedQueue<T, CAPACITY>::ThreadSafeBoundedQueue() {
+  free_slots = xQueueCreateStatic(CAPACITY, sizeof(uint8_t), free_slots_storage, &free_slots_control);
+  filled_slots = xQueueCreateStatic(CAPACITY, sizeof(uint8_t), filled_slots_storage, &filled_slots_control);
+
+  for (unsigned int i = 0; i < CAPACITY; ++i) {
+    uint8_t index = i;
+    xQueueSend(free_slots, &index, 0);
+  }
 }
 
-template <typename T>
-bool ThreadSafeBoundedQueue<T>::push(T&& object) {
-  T* pointer_to_copy = new T();
-  *pointer_to_copy = std::move(object);
+template <typename T, unsigned int CAPACITY>
+ThreadSafeBoundedQueue<T, CAPACITY>::~ThreadSafeBoundedQueue() {
+  uint8_t index;
+  while (xQueueReceive(filled_slots, &index, 0) == pdPASS) {
+    slot_at(index)->~T();
+  }
+}
+
+template <typename T, unsigned int CAPACITY>
+bool ThreadSafeBoundedQueue<T, CAPACITY>::push(T&& object) {
+  uint8_t index;
+  if (xQueueReceive(free_slots, &index, 0) != pdPASS) {
+    push_failures.fetch_add(1);
+    return false;
+  }
+
+  const uint32_t used_slots = CAPACITY - uxQueueMessagesWaiting(free_slots);
+  uint32_t previous_high_water_mark = high_water_mark.load();
+  while (used_slots > previous_high_water_mark && !high_water_mark.compare_exchange_weak(previous_high_water_mark, used_slots)) {}
 
-  // add the pointer to the queue, not the object itself
-  auto result = xQueueSend(queue, &pointer_to_copy, 20L / portTICK_PERIOD_MS);
-  return result == pdPASS;
+  new (slot_at(index)) T(std::move(object));
+
+  // publish the index of the filled slot, there is always room for it because both queues have the same capacity
+  xQueueSend(filled_slots, &index, 0);
+  return true;
 }
 
-template <typename T>
-bool ThreadSafeBoundedQueue<T>::take(T& object) {
-  T* pointer_to_object; 
-  auto result = xQueueReceive(queue, &pointer_to_object, 0);
-  if (result != pdPASS) {
+template <typename T, unsigned int CAPACITY>
+bool ThreadSafeBoundedQueue<T, CAPACITY>::take(T& object, TickType_t ticks_to_wait) {
+  uint8_t index;
+  if (xQueueReceive(filled_slots, &index, ticks_to_wait) != pdPASS) {
     return false;
   }
 
-  object = std::move(*pointer_to_object);
-  delete pointer_to_object;
+  T* queued_object = slot_at(index);
+  object = std::move(*queued_object);
+  queued_object->~T();
+
+  xQueueSend(free_slots, &index, 0);
   return true;
 }
 
+template <typename T, unsigned int CAPACITY>
+void ThreadSafeBoundedQueue<T, CAPACITY>::reset_statistics() {
+  high_water_mark.store(0);
+  push_failures.store(0);
+}
+
 } // namespace esp32_ble_controller
 } // namespace esphome
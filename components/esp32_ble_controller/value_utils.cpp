@@ -0,0 +1,58 @@
+#include "value_utils.h"
+
+#include <cmath>
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+int32_t to_fixed_point(float value, int8_t exponent, int32_t min_value, int32_t max_value) {
+  if (std::isnan(value)) {
+    return min_value;
+  }
+
+  const float scaled_value = std::round(value * std::pow(10.0f, -exponent));
+  if (scaled_value <= min_value) {
+    return min_value + 1;
+  }
+  if (scaled_value >= max_value) {
+    return max_value;
+  }
+  return static_cast<int32_t>(scaled_value);
+}
+
+vector<string> split(const string& text, char delimiter) {
+  vector<string> result;
+  int j = 0;
+  for (int i = 0; i < text.length(); i ++) {
+    if (text[i] == delimiter) {
+      string token = text.substr(j, i - j);
+      if (token.length()) {
+        result.push_back(token);
+      }
+      j = i + 1;
+    }
+  }
+  if (j < text.length()) {
+    result.push_back(text.substr(j));
+  }
+  return result;
+}
+
+size_t tokenize(string_view text, string_view* tokens, size_t max_tokens, string_view delimiters) {
+  size_t count = 0;
+  size_t start = 0;
+  while (count < max_tokens && start < text.length()) {
+    size_t end = text.find_first_of(delimiters, start);
+    if (end == string_view::npos) {
+      end = text.length();
+    }
+    if (end > start) {
+      tokens[count++] = text.substr(start, end - start);
+    }
+    start = end + 1;
+  }
+  return count;
+}
+
+} // namespace esp32_ble_controller
+} // namespace esphome
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+/**
+ * Converts the given value to a fixed-point integer, i.e. value / 10^exponent rounded and clamped to ]min_value, max_value].
+ * NaN is mapped to min_value, which serves as "unknown" marker.
+ */
+int32_t to_fixed_point(float value, int8_t exponent, int32_t min_value, int32_t max_value);
+
+vector<string> split(const string& text, char delimiter = ' ');
+
+/**
+ * Splits the given text at any of the given delimiters into at most max_tokens non-empty tokens, which are views into the text (i.e. nothing is copied or allocated).
+ * @return the number of tokens, further tokens beyond max_tokens are ignored
+ */
+size_t tokenize(string_view text, string_view* tokens, size_t max_tokens, string_view delimiters = " ");
+
+} // namespace esp32_ble_controller
+} // namespace esphome
@@ -2,15 +2,51 @@
 
 #ifdef USE_WIFI
 
+#include <algorithm>
+
+#include <WiFi.h>
+
 #include "esphome/core/application.h"
 #include "esphome/core/log.h"
 #include "esphome/components/wifi/wifi_component.h"
 
+#include "esp32_ble_controller.h"
+
 namespace esphome {
 namespace esp32_ble_controller {
 
 static const char *TAG = "wifi_configuration_handler";
 
+static void fill_configuration(WifiConfiguration& configuration, const std::string &ssid, const std::string &password, bool hidden_network) {
+  strncpy(configuration.ssid, ssid.c_str(), WIFI_SSID_LEN);
+  strncpy(configuration.password, password.c_str(), WIFI_PASSWORD_LEN);
+  configuration.hidden_network = hidden_network;
+}
+
+/// Appends the given network as a line to the given result, the SSID comes last because it may contain spaces.
+static void append_network(std::string& result, const WifiScannedNetwork& network) {
+  char line[32];
+  snprintf(line, sizeof(line), "\n%d dBm ch %u %s ", network.rssi, network.channel, network.with_auth ? "secured" : "open");
+  result += line;
+  result += network.ssid;
+}
+
+/// Returns the network with the given SSID, nullptr if there is none.
+static WifiScannedNetwork* find_network(std::vector<WifiScannedNetwork>& networks, const std::string& ssid) {
+  auto network = std::find_if(networks.begin(), networks.end(), [&ssid](const WifiScannedNetwork& network) { return network.ssid == ssid; });
+  return network != networks.end() ? &*network : nullptr;
+}
+
+static wifi::WiFiAP to_sta(const WifiConfiguration& configuration) {
+  wifi::WiFiAP sta;
+
+  sta.set_ssid(configuration.ssid);
+  sta.set_password(configuration.password);
+  sta.set_hidden(configuration.hidden_network);
+
+  return sta;
+}
+
 void WifiConfigurationHandler::setup() {
   // Hash with compilation time
   // This ensures the AP override is not applied for OTA
@@ -28,10 +64,7 @@ void WifiConfigurationHandler::set_credentials(const std::string &ssid, const st
   ESP_LOGI(TAG, "Updating WIFI configuration");
 
   WifiConfiguration configuration;
-
-  strncpy(configuration.ssid, ssid.c_str(), WIFI_SSID_LEN);
-  strncpy(configuration.password, password.c_str(), WIFI_PASSWORD_LEN);
-  configuration.hidden_network = hidden_network;
+  fill_configuration(configuration, ssid, password, hidden_network);
 
   if (!save_configuration(configuration)) {
     ESP_LOGE(TAG, "Could not save new WIFI configuration");
@@ -68,14 +101,158 @@ bool WifiConfigurationHandler::save_configuration(const WifiConfiguration& confi
   return wifi_configuration_preference.save(&configuration);
 }
 
+/**
+ * Replaces the networks of the WIFI component with the given one. set_sta() only changes the list the component uses the next time it (re)connects; unlike 
+ * save_wifi_sta() it does not start connecting, so after a successful credentials test the established connection is kept instead of being reconnected.
+ */
 void WifiConfigurationHandler::override_sta(const WifiConfiguration& configuration) {
-  wifi::WiFiAP sta;
+  wifi::global_wifi_component->set_sta(to_sta(configuration));
+}
 
-  sta.set_ssid(configuration.ssid);
-  sta.set_password(configuration.password);
-  sta.set_hidden(configuration.hidden_network);
+void WifiConfigurationHandler::loop() {
+  if (is_scanning()) {
+    update_scan();
+  }
+  if (testing_credentials) {
+    update_credentials_test();
+  }
+}
+
+// credentials test ///////////////////////////////////////////////////////////////////////////////////////////////
+
+void WifiConfigurationHandler::test_credentials(const std::string &ssid, const std::string &password, bool hidden_network) {
+  ESP_LOGI(TAG, "Testing WIFI configuration for network %s", ssid.c_str());
+
+  fill_configuration(tested_configuration, ssid, password, hidden_network);
+  testing_credentials = true;
+  credentials_test_start_millis = millis();
+
+  // Connecting directly leaves the configured networks untouched, so the WIFI component retries those if this connection fails.
+  wifi::global_wifi_component->start_connecting(to_sta(tested_configuration), false);
+}
+
+void WifiConfigurationHandler::update_credentials_test() {
+  const bool connected = wifi::global_wifi_component->is_connected() && wifi::global_wifi_component->wifi_ssid() == tested_configuration.ssid;
+  if (connected) {
+    testing_credentials = false;
+    ESP_LOGI(TAG, "Connected to network %s, saving WIFI configuration", tested_configuration.ssid);
+    if (!save_configuration(tested_configuration)) {
+      ESP_LOGE(TAG, "Could not save new WIFI configuration");
+      global_ble_controller->send_command_result("WIFI test succeeded for network %s, but the configuration could not be saved.", tested_configuration.ssid);
+      return;
+    }
+    override_sta(tested_configuration);
+    global_ble_controller->send_command_result("WIFI test succeeded, configuration saved for network %s.", tested_configuration.ssid);
+  } else if (millis() - credentials_test_start_millis >= CREDENTIALS_TEST_TIMEOUT_MILLIS) {
+    testing_credentials = false;
+    ESP_LOGW(TAG, "Could not connect to network %s, WIFI configuration unchanged", tested_configuration.ssid);
+    global_ble_controller->send_command_result("WIFI test failed for network %s, configuration unchanged.", tested_configuration.ssid);
+  }
+}
+
+// scan ///////////////////////////////////////////////////////////////////////////////////////////////
+
+void WifiConfigurationHandler::start_scan() {
+  ESP_LOGI(TAG, "Scanning WIFI channels");
+  scanned_networks.clear();
+  scanned_channel = 1;
+  channel_scan_started = false;
+  channel_scan_start_millis = millis();
+}
+
+void WifiConfigurationHandler::scan_next_channel() {
+  channel_scan_started = false;
+  channel_scan_start_millis = millis();
+  if (scanned_channel < MAX_WIFI_CHANNEL) {
+    ++scanned_channel;
+    return;
+  }
+
+  // done: send all networks sorted by RSSI (strongest first)
+  scanned_channel = 0;
+  std::string result = "WIFI scan done, " + to_string(scanned_networks.size()) + " networks found.";
+  for (const auto& network : scanned_networks) {
+    append_network(result, network);
+  }
+  global_ble_controller->send_command_result(result);
+  scanned_networks.clear();
+  scanned_networks.shrink_to_fit();
+}
+
+/**
+ * Returns true if a channel scan does not get in the way of the WIFI component.
+ * The scans run behind the back of the WIFI component: it takes over the results of every scan from the WIFI library (its event handler cannot tell our scans 
+ * from its own), but only evaluates them while it is scanning for its networks itself. So our scans only run while it is connected (it ignores scan results 
+ * then) or has no networks to connect to, never while it is scanning or connecting (or while the credentials test connects).
+ */
+bool WifiConfigurationHandler::can_scan_channel() const {
+  if (testing_credentials) {
+    return false;
+  }
+  return wifi::global_wifi_component->is_connected() || !wifi::global_wifi_component->has_sta();
+}
+
+/**
+ * The channels are scanned one by one (without blocking), so that the networks of each channel can be sent right away.
+ * The scan results end up in the WIFI component, which takes them over from the WIFI library once a scan is done (see can_scan_channel()).
+ */
+void WifiConfigurationHandler::update_scan() {
+  const bool timed_out = millis() - channel_scan_start_millis >= CHANNEL_SCAN_TIMEOUT_MILLIS;
+  if (!channel_scan_started) {
+    // While the WIFI component is busy, the scan does not start; we retry in the next loop pass.
+    channel_scan_started = can_scan_channel() && WiFi.scanNetworks(true, false, false, SCAN_MILLIS_PER_CHANNEL, scanned_channel) == WIFI_SCAN_RUNNING;
+    if (!channel_scan_started && timed_out) {
+      ESP_LOGD(TAG, "Skipping WIFI channel %u", scanned_channel);
+      scan_next_channel();
+    }
+    return;
+  }
+
+  // the scan is running or its results have not been taken over by the WIFI component yet
+  if (WiFi.scanComplete() != WIFI_SCAN_FAILED) {
+    if (timed_out) {
+      scan_next_channel();
+    }
+    return;
+  }
+
+  on_channel_scanned();
+  scan_next_channel();
+}
+
+void WifiConfigurationHandler::on_channel_scanned() {
+  std::vector<WifiScannedNetwork> found_networks;
+  for (const auto& scan_result : wifi::global_wifi_component->get_scan_result()) {
+    if (scan_result.get_is_hidden() || scan_result.get_ssid().empty()) {
+      continue;
+    }
+    WifiScannedNetwork* known_network = find_network(scanned_networks, scan_result.get_ssid());
+    if (known_network == nullptr) {
+      known_network = find_network(found_networks, scan_result.get_ssid());
+    }
+    if (known_network != nullptr) {
+      // another access point of a known network (or the same one again), only the strongest one is kept
+      if (scan_result.get_rssi() > known_network->rssi) {
+        known_network->rssi = scan_result.get_rssi();
+        known_network->channel = scan_result.get_channel();
+      }
+      continue;
+    }
+    found_networks.push_back(WifiScannedNetwork{ scan_result.get_ssid(), scan_result.get_rssi(), scan_result.get_channel(), scan_result.get_with_auth() });
+  }
+
+  auto by_rssi = [](const WifiScannedNetwork& network1, const WifiScannedNetwork& network2) { return network1.rssi > network2.rssi; };
+  std::sort(found_networks.begin(), found_networks.end(), by_rssi);
+  if (!found_networks.empty()) {
+    std::string result = "WIFI channel " + to_string(scanned_channel) + ":";
+    for (const auto& network : found_networks) {
+      append_network(result, network);
+    }
+    global_ble_controller->send_command_result(result);
+  }
 
-  wifi::global_wifi_component->set_sta(sta);
+  scanned_networks.insert(scanned_networks.end(), found_networks.begin(), found_networks.end());
+  std::sort(scanned_networks.begin(), scanned_networks.end(), by_rssi);
 }
 
 } // namespace esp32_ble_controller
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "esphome/core/defines.h"
 #include "esphome/core/preferences.h"
@@ -20,13 +21,33 @@ struct WifiConfiguration {
   bool hidden_network;
 } PACKED;  // NOLINT
 
+/// Access point found by a scan.
+struct WifiScannedNetwork {
+  std::string ssid;
+  int8_t rssi;
+  uint8_t channel;
+  bool with_auth;
+};
+
 class WifiConfigurationHandler {
 public:
   void setup();
+  void loop();
 
   void set_credentials(const std::string& ssid, const std::string& password, bool hidden_network);
   void clear_credentials();
 
+  /**
+   * Tries the given credentials right away without saving them. They are saved (and used from then on) only once the device has connected to the network;
+   * otherwise the WIFI component falls back to the networks configured before. The outcome is sent as command result (see loop()).
+   */
+  void test_credentials(const std::string& ssid, const std::string& password, bool hidden_network);
+  bool is_testing_credentials() const { return testing_credentials; }
+
+  /// Scans one channel after the other, the access points found on each channel are sent as command result right away and finally all of them sorted by RSSI (see loop()).
+  void start_scan();
+  bool is_scanning() const { return scanned_channel != 0; }
+
   const optional<std::string> get_current_ssid() const;
 
 private:
@@ -34,8 +55,28 @@ private:
   bool save_configuration(const WifiConfiguration& configuration);
   void override_sta(const WifiConfiguration& configuration);
 
+  bool can_scan_channel() const;
+  void update_scan();
+  void on_channel_scanned();
+  void scan_next_channel();
+  void update_credentials_test();
+
 private:
   ESPPreferenceObject wifi_configuration_preference;
+
+  static const uint8_t MAX_WIFI_CHANNEL = 13;
+  static const uint32_t SCAN_MILLIS_PER_CHANNEL = 120;
+  /// time after which a channel is skipped, e.g. if the WIFI component is busy with scanning or connecting itself
+  static const uint32_t CHANNEL_SCAN_TIMEOUT_MILLIS = 2000;
+  uint8_t scanned_channel{0}; // channel that is being scanned, 0 = not scanning
+  bool channel_scan_started{false};
+  uint32_t channel_scan_start_millis{0};
+  std::vector<WifiScannedNetwork> scanned_networks; // the strongest access point of each network found so far
+
+  static const uint32_t CREDENTIALS_TEST_TIMEOUT_MILLIS = 30000;
+  bool testing_credentials{false};
+  WifiConfiguration tested_configuration;
+  uint32_t credentials_test_start_millis{0};
 };
 
 } // namespace esp32_ble_controller
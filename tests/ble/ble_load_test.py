@@ -0,0 +1,347 @@
+#!/usr/bin/env python3
+"""Client-side load and latency test for a device running ble_load_test.yaml (see "Measuring performance" in the README).
+
+Puts a fixed load on the device for a given time:
+- hammers the command channel with "help", "version" and the custom "echo" command,
+- toggles the switch and the fan by characteristic writes,
+- subscribes to the high-rate sensors and the log characteristic.
+
+Then fetches the "stats" report of the device and writes a JSON result with the same keys for every run:
+client-side round trips (command, write to state notification), notifications per second, dropped updates (gaps in the
+counter sensor and the log ticks, lost commands and writes), and the device-side latencies from the report (state change
+to notification and write to executed change). With --baseline the numbers are compared with the result of an earlier run.
+
+Requires bleak (pip install bleak).
+"""
+
+import argparse
+import asyncio
+import json
+import math
+import re
+import struct
+import sys
+import time
+
+from bleak import BleakClient, BleakScanner
+
+### UUIDs (see ble_load_test.yaml and ble_maintenance_handler.cpp) ############################################################################################
+
+UUID_COMMAND = "1d3c6498-cfdf-44a1-9038-3e757dcc449d"
+UUID_LOGGING = "a1083f3b-0ad6-49e0-8a9d-56eb5bf462ca"
+UUID_SWITCH = "8a1f0002-6c4e-4b5d-9f3a-2e7b5c1d0a00"
+UUID_FAN = "8a1f0003-6c4e-4b5d-9f3a-2e7b5c1d0a00"
+UUID_COUNTER = "8a1f0004-6c4e-4b5d-9f3a-2e7b5c1d0a00"
+UUID_SINE = "8a1f0005-6c4e-4b5d-9f3a-2e7b5c1d0a00"
+
+CHUNK_FLAG_LAST = 0x01
+LOG_LEVEL_DEBUG = 5
+
+RESULT_TIMEOUT = 5.0 # seconds to wait for a command result or a state notification before counting it as lost
+SCHEMA_VERSION = 1
+
+### Measurements ############################################################################################
+
+def percentile(values, p):
+    """Returns the p-th percentile (nearest rank) of the given values, None if there are none."""
+    if not values:
+        return None
+    ordered = sorted(values)
+    rank = max(1, math.ceil(p / 100 * len(ordered)))
+    return ordered[rank - 1]
+
+def summarize(latencies, lost):
+    """Summarizes round trips in seconds as count, p50, p99, max (in milliseconds) and lost operations."""
+    to_ms = lambda value: None if value is None else round(value * 1000, 2)
+    return {
+        "count": len(latencies),
+        "p50_ms": to_ms(percentile(latencies, 50)),
+        "p99_ms": to_ms(percentile(latencies, 99)),
+        "max_ms": to_ms(max(latencies) if latencies else None),
+        "lost": lost,
+    }
+
+class Notifications:
+    """Counts the notifications of a characteristic."""
+    def __init__(self):
+        self.count = 0
+
+    def on_notification(self, _, data):
+        self.count += 1
+
+    def rate(self, duration):
+        return round(self.count / duration, 2)
+
+class CounterSensor(Notifications):
+    """The counter sensor increments its value with each update, so gaps between notified values are dropped updates."""
+    def __init__(self):
+        super().__init__()
+        self.last_value = None
+        self.dropped = 0
+
+    def on_notification(self, _, data):
+        self.count += 1
+        value = int(struct.unpack("<f", bytes(data[:4]))[0])
+        if self.last_value is not None and value > self.last_value + 1:
+            self.dropped += value - self.last_value - 1
+        self.last_value = value
+
+class LogLines(Notifications):
+    """Counts the log lines, the lines reported as dropped by the device and the gaps between the ticks of the load interval."""
+    TICK = re.compile(r"\[load[^\]]*\]: tick (\d+)")
+    DROPPED = re.compile(r"^\[(\d+) log lines dropped\]$")
+
+    def __init__(self):
+        super().__init__()
+        self.lines = 0
+        self.dropped_lines = 0
+        self.missing_ticks = 0
+        self.last_tick = None
+
+    def on_notification(self, _, data):
+        self.count += 1
+        for line in bytes(data).decode("utf-8", "replace").split("\n"):
+            self.lines += 1
+            dropped = self.DROPPED.match(line)
+            if dropped:
+                self.dropped_lines += int(dropped.group(1))
+                continue
+            tick = self.TICK.search(line)
+            if tick:
+                value = int(tick.group(1))
+                if self.last_tick is not None and value > self.last_tick + 1:
+                    self.missing_ticks += value - self.last_tick - 1
+                self.last_tick = value
+
+class StateWaiter(Notifications):
+    """Measures the time from a write to the notification of the written state."""
+    def __init__(self, matches):
+        super().__init__()
+        self.matches = matches
+        self.expected = None
+        self.future = None
+
+    def on_notification(self, _, data):
+        self.count += 1
+        if self.future is not None and not self.future.done() and self.matches(bytes(data), self.expected):
+            self.future.set_result(time.perf_counter())
+
+    async def write_and_wait(self, client, uuid, value, expected):
+        self.expected = expected
+        self.future = asyncio.get_running_loop().create_future()
+        start = time.perf_counter()
+        await client.write_gatt_char(uuid, value, response=True)
+        try:
+            return await asyncio.wait_for(self.future, RESULT_TIMEOUT) - start
+        except asyncio.TimeoutError:
+            return None
+
+class CommandChannel(Notifications):
+    """Sends tagged commands and reassembles the chunked results (requires chunked_command_results)."""
+    def __init__(self):
+        super().__init__()
+        self.pending = {}
+        self.buffer = b""
+        self.next_tag = 1
+
+    def on_notification(self, _, data):
+        self.count += 1
+        data = bytes(data)
+        if len(data) < 2:
+            return
+        self.buffer += data[2:]
+        if data[1] & CHUNK_FLAG_LAST:
+            result = self.buffer.decode("utf-8", "replace")
+            self.buffer = b""
+            tag, _, text = result.partition(" ")
+            future = self.pending.pop(tag, None)
+            if future is not None and not future.done():
+                future.set_result((time.perf_counter(), text))
+
+    async def execute(self, client, command):
+        """Returns the round trip in seconds and the result, (None, None) if the result did not arrive in time."""
+        tag = "#%d" % self.next_tag
+        self.next_tag += 1
+        future = asyncio.get_running_loop().create_future()
+        self.pending[tag] = future
+        start = time.perf_counter()
+        await client.write_gatt_char(UUID_COMMAND, ("%s %s" % (tag, command)).encode(), response=True)
+        try:
+            end, result = await asyncio.wait_for(future, RESULT_TIMEOUT)
+            return end - start, result
+        except asyncio.TimeoutError:
+            self.pending.pop(tag, None)
+            return None, None
+
+### Load ############################################################################################
+
+async def hammer_commands(client, channel, deadline, latencies, lost):
+    commands = ["help", "version", "echo load"]
+    n = 0
+    while time.perf_counter() < deadline:
+        round_trip, _ = await channel.execute(client, commands[n % len(commands)])
+        n += 1
+        if round_trip is None:
+            lost[0] += 1
+        else:
+            latencies.append(round_trip)
+
+async def toggle(client, uuid, waiter, values, interval, deadline, latencies, lost):
+    n = 0
+    while time.perf_counter() < deadline:
+        value, expected = values[n % len(values)]
+        n += 1
+        round_trip = await waiter.write_and_wait(client, uuid, value, expected)
+        if round_trip is None:
+            lost[0] += 1
+        else:
+            latencies.append(round_trip)
+        await asyncio.sleep(interval)
+
+### Device statistics ############################################################################################
+
+QUEUE_STATS = re.compile(r"(events|subscriptions|commands|writes) max (\d+)/(\d+)(?:, (\d+) coalesced)?, (\d+) rejected")
+LINK_STATS = re.compile(r"^links: (\d+) notif, (\d+) failed, (\d+) congested; notify intervals x(\d+), (\d+) widenings")
+HANDLER_STATS = re.compile(r"^(\S+): (\d+) notif, (\d+) B, (\d+) coalesced, (\d+) suppressed, "
+                           r"notify avg (\d+)us p50 (\d+)us p99 (\d+)us max (\d+)us, write avg (\d+)us p50 (\d+)us p99 (\d+)us max (\d+)us")
+
+def parse_statistics_report(report):
+    """Extracts the numbers from the report of the "stats" command (see ESP32BLEController::get_statistics_report())."""
+    statistics = {"queues": {}, "links": {}, "handlers": {}}
+    for line in report.split("\n"):
+        if line.startswith("queues:"):
+            for name, high_water_mark, capacity, coalesced, rejected in QUEUE_STATS.findall(line):
+                queue = {"max": int(high_water_mark), "capacity": int(capacity), "rejected": int(rejected)}
+                if coalesced:
+                    queue["coalesced"] = int(coalesced)
+                statistics["queues"][name] = queue
+            continue
+        links = LINK_STATS.match(line)
+        if links:
+            keys = ["notifications", "failed_notifications", "congestion_events", "notify_interval_factor", "widenings"]
+            statistics["links"] = dict(zip(keys, map(int, links.groups())))
+            continue
+        handler = HANDLER_STATS.match(line)
+        if handler:
+            keys = ["notifications", "notified_bytes", "coalesced", "suppressed", "notify_avg_us", "notify_p50_us", "notify_p99_us",
+                    "notify_max_us", "write_avg_us", "write_p50_us", "write_p99_us", "write_max_us"]
+            statistics["handlers"][handler.group(1)] = dict(zip(keys, map(int, handler.groups()[1:])))
+    return statistics
+
+### Comparison ############################################################################################
+
+def flatten(value, prefix=""):
+    if isinstance(value, dict):
+        for key, item in value.items():
+            yield from flatten(item, prefix + "." + key if prefix else key)
+    elif isinstance(value, (int, float)) and not isinstance(value, bool):
+        yield prefix, value
+
+def compare(baseline, result):
+    """Prints the numbers that differ from the baseline, one line each (to stderr, the result may go to stdout)."""
+    base = dict(flatten({"client": baseline.get("client", {}), "device": baseline.get("device", {})}))
+    for key, value in flatten({"client": result["client"], "device": result["device"]}):
+        if key in base and base[key] != value:
+            change = "" if base[key] == 0 else " (%+.1f%%)" % (100.0 * (value - base[key]) / base[key])
+            print("%-60s %12s -> %12s%s" % (key, base[key], value, change), file=sys.stderr)
+
+### Main ############################################################################################
+
+async def find_address(name):
+    device = await BleakScanner.find_device_by_name(name, timeout=20)
+    if device is None:
+        raise SystemExit("Device '%s' not found" % name)
+    return device.address
+
+async def run(args):
+    address = args.address or await find_address(args.name)
+    async with BleakClient(address) as client:
+        channel = CommandChannel()
+        switch = StateWaiter(lambda data, expected: len(data) >= 1 and data[0] == expected)
+        fan = StateWaiter(lambda data, expected: data.decode("utf-8", "replace").startswith(expected))
+        counter = CounterSensor()
+        sine = Notifications()
+        log = LogLines()
+
+        await client.start_notify(UUID_COMMAND, channel.on_notification)
+        _, version = await channel.execute(client, "version")
+        await channel.execute(client, "log-level %d" % LOG_LEVEL_DEBUG)
+        if not args.no_reset:
+            await channel.execute(client, "stats reset")
+
+        # start from a known state, so that every write of the load changes the state (and is notified)
+        await client.write_gatt_char(UUID_SWITCH, b"\x00", response=True)
+        await client.write_gatt_char(UUID_FAN, b"off", response=True)
+        await asyncio.sleep(1)
+
+        for uuid, handler in [(UUID_SWITCH, switch), (UUID_FAN, fan), (UUID_COUNTER, counter), (UUID_SINE, sine), (UUID_LOGGING, log)]:
+            await client.start_notify(uuid, handler.on_notification)
+
+        command_latencies, command_lost = [], [0]
+        switch_latencies, switch_lost = [], [0]
+        fan_latencies, fan_lost = [], [0]
+        start = time.perf_counter()
+        deadline = start + args.duration
+        await asyncio.gather(
+            hammer_commands(client, channel, deadline, command_latencies, command_lost),
+            toggle(client, UUID_SWITCH, switch, [(b"\x01", 1), (b"\x00", 0)], args.interval, deadline, switch_latencies, switch_lost),
+            toggle(client, UUID_FAN, fan, [(b"on 2", "fan=on"), (b"off", "fan=off")], args.interval, deadline, fan_latencies, fan_lost),
+        )
+        duration = time.perf_counter() - start
+
+        for uuid in [UUID_SWITCH, UUID_FAN, UUID_COUNTER, UUID_SINE, UUID_LOGGING]:
+            await client.stop_notify(uuid)
+        _, report = await channel.execute(client, "stats")
+        if report is None:
+            raise SystemExit("The device did not send its statistics")
+
+    notifications = {"commands": channel, "switch": switch, "fan": fan, "counter": counter, "sine": sine, "log": log}
+    return {
+        "schema": SCHEMA_VERSION,
+        "version": version,
+        "duration_s": round(duration, 1),
+        "client": {
+            "command_round_trip": summarize(command_latencies, command_lost[0]),
+            "switch_write_to_state": summarize(switch_latencies, switch_lost[0]),
+            "fan_write_to_state": summarize(fan_latencies, fan_lost[0]),
+            "notifications_per_s": dict({name: item.rate(duration) for name, item in notifications.items()},
+                                        total=round(sum(item.count for item in notifications.values()) / duration, 2)),
+            "dropped_updates": {
+                "counter": counter.dropped,
+                "log_lines": log.dropped_lines,
+                "log_ticks": log.missing_ticks,
+                "commands": command_lost[0],
+                "switch_writes": switch_lost[0],
+                "fan_writes": fan_lost[0],
+            },
+        },
+        "device": parse_statistics_report(report),
+        "report": report,
+    }
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    target = parser.add_mutually_exclusive_group(required=True)
+    target.add_argument("--address", help="BLE address of the device")
+    target.add_argument("--name", help="name of the device (scans for it)")
+    parser.add_argument("--duration", type=float, default=60, help="duration of the load in seconds (default 60)")
+    parser.add_argument("--interval", type=float, default=0.1, help="pause between two switch or fan writes in seconds (default 0.1)")
+    parser.add_argument("--no-reset", action="store_true", help="do not reset the statistics of the device before the run")
+    parser.add_argument("--output", help="file to write the JSON result to (default: stdout)")
+    parser.add_argument("--baseline", help="JSON result of an earlier run to compare with")
+    args = parser.parse_args()
+
+    result = asyncio.run(run(args))
+    text = json.dumps(result, indent=2, sort_keys=True)
+    if args.output:
+        with open(args.output, "w") as file:
+            file.write(text + "\n")
+    else:
+        print(text)
+    if args.baseline:
+        with open(args.baseline) as file:
+            compare(json.load(file), result)
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
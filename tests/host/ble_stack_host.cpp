@@ -0,0 +1,84 @@
+#include "ble_stack_host.h"
+
+#include <algorithm>
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+HostBLEStack host_ble_stack;
+
+static bool started = false;
+
+bool is_ble_stack_started() {
+  return started;
+}
+
+BLEStackResult start_ble_stack() {
+  started = true;
+  return BLEStackResult::OK;
+}
+
+BLEStackResult send_ble_notification(uint16_t conn_id, uint16_t attribute_handle, const uint8_t* value, uint16_t length) {
+  if (host_ble_stack.notification_result != BLEStackResult::OK) {
+    return host_ble_stack.notification_result;
+  }
+  ++host_ble_stack.notification_count;
+  if (host_ble_stack.record_notifications) {
+    host_ble_stack.notifications.push_back(HostBLENotification{ conn_id, attribute_handle, std::string(reinterpret_cast<const char*>(value), length) });
+  }
+  return BLEStackResult::OK;
+}
+
+BLEStackResult restart_ble_service(uint16_t service_handle) {
+  host_ble_stack.restarted_service_handles.push_back(service_handle);
+  return BLEStackResult::OK;
+}
+
+BLEStackResult send_ble_service_changed_indication(const BLEStackAddress& address) {
+  ++host_ble_stack.service_changed_indications;
+  return BLEStackResult::OK;
+}
+
+BLEStackResult request_ble_connection_parameters(const BLEStackAddress& address, uint16_t min_interval, uint16_t max_interval, uint16_t latency, uint16_t timeout) {
+  ++host_ble_stack.connection_parameter_requests;
+  return BLEStackResult::OK;
+}
+
+BLEStackResult set_ble_only_accept_specified_authentication(bool enabled) {
+  return BLEStackResult::OK;
+}
+
+void load_bonded_devices(std::vector<BLEStackBond>& bonded_devices) {
+  bonded_devices = host_ble_stack.bonds;
+}
+
+BLEStackResult remove_ble_bond(const BLEStackAddress& address) {
+  auto& bonds = host_ble_stack.bonds;
+  bonds.erase(std::remove_if(bonds.begin(), bonds.end(), [&address](const BLEStackBond& bond) {
+    return memcmp(bond.address.bytes, address.bytes, BLEStackAddress::LENGTH) == 0;
+  }), bonds.end());
+  return BLEStackResult::OK;
+}
+
+BLEStackResult clear_ble_accept_list() {
+  return BLEStackResult::OK;
+}
+
+BLEStackResult add_to_ble_accept_list(const BLEStackAddress& address, bool public_address) {
+  return BLEStackResult::OK;
+}
+
+BLEStackResult release_bt_controller_memory() {
+  return BLEStackResult::OK;
+}
+
+BLEStackResult read_ble_rssi(const BLEStackAddress& address) {
+  return BLEStackResult::OK;
+}
+
+BLEStackResult request_ble_data_length(const BLEStackAddress& address, uint16_t tx_octets) {
+  return BLEStackResult::OK;
+}
+
+} // namespace esp32_ble_controller
+} // namespace esphome
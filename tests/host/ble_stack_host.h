@@ -0,0 +1,42 @@
+#pragma once
+
+// Backend of the stack layer for the host build (see ble_stack.h), which records the calls of the BLE controller instead of talking to a host stack.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "esp32_ble_controller/ble_stack.h"
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+struct HostBLENotification {
+  uint16_t conn_id;
+  uint16_t attribute_handle;
+  std::string value;
+};
+
+struct HostBLEStack {
+  /// the sent notifications in order (only if recorded, benchmarks just count them)
+  std::vector<HostBLENotification> notifications;
+  bool record_notifications{true};
+  uint32_t notification_count{0};
+  /// result of each notification, e.g. to simulate a full transmit buffer
+  BLEStackResult notification_result{BLEStackResult::OK};
+
+  std::vector<uint16_t> restarted_service_handles;
+  uint32_t service_changed_indications{0};
+  uint32_t connection_parameter_requests{0};
+  std::vector<BLEStackBond> bonds;
+
+  void clear_notifications() {
+    notifications.clear();
+    notification_count = 0;
+  }
+};
+
+extern HostBLEStack host_ble_stack;
+
+} // namespace esp32_ble_controller
+} // namespace esphome
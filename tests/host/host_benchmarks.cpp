@@ -0,0 +1,176 @@
+// Micro-benchmarks of the hot paths of the BLE controller and its handlers in the host build (see CMakeLists.txt).
+// Prints the time and the heap allocations per operation, so the numbers of two releases can be compared line by line.
+// Usage: host_benchmarks [iterations]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#include "esp32_ble_controller/ble_sensor_history.h"
+#include "esp32_ble_controller/ble_statistics.h"
+#include "esp32_ble_controller/inline_function.h"
+#include "esp32_ble_controller/log_ring_buffer.h"
+#include "esp32_ble_controller/thread_safe_bounded_queue.h"
+#include "esp32_ble_controller/value_utils.h"
+
+#include "host_device.h"
+
+using namespace esphome::esp32_ble_controller;
+
+// allocation counting ////////////////////////////////////////////////////////////////////////////////////////////////
+
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void* p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+// harness ////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// keeps the compiler from optimizing the benchmarked code away
+static volatile uint32_t sink;
+
+template <typename F>
+static void run(const char* name, uint32_t iterations, F&& operation) {
+  // warm up (e.g. lazily initialized statics)
+  for (uint32_t i = 0; i < iterations / 10 + 1; ++i) {
+    operation(i);
+  }
+
+  const uint64_t allocations_before = allocations.load();
+  const auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; ++i) {
+    operation(i);
+  }
+  const auto end = std::chrono::steady_clock::now();
+  const uint64_t allocated = allocations.load() - allocations_before;
+
+  const double nanos = std::chrono::duration<double, std::nano>(end - start).count();
+  printf("%-36s %10.1f ns/op %8.2f allocs/op\n", name, nanos / iterations, double(allocated) / iterations);
+}
+
+using DeferredFunction = InlineFunction<4 * sizeof(void*)>;
+
+int main(int argc, char** argv) {
+  const uint32_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+  if (iterations == 0) {
+    printf("Usage: %s [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  const string fan_options = "on 45 no reverse";
+  run("split fan options", iterations, [&fan_options](uint32_t) {
+    sink = split(fan_options).size();
+  });
+
+  const string command = "wifi-config my-wifi-ssid my-secret-password;stats\n";
+  run("tokenize pipelined commands", iterations, [&command](uint32_t) {
+    string_view commands[4];
+    string_view tokens[8];
+    const size_t command_count = tokenize(command, commands, 4, ";\n");
+    size_t token_count = 0;
+    for (size_t i = 0; i < command_count; ++i) {
+      token_count += tokenize(commands[i], tokens, 8, " \r");
+    }
+    sink = token_count;
+  });
+
+  run("to_fixed_point", iterations, [](uint32_t i) {
+    sink = to_fixed_point(i * 0.01f, -2, INT16_MIN, INT16_MAX);
+  });
+
+  LogRingBuffer log_buffer;
+  run("log line push (strip magic) + pop", iterations, [&log_buffer](uint32_t) {
+    char lines[128];
+    log_buffer.push_line("\033[0;36m[D][sensor:094]: \033[5mtemperature\033[6m: Sending state 21.50000 °C\033[0m");
+    size_t length;
+    log_buffer.pop_lines(lines, sizeof(lines), length);
+    sink = length;
+  });
+
+  ThreadSafeBoundedQueue<DeferredFunction, 16> queue;
+  run("deferred function push + take", iterations, [&queue](uint32_t i) {
+    DeferredFunction function;
+    queue.push([i]() { sink = i; });
+    queue.take(function);
+    function();
+  });
+
+  run("deferred function burst of 16", iterations / 16 + 1, [&queue](uint32_t i) {
+    for (uint32_t j = 0; j < 16; ++j) {
+      queue.push([i, j]() { sink = i + j; });
+    }
+    DeferredFunction function;
+    while (queue.take(function)) {
+      function();
+    }
+  });
+
+  BLELatencyStatistics latency;
+  run("latency add", iterations, [&latency](uint32_t i) {
+    latency.add(i % 5000);
+  });
+  run("latency p99", iterations, [&latency](uint32_t) {
+    sink = latency.get_percentile_micros(99);
+  });
+
+  BLESensorHistory history(1024, -2);
+  run("history add", iterations, [&history](uint32_t i) {
+    history.add(20.0f + (i % 100) * 0.01f, i);
+  });
+  BLEHistoryCursor cursor;
+  run("history frame (MTU 247)", iterations / 10 + 1, [&history, &cursor](uint32_t) {
+    uint8_t frame[244];
+    sink = history.write_frame(0, cursor, 0, frame, sizeof(frame));
+    if (frame[2] == 0) {
+      cursor = BLEHistoryCursor(); // download again from the oldest sample
+    }
+  });
+
+  // a client subscribed to all component characteristics and the command results, the notifications are counted only
+  HostDevice& device = HostDevice::get();
+  host_ble_stack.record_notifications = false;
+  device.connect(1);
+  device.subscribe(1, device.fan_characteristic);
+  device.subscribe(1, device.switch_characteristic);
+  device.subscribe(1, device.sensor_characteristic);
+  device.subscribe(1, device.command_characteristic);
+
+  run("fan state change + notify", iterations, [&device](uint32_t i) {
+    device.fan.make_call().set_speed(i % 3 + 1).perform();
+  });
+  run("switch state change + notify", iterations, [&device](uint32_t i) {
+    device.a_switch.publish_state(i & 1);
+  });
+  run("sensor state + history + notify", iterations, [&device](uint32_t i) {
+    device.sensor.publish_state(20.0f + (i % 100) * 0.01f);
+  });
+  run("history download (300 samples)", iterations / 100 + 1, [&device](uint32_t) {
+    device.write(1, device.history_characteristic, string("\x02", 1));
+    for (int i = 0; i < 10; ++i) {
+      device.loop();
+    }
+  });
+  run("fan write + loop", iterations, [&device](uint32_t i) {
+    device.write(1, device.fan_characteristic, i & 1 ? "on 2" : "off");
+    device.loop();
+  });
+  run("command write + loop (echo)", iterations, [&device](uint32_t) {
+    device.write(1, device.command_characteristic, "#9 echo hello");
+    device.loop();
+  });
+  sink = host_ble_stack.notification_count;
+
+  return 0;
+}
@@ -0,0 +1,116 @@
+#include "host_device.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "esphome/core/application.h"
+
+#include "esp32_ble_controller/ble_utils.h"
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+// the UUIDs of the maintenance service are fixed (see ble_maintenance_handler.cpp)
+static const char* MAINTENANCE_SERVICE_UUID = "7b691dff-9062-4192-b46a-692e0da81d91";
+static const char* COMMAND_UUID = "1d3c6498-cfdf-44a1-9038-3e757dcc449d";
+static const char* SNAPSHOT_UUID = "c7d4e2a1-3b6f-4e58-8d91-6a0f2b7c5e34";
+static const char* HISTORY_UUID = "e3b5f1c8-2a4d-4f6b-9c7e-1d8a0b3f5e62";
+static const char* BATCH_UUID = "4f8e2d6a-1c7b-4a93-b5e0-7d3c9a1f6b28";
+
+// 128-bit UUIDs as generated by the code generation, least significant byte first
+static const uint8_t SERVICE_UUID[BLE_UUID128_LENGTH] = { 0x00, 0x0a, 0x1d, 0x5c, 0x7b, 0x2e, 0x3a, 0x9f, 0x5d, 0x4b, 0x4e, 0x6c, 0x01, 0x00, 0x1f, 0x8a };
+static const uint8_t FAN_UUID[BLE_UUID128_LENGTH] = { 0x00, 0x0a, 0x1d, 0x5c, 0x7b, 0x2e, 0x3a, 0x9f, 0x5d, 0x4b, 0x4e, 0x6c, 0x02, 0x00, 0x1f, 0x8a };
+static const uint8_t SWITCH_UUID[BLE_UUID128_LENGTH] = { 0x00, 0x0a, 0x1d, 0x5c, 0x7b, 0x2e, 0x3a, 0x9f, 0x5d, 0x4b, 0x4e, 0x6c, 0x03, 0x00, 0x1f, 0x8a };
+static const uint8_t SENSOR_UUID[BLE_UUID128_LENGTH] = { 0x00, 0x0a, 0x1d, 0x5c, 0x7b, 0x2e, 0x3a, 0x9f, 0x5d, 0x4b, 0x4e, 0x6c, 0x04, 0x00, 0x1f, 0x8a };
+
+HostDevice& HostDevice::get() {
+  static HostDevice device;
+  return device;
+}
+
+HostDevice::HostDevice() {
+  App.register_fan(&fan);
+  App.register_switch(&a_switch);
+  App.register_sensor(&sensor);
+
+  controller.register_component(&fan, SERVICE_UUID, FAN_UUID);
+  controller.register_component(&a_switch, SERVICE_UUID, SWITCH_UUID);
+  controller.register_component(&sensor, SERVICE_UUID, SENSOR_UUID, true, 0, 0, BLEValueEncoding::SINT16, -2, HISTORY_SIZE);
+  controller.register_service(SERVICE_UUID, 1 + 3 * 6);
+
+  echo_trigger.set_automation([](std::vector<std::string> arguments, BLECustomCommandResultSender result) {
+    result = arguments.empty() ? "" : arguments[0];
+  });
+  controller.register_command("echo", "'echo <text>' sends the text back.", &echo_trigger);
+
+  controller.set_security_mode(BLESecurityMode::NONE);
+  controller.set_max_connections(3);
+  controller.set_snapshot_characteristic_exposed(true);
+  controller.set_batch_characteristic_exposed(true);
+  controller.setup();
+
+  BLEServer* server = BLEDevice::m_pServer;
+  BLEService* component_service = server->getServiceByUUID(to_ble_uuid(SERVICE_UUID));
+  fan_characteristic = component_service->getCharacteristic(to_ble_uuid(FAN_UUID));
+  switch_characteristic = component_service->getCharacteristic(to_ble_uuid(SWITCH_UUID));
+  sensor_characteristic = component_service->getCharacteristic(to_ble_uuid(SENSOR_UUID));
+
+  BLEService* maintenance_service = server->getServiceByUUID(MAINTENANCE_SERVICE_UUID);
+  command_characteristic = maintenance_service->getCharacteristic(COMMAND_UUID);
+  snapshot_characteristic = maintenance_service->getCharacteristic(SNAPSHOT_UUID);
+  history_characteristic = maintenance_service->getCharacteristic(HISTORY_UUID);
+  batch_characteristic = maintenance_service->getCharacteristic(BATCH_UUID);
+}
+
+void HostDevice::connect(uint16_t conn_id, uint16_t mtu) {
+  esp_ble_gatts_cb_param_t param = {};
+  param.connect.conn_id = conn_id;
+  const esp_bd_addr_t address = { 0x40, 0x4c, 0xca, 0x00, 0x00, uint8_t(conn_id) };
+  memcpy(param.connect.remote_bda, address, sizeof(esp_bd_addr_t));
+  param.connect.conn_params = { 24, 0, 400 };
+  BLEDevice::handle_gatts_event(ESP_GATTS_CONNECT_EVT, &param);
+
+  param = {};
+  param.mtu.conn_id = conn_id;
+  param.mtu.mtu = mtu;
+  BLEDevice::handle_gatts_event(ESP_GATTS_MTU_EVT, &param);
+
+  loop();
+}
+
+void HostDevice::disconnect(uint16_t conn_id) {
+  esp_ble_gatts_cb_param_t param = {};
+  param.disconnect.conn_id = conn_id;
+  BLEDevice::handle_gatts_event(ESP_GATTS_DISCONNECT_EVT, &param);
+  loop();
+}
+
+void HostDevice::subscribe(uint16_t conn_id, BLECharacteristic* characteristic, bool subscribed) {
+  BLEDescriptor* cccd = characteristic->getDescriptorByUUID(BLEUUID((uint16_t) 0x2902));
+  uint8_t value[2] = { uint8_t(subscribed ? 0x01 : 0x00), 0x00 };
+
+  esp_ble_gatts_cb_param_t param = {};
+  param.write.conn_id = conn_id;
+  param.write.handle = cccd->getHandle();
+  param.write.len = sizeof(value);
+  param.write.value = value;
+  BLEDevice::handle_gatts_event(ESP_GATTS_WRITE_EVT, &param);
+  loop();
+}
+
+void HostDevice::write(uint16_t conn_id, BLECharacteristic* characteristic, const std::string& value) {
+  uint8_t written[BLE_MAX_MTU];
+  const size_t length = std::min<size_t>(value.length(), sizeof(written));
+  memcpy(written, value.data(), length);
+
+  esp_ble_gatts_cb_param_t param = {};
+  param.write.conn_id = conn_id;
+  param.write.handle = characteristic->getHandle();
+  param.write.len = length;
+  param.write.value = written;
+  BLEDevice::handle_gatts_event(ESP_GATTS_WRITE_EVT, &param);
+}
+
+} // namespace esp32_ble_controller
+} // namespace esphome
@@ -0,0 +1,62 @@
+#pragma once
+
+// A device in the host build: the BLE controller exposes a fan, a switch and a sensor (with history) and has a custom command, like a yaml configuration
+// would set it up. The tests act as BLE clients by passing GATT server events to the stub of the BLE library (see stubs/BLEDevice.h).
+
+#include <cstdint>
+#include <string>
+
+#include <BLEDevice.h>
+
+#include "esphome/components/fan/fan.h"
+#include "esphome/components/sensor/sensor.h"
+#include "esphome/components/switch/switch.h"
+
+#include "esp32_ble_controller/automation.h"
+#include "esp32_ble_controller/esp32_ble_controller.h"
+
+#include "ble_stack_host.h"
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+class HostDevice {
+public:
+  /// Returns the device, which is set up on first use (there is only one BLE controller per process).
+  static HostDevice& get();
+
+  /// Connects a client with the given MTU and runs the main loop, which handles the deferred connection events.
+  void connect(uint16_t conn_id, uint16_t mtu = BLE_MAX_MTU);
+  void disconnect(uint16_t conn_id);
+  /// Enables or disables the notifications of the given characteristic for the given client.
+  void subscribe(uint16_t conn_id, BLECharacteristic* characteristic, bool subscribed = true);
+  /// Writes the given value of the given characteristic from the given client (like the BLE task does), the main loop does not run.
+  void write(uint16_t conn_id, BLECharacteristic* characteristic, const std::string& value);
+
+  /// Runs the main loop of the controller once.
+  void loop() { controller.loop(); }
+
+  static const uint16_t HISTORY_SIZE = 300;
+
+  fan::Fan fan{"Fan", "fan", fan::FanTraits(true, true, true, 3)};
+  switch_::Switch a_switch{"Switch", "switch"};
+  sensor::Sensor sensor{"Temperature", "temperature", "°C", 1}; // SINT16 with two decimals, keeps a history
+  ESP32BLEController controller;
+
+  // the characteristics of the components (in the order of registration) and of the maintenance service
+  BLECharacteristic* fan_characteristic;
+  BLECharacteristic* switch_characteristic;
+  BLECharacteristic* sensor_characteristic;
+  BLECharacteristic* command_characteristic;
+  BLECharacteristic* snapshot_characteristic;
+  BLECharacteristic* history_characteristic;
+  BLECharacteristic* batch_characteristic;
+
+private:
+  HostDevice();
+
+  BLEControllerCustomCommandExecutionTrigger echo_trigger{&controller};
+};
+
+} // namespace esp32_ble_controller
+} // namespace esphome
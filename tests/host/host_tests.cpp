@@ -0,0 +1,603 @@
+// Unit tests of the BLE controller and its handlers in the host build (see CMakeLists.txt).
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "esp32_ble_controller/ble_sensor_history.h"
+#include "esp32_ble_controller/ble_statistics.h"
+#include "esp32_ble_controller/inline_function.h"
+#include "esp32_ble_controller/log_ring_buffer.h"
+#include "esp32_ble_controller/thread_safe_bounded_queue.h"
+#include "esp32_ble_controller/value_utils.h"
+
+#include "esphome/core/hal.h"
+
+#include "host_device.h"
+
+using namespace esphome::esp32_ble_controller;
+
+static int failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      ++failures; \
+    } \
+  } while (false)
+
+using DeferredFunction = InlineFunction<4 * sizeof(void*)>;
+
+// inline function ////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void test_inline_function() {
+  int calls = 0;
+  DeferredFunction function([&calls]() { ++calls; });
+  CHECK(bool(function));
+  function();
+  CHECK(calls == 1);
+
+  DeferredFunction moved(std::move(function));
+  CHECK(!function);
+  moved();
+  CHECK(calls == 2);
+
+  // the captures are destroyed with the function
+  auto shared = std::make_shared<int>(0);
+  {
+    DeferredFunction holder([shared]() { ++*shared; });
+    CHECK(shared.use_count() == 2);
+    holder();
+  }
+  CHECK(shared.use_count() == 1);
+  CHECK(*shared == 1);
+}
+
+// queue ////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void test_queue_reject() {
+  ThreadSafeBoundedQueue<int, 3> queue;
+  for (int i = 0; i < 3; ++i) {
+    int value = i;
+    CHECK(queue.push(std::move(value)));
+  }
+  int value = 3;
+  CHECK(!queue.push(std::move(value)));
+  CHECK(queue.get_free_capacity() == 0);
+  CHECK(queue.get_high_water_mark() == 3);
+  CHECK(queue.get_push_failures() == 1);
+
+  for (int i = 0; i < 3; ++i) {
+    CHECK(queue.take(value));
+    CHECK(value == i);
+  }
+  CHECK(!queue.take(value));
+  CHECK(queue.get_free_capacity() == 3);
+
+  queue.reset_statistics();
+  CHECK(queue.get_high_water_mark() == 0);
+  CHECK(queue.get_push_failures() == 0);
+}
+
+static void test_queue_of_functions() {
+  auto shared = std::make_shared<int>(0);
+  {
+    ThreadSafeBoundedQueue<DeferredFunction, 4> queue;
+    for (int i = 0; i < 3; ++i) {
+      CHECK(queue.push(DeferredFunction([shared]() { ++*shared; })));
+    }
+    DeferredFunction function;
+    CHECK(queue.take(function));
+    function();
+    CHECK(*shared == 1);
+    // the queue destroys the functions that have not been taken
+  }
+  CHECK(shared.use_count() == 1);
+}
+
+static void test_queue_across_tasks() {
+  static const int COUNT = 10000;
+  ThreadSafeBoundedQueue<int, 8> queue;
+  std::thread producer([&queue]() {
+    for (int i = 0; i < COUNT; ++i) {
+      int value = i;
+      while (!queue.push(std::move(value))) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  bool in_order = true;
+  for (int expected = 0; expected < COUNT; ++expected) {
+    int value = -1;
+    if (!queue.take(value, portMAX_DELAY) || value != expected) {
+      in_order = false;
+    }
+  }
+  producer.join();
+  CHECK(in_order);
+  CHECK(queue.get_high_water_mark() <= 8);
+}
+
+// log ring buffer ////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void test_log_ring_buffer_strips_magic() {
+  LogRingBuffer buffer;
+  CHECK(buffer.push_line("\033[0;32m[I][app:100]: \033[5mSetup done\033[0m"));
+  CHECK(buffer.push_line("second"));
+
+  char lines[64];
+  size_t length;
+  CHECK(buffer.pop_lines(lines, sizeof(lines), length));
+  CHECK(std::string(lines, length) == "[I][app:100]: Setup done\nsecond");
+  CHECK(!buffer.pop_lines(lines, sizeof(lines), length));
+  CHECK(length == 0);
+}
+
+static void test_log_ring_buffer_empty_line() {
+  LogRingBuffer buffer;
+  CHECK(buffer.push_line("\033[0;32m\033[0m")); // nothing left after stripping the magic
+  CHECK(buffer.push_line("after"));
+
+  // the empty line does not fit together with the next one, it is popped on its own and does not look like an empty buffer
+  char lines[5];
+  size_t length = 1;
+  CHECK(buffer.pop_lines(lines, sizeof(lines), length));
+  CHECK(length == 0);
+  CHECK(buffer.pop_lines(lines, sizeof(lines), length));
+  CHECK(std::string(lines, length) == "after");
+  CHECK(!buffer.pop_lines(lines, sizeof(lines), length));
+}
+
+static void test_log_ring_buffer_splits_long_lines() {
+  LogRingBuffer buffer;
+  CHECK(buffer.push_line("0123456789"));
+  CHECK(buffer.push_line("abc"));
+
+  char lines[6];
+  size_t length;
+  CHECK(buffer.pop_lines(lines, sizeof(lines), length));
+  CHECK(std::string(lines, length) == "012345");
+  CHECK(buffer.pop_lines(lines, sizeof(lines), length));
+  CHECK(std::string(lines, length) == "6789");
+  CHECK(buffer.pop_lines(lines, sizeof(lines), length));
+  CHECK(std::string(lines, length) == "abc");
+}
+
+static void test_log_ring_buffer_drops_when_full() {
+  LogRingBuffer buffer;
+  const std::string line(100, 'x');
+  size_t pushed = 0;
+  while (buffer.push_line(line.c_str())) {
+    ++pushed;
+  }
+  CHECK(pushed == LogRingBuffer::CAPACITY / (line.length() + 1));
+  CHECK(buffer.take_dropped_lines() == 1);
+  CHECK(buffer.take_dropped_lines() == 0);
+}
+
+// statistics ////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void test_latency_statistics() {
+  BLELatencyStatistics statistics;
+  CHECK(statistics.get_percentile_micros(50) == 0);
+
+  for (uint32_t micros = 1; micros <= 100; ++micros) {
+    statistics.add(micros * 10);
+  }
+  CHECK(statistics.count == 100);
+  CHECK(statistics.max_micros == 1000);
+  CHECK(statistics.get_average_micros() == 505);
+
+  // the percentiles are upper bounds of at most twice the exact value
+  const uint32_t p50 = statistics.get_percentile_micros(50);
+  CHECK(p50 >= 500 && p50 <= 1000);
+  CHECK(statistics.get_percentile_micros(99) == 1000);
+  CHECK(statistics.get_percentile_micros(100) == 1000);
+}
+
+// sensor history ////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t get_uint32(const uint8_t* buffer) { return buffer[0] | buffer[1] << 8 | buffer[2] << 16 | uint32_t(buffer[3]) << 24; }
+
+static void test_sensor_history() {
+  BLESensorHistory history(4, -1);
+  CHECK(history.is_allocated());
+  for (int i = 0; i < 6; ++i) {
+    history.add(20.0f + i * 0.5f, 100 + i * 10);
+  }
+  history.add(NAN, 200);
+  CHECK(history.get_size() == 4);
+  CHECK(history.get_first_sequence_number() == 2);
+  CHECK(history.get_next_sequence_number() == 6);
+
+  uint8_t frame[64];
+  BLEHistoryCursor cursor;
+  const size_t length = history.write_frame(7, cursor, 300, frame, sizeof(frame));
+  CHECK(length == BLESensorHistory::FRAME_HEADER_LENGTH + 3 * sizeof(BLEHistoryRecord));
+  CHECK(frame[0] == 7);
+  CHECK(int8_t(frame[1]) == -1);
+  CHECK(frame[2] == 4);
+  CHECK(get_uint32(frame + 3) == 2);
+  CHECK(get_uint32(frame + 7) == 120);
+  CHECK(int32_t(get_uint32(frame + 11)) == 210);
+  CHECK(frame[15] == 5 && frame[16] == 0 && frame[17] == 10 && frame[18] == 0);
+  CHECK(cursor.sequence_number == 6);
+
+  // the end of the history
+  CHECK(history.write_frame(7, cursor, 300, frame, sizeof(frame)) == BLESensorHistory::FRAME_HEADER_LENGTH);
+  CHECK(frame[2] == 0);
+  CHECK(get_uint32(frame + 3) == 6);
+  CHECK(get_uint32(frame + 7) == 300);
+}
+
+static void test_sensor_history_frame_limit() {
+  BLESensorHistory history(10, 0);
+  for (int i = 0; i < 10; ++i) {
+    history.add(i, i);
+  }
+  uint8_t frame[BLESensorHistory::FRAME_HEADER_LENGTH + 2 * sizeof(BLEHistoryRecord)];
+  BLEHistoryCursor cursor;
+  CHECK(history.write_frame(0, cursor, 10, frame, sizeof(frame)) == sizeof(frame));
+  CHECK(frame[2] == 3);
+  CHECK(cursor.sequence_number == 3);
+  CHECK(history.write_frame(0, cursor, 10, frame, BLESensorHistory::FRAME_HEADER_LENGTH - 1) == 0);
+}
+
+static void test_sensor_history_download_resumes() {
+  // sample n has the value 3n - 50 at 2n seconds (and the sequence number n)
+  BLESensorHistory history(20, 0);
+  uint32_t added = 0;
+  const auto add_sample = [&history, &added]() {
+    history.add(3.0f * added - 50, 2 * added);
+    ++added;
+  };
+  while (added < 20) {
+    add_sample();
+  }
+
+  // frames of three samples; during the first frames more samples are added than downloaded, so the oldest ones get dropped before they are sent
+  uint8_t frame[BLESensorHistory::FRAME_HEADER_LENGTH + 2 * sizeof(BLEHistoryRecord)];
+  BLEHistoryCursor cursor;
+  uint32_t expected_sequence_number = 0;
+  size_t frames = 0;
+  bool dropped = false;
+  while (history.write_frame(0, cursor, 0, frame, sizeof(frame)) > 0 && frame[2] > 0) {
+    const uint32_t sequence_number = get_uint32(frame + 3);
+    uint32_t time = get_uint32(frame + 7);
+    int32_t value = get_uint32(frame + 11);
+    CHECK(sequence_number == std::max(expected_sequence_number, history.get_first_sequence_number()));
+    dropped |= sequence_number > expected_sequence_number;
+    for (size_t i = 0; i < frame[2]; ++i) {
+      if (i > 0) {
+        const uint8_t* record = frame + BLESensorHistory::FRAME_HEADER_LENGTH + (i - 1) * sizeof(BLEHistoryRecord);
+        value += int16_t(record[0] | record[1] << 8);
+        time += record[2] | record[3] << 8;
+      }
+      CHECK(value == 3 * int32_t(sequence_number + i) - 50);
+      CHECK(time == 2 * (sequence_number + i));
+    }
+    expected_sequence_number = sequence_number + frame[2];
+    CHECK(cursor.sequence_number == expected_sequence_number);
+
+    if (++frames <= 5) {
+      for (int i = 0; i < 4; ++i) {
+        add_sample();
+      }
+    }
+  }
+  CHECK(dropped);
+  CHECK(frames > 5);
+  CHECK(expected_sequence_number == added);
+  CHECK(cursor.sequence_number == history.get_next_sequence_number());
+}
+
+// value utils ////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void test_to_fixed_point() {
+  CHECK(to_fixed_point(21.46f, -1, INT16_MIN, INT16_MAX) == 215);
+  CHECK(to_fixed_point(-3.0f, 0, INT16_MIN, INT16_MAX) == -3);
+  CHECK(to_fixed_point(NAN, -1, INT16_MIN, INT16_MAX) == INT16_MIN);
+  CHECK(to_fixed_point(1e9f, 0, INT16_MIN, INT16_MAX) == INT16_MAX);
+  CHECK(to_fixed_point(-1e9f, 0, INT16_MIN, INT16_MAX) == INT16_MIN + 1);
+}
+
+static void test_split_and_tokenize() {
+  const vector<string> options = split("on  45 no ");
+  CHECK(options.size() == 3 && options[0] == "on" && options[1] == "45" && options[2] == "no");
+
+  string_view tokens[3];
+  CHECK(tokenize("wifi-ssid  my-wifi\r", tokens, 3, " \r") == 2);
+  CHECK(tokens[0] == "wifi-ssid" && tokens[1] == "my-wifi");
+  CHECK(tokenize("a;b;c;d", tokens, 3, ";") == 3);
+  CHECK(tokens[2] == "c");
+  CHECK(tokenize(" ", tokens, 3) == 0);
+}
+
+// controller ////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Returns the values notified to the given client for the given characteristic (in order).
+static vector<string> get_notifications(uint16_t conn_id, const BLECharacteristic* characteristic) {
+  vector<string> values;
+  for (const auto& notification : host_ble_stack.notifications) {
+    if (notification.conn_id == conn_id && notification.attribute_handle == characteristic->getHandle()) {
+      values.push_back(notification.value);
+    }
+  }
+  return values;
+}
+
+/// Connects two clients, the first one subscribes to all component characteristics, the second one only to the command results.
+static void connect_clients() {
+  HostDevice& device = HostDevice::get();
+  device.connect(1, 185);
+  device.connect(2, 185);
+  device.subscribe(1, device.fan_characteristic);
+  device.subscribe(1, device.switch_characteristic);
+  device.subscribe(1, device.sensor_characteristic);
+  device.subscribe(2, device.command_characteristic);
+  CHECK(device.controller.get_connections().size() == 2);
+  CHECK(device.controller.get_max_notification_length() == 182);
+}
+
+static void test_fan_state_notified() {
+  HostDevice& device = HostDevice::get();
+  host_ble_stack.clear_notifications();
+  const uint32_t generation = device.controller.get_state_generation();
+
+  device.fan.make_call().set_state(true).set_speed(2).set_direction(esphome::fan::FanDirection::REVERSE).perform();
+
+  const string expected = "fan=on speed=2/3 oscillating=no direction=reverse";
+  CHECK(device.fan_characteristic->getValue() == expected);
+  CHECK(get_notifications(1, device.fan_characteristic) == vector<string>{ expected });
+  CHECK(get_notifications(2, device.fan_characteristic).empty()); // not subscribed
+  CHECK(device.controller.get_state_generation() == generation + 1);
+}
+
+static void test_fan_written() {
+  HostDevice& device = HostDevice::get();
+  host_ble_stack.clear_notifications();
+
+  device.write(2, device.fan_characteristic, "off 1 yes forward");
+  CHECK(device.fan.state); // the write is deferred to the main loop
+  device.loop();
+
+  CHECK(!device.fan.state);
+  CHECK(device.fan.speed == 1);
+  CHECK(device.fan.oscillating);
+  CHECK(device.fan.direction == esphome::fan::FanDirection::FORWARD);
+  CHECK(get_notifications(1, device.fan_characteristic) == vector<string>{ "fan=off speed=1/3 oscillating=yes direction=forward" });
+
+  // unknown options are skipped, an out of range speed as well
+  device.write(2, device.fan_characteristic, "on 7 sideways");
+  device.loop();
+  CHECK(device.fan.state);
+  CHECK(device.fan.speed == 1);
+}
+
+static void test_switch_state() {
+  HostDevice& device = HostDevice::get();
+  host_ble_stack.clear_notifications();
+
+  device.a_switch.publish_state(true);
+  CHECK(get_notifications(1, device.switch_characteristic) == vector<string>{ string("\x01\x00", 2) });
+
+  device.write(1, device.switch_characteristic, string("\x00", 1));
+  device.loop();
+  CHECK(!device.a_switch.state);
+  CHECK(get_notifications(1, device.switch_characteristic).back() == string("\x00\x00", 2));
+
+  // a 2-byte value is not mistaken for a subscription (only writes of 0x2902 descriptors are)
+  const auto subscribed_handles = [&device](uint16_t conn_id) {
+    for (const auto& connection : device.controller.get_connections()) {
+      if (connection.conn_id == conn_id) {
+        return connection.subscribed_cccd_handles;
+      }
+    }
+    return vector<uint16_t>();
+  };
+  const vector<uint16_t> handles = subscribed_handles(2);
+  device.write(2, device.switch_characteristic, string("\x01\x00", 2));
+  device.loop();
+  CHECK(subscribed_handles(2) == handles);
+  CHECK(get_notifications(2, device.switch_characteristic).empty());
+}
+
+static void test_sensor_state() {
+  HostDevice& device = HostDevice::get();
+  host_ble_stack.clear_notifications();
+  const BLESensorHistory* history = device.controller.get_history(2);
+  CHECK(history != nullptr);
+  const uint32_t next_sequence_number = history->get_next_sequence_number();
+
+  device.sensor.publish_state(21.456f);
+  // SINT16 with two decimals, little-endian
+  CHECK(get_notifications(1, device.sensor_characteristic) == vector<string>{ string("\x62\x08", 2) });
+  CHECK(history->get_next_sequence_number() == next_sequence_number + 1);
+}
+
+static void test_history_download() {
+  HostDevice& device = HostDevice::get();
+  device.subscribe(2, device.history_characteristic);
+  const BLESensorHistory* history = device.controller.get_history(2);
+
+  // more samples than the history keeps, sample i has the value i / 4 (SINT16 with two decimals, so the history keeps 25 * i)
+  const uint32_t first_added = history->get_next_sequence_number();
+  const uint32_t start_seconds = esphome::millis() / 1000;
+  for (uint16_t i = 0; i < HostDevice::HISTORY_SIZE + 20; ++i) {
+    device.sensor.publish_state(i * 0.25f);
+  }
+  CHECK(history->get_size() == HostDevice::HISTORY_SIZE);
+  host_ble_stack.clear_notifications();
+
+  // download everything (cursor 0), the frames are streamed over several loop passes
+  device.write(2, device.history_characteristic, string("\x02", 1));
+  for (int i = 0; i < 100 && (get_notifications(2, device.history_characteristic).empty() || get_notifications(2, device.history_characteristic).back()[2] != 0); ++i) {
+    device.loop();
+  }
+
+  const vector<string> frames = get_notifications(2, device.history_characteristic);
+  CHECK(frames.size() > 2);
+  uint32_t expected_sequence_number = history->get_first_sequence_number();
+  for (const string& frame : frames) {
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(frame.data());
+    CHECK(frame.length() >= BLESensorHistory::FRAME_HEADER_LENGTH && frame.length() <= device.controller.get_max_notification_length());
+    CHECK(data[0] == 2);
+    CHECK(int8_t(data[1]) == -2);
+    CHECK(get_uint32(data + 3) == expected_sequence_number);
+    if (data[2] == 0) {
+      continue; // the end of the download
+    }
+    CHECK(frame.length() == BLESensorHistory::FRAME_HEADER_LENGTH + (data[2] - 1) * sizeof(BLEHistoryRecord));
+
+    uint32_t time = get_uint32(data + 7);
+    int32_t value = get_uint32(data + 11);
+    for (size_t i = 0; i < data[2]; ++i) {
+      if (i > 0) {
+        const uint8_t* record = data + BLESensorHistory::FRAME_HEADER_LENGTH + (i - 1) * sizeof(BLEHistoryRecord);
+        value += int16_t(record[0] | record[1] << 8);
+        time += record[2] | record[3] << 8;
+      }
+      CHECK(value == 25 * int32_t(expected_sequence_number - first_added));
+      CHECK(time >= start_seconds && time <= esphome::millis() / 1000);
+      ++expected_sequence_number;
+    }
+  }
+  CHECK(frames.back()[2] == 0);
+  CHECK(expected_sequence_number == history->get_next_sequence_number());
+  CHECK(expected_sequence_number - history->get_first_sequence_number() == HostDevice::HISTORY_SIZE);
+}
+
+static void test_batch_written() {
+  HostDevice& device = HostDevice::get();
+  device.subscribe(2, device.batch_characteristic);
+  device.a_switch.publish_state(false);
+  host_ble_stack.clear_notifications();
+
+  // the switch is turned on, the unknown index 7 and the read-only sensor are rejected
+  device.write(2, device.batch_characteristic, string("\x01\x01\x01" "\x07\x01\x00" "\x02\x02\x00\x00", 10));
+  device.loop();
+  CHECK(device.a_switch.state);
+  CHECK(get_notifications(2, device.batch_characteristic) == vector<string>{ string("\x01\x02\x07\x02", 4) });
+}
+
+static void test_snapshot_continuation() {
+  HostDevice& device = HostDevice::get();
+  device.subscribe(1, device.snapshot_characteristic);
+  device.subscribe(2, device.snapshot_characteristic);
+  host_ble_stack.clear_notifications();
+
+  // the entries from the switch on are notified to the client that asks for them only
+  device.write(1, device.snapshot_characteristic, string("\x01", 1));
+  device.loop();
+  const vector<string> continuations = get_notifications(1, device.snapshot_characteristic);
+  CHECK(continuations.size() == 1);
+  CHECK(continuations[0].length() > 7 && continuations[0][5] == 1 && continuations[0][7] == 1);
+  CHECK(get_notifications(2, device.snapshot_characteristic).empty());
+
+  // the readable snapshot still starts with the first component
+  const string snapshot = device.snapshot_characteristic->getValue();
+  CHECK(snapshot.length() > 7 && snapshot[5] == 0 && snapshot[7] == 0);
+}
+
+static void test_unsubscribed_client_not_notified() {
+  HostDevice& device = HostDevice::get();
+  device.subscribe(1, device.fan_characteristic, false);
+  host_ble_stack.clear_notifications();
+
+  device.fan.make_call().set_speed(3).perform();
+  CHECK(host_ble_stack.notifications.empty());
+  CHECK(device.fan_characteristic->getValue() == "fan=on speed=3/3 oscillating=yes direction=forward"); // clients can still read it
+
+  device.subscribe(1, device.fan_characteristic);
+}
+
+static void test_command_dispatch() {
+  HostDevice& device = HostDevice::get();
+  host_ble_stack.clear_notifications();
+
+  // pipelined commands with sequence tags, the results are notified in order in the same loop pass
+  device.write(2, device.command_characteristic, "#1 echo hello\n#2 nope;;#3 echo");
+  CHECK(host_ble_stack.notifications.empty());
+  device.loop();
+  CHECK(get_notifications(2, device.command_characteristic) == (vector<string>{ "#1 hello", "#2 Unkown command 'nope', try 'help'.", "#3 " }));
+  CHECK(get_notifications(1, device.command_characteristic).empty());
+  CHECK(device.command_characteristic->getValue() == "#3 ");
+
+  // custom commands take the rest of the line, so their arguments may contain ';'
+  host_ble_stack.clear_notifications();
+  device.write(2, device.command_characteristic, "#4 nope;#5 echo a;b;c\r\n#6 echo x");
+  device.loop();
+  CHECK(get_notifications(2, device.command_characteristic) == (vector<string>{ "#4 Unkown command 'nope', try 'help'.", "#5 a;b;c", "#6 x" }));
+
+  // too many commands or arguments are rejected with an error
+  host_ble_stack.clear_notifications();
+  device.write(2, device.command_characteristic, "echo 1\necho 2\necho 3\necho 4\necho 5\necho 6\necho 7\necho 8\necho 9");
+  device.loop();
+  CHECK(get_notifications(2, device.command_characteristic) == vector<string>{ "Too many commands, at most 8 per write; none executed." });
+  host_ble_stack.clear_notifications();
+  device.write(2, device.command_characteristic, "#7 echo 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15");
+  device.loop();
+  CHECK(get_notifications(2, device.command_characteristic) == vector<string>{ "#7 Too many arguments for 'echo', at most 16 words per command including the sequence tag." });
+  host_ble_stack.clear_notifications();
+  device.write(2, device.command_characteristic, "#8 echo 1 2 3 4 5 6 7 8 9 10 11 12 13 14");
+  device.loop();
+  CHECK(get_notifications(2, device.command_characteristic) == vector<string>{ "#8 1" });
+
+  host_ble_stack.clear_notifications();
+  device.write(2, device.command_characteristic, "help");
+  device.loop();
+  const vector<string> help = get_notifications(2, device.command_characteristic);
+  CHECK(help.size() == 1 && help[0].find("echo") != string::npos && help[0].find("stats") != string::npos);
+
+  // the built-in commands work on the controller
+  host_ble_stack.clear_notifications();
+  device.write(2, device.command_characteristic, "ble-services off");
+  device.loop();
+  CHECK(!device.controller.get_component_services_exposed());
+  device.a_switch.publish_state(true);
+  CHECK(get_notifications(1, device.switch_characteristic).empty());
+  device.write(2, device.command_characteristic, "ble-services on");
+  device.loop();
+  CHECK(device.controller.get_component_services_exposed());
+}
+
+int main() {
+  test_inline_function();
+  test_queue_reject();
+  test_queue_of_functions();
+  test_queue_across_tasks();
+  test_log_ring_buffer_strips_magic();
+  test_log_ring_buffer_empty_line();
+  test_log_ring_buffer_splits_long_lines();
+  test_log_ring_buffer_drops_when_full();
+  test_latency_statistics();
+  test_sensor_history();
+  test_sensor_history_frame_limit();
+  test_sensor_history_download_resumes();
+  test_to_fixed_point();
+  test_split_and_tokenize();
+
+  connect_clients();
+  test_fan_state_notified();
+  test_fan_written();
+  test_switch_state();
+  test_sensor_state();
+  test_history_download();
+  test_batch_written();
+  test_snapshot_continuation();
+  test_unsubscribed_client_not_notified();
+  test_command_dispatch();
+
+  if (failures > 0) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+// The host stub of the Arduino BLE library is a single header.
+#include "BLEDevice.h"
@@ -0,0 +1,474 @@
+#pragma once
+
+// Host stub of the Arduino BLE library (see tests/host/CMakeLists.txt), all its classes used by the BLE controller live in this header.
+// The objects keep their values, handles and callbacks like the library does, but nothing goes over the air: the stack layer of the host build records the
+// notifications (see ble_stack_host.cpp), and the tests play the part of the BLE task by passing GATT server events to BLEDevice::handle_gatts_event().
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <esp_bt_defs.h>
+#include <esp_gap_ble_api.h>
+#include <esp_gatt_defs.h>
+#include <esp_gatts_api.h>
+
+typedef void (*gatts_event_handler)(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t* param);
+typedef void (*gap_event_handler)(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param);
+
+class BLEServer;
+class BLEService;
+
+/// The attribute handles are assigned in the order the attributes are created, starting after the handles of the GATT and GAP services.
+inline uint16_t next_host_attribute_handle = 0x28;
+
+// UUIDs and addresses ////////////////////////////////////////////////////////////////////////////////////////////////
+
+class BLEUUID {
+public:
+  BLEUUID() = default;
+  BLEUUID(const std::string& uuid) : text(uuid) {
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return std::tolower(c); });
+  }
+  BLEUUID(const char* uuid) : BLEUUID(std::string(uuid)) {}
+  BLEUUID(uint16_t uuid16) {
+    char uuid[37];
+    snprintf(uuid, sizeof(uuid), "0000%04x-0000-1000-8000-00805f9b34fb", uuid16);
+    text = uuid;
+  }
+  /// The bytes of a 128-bit UUID are stored least significant byte first, like Bluedroid does.
+  BLEUUID(esp_bt_uuid_t uuid) {
+    if (uuid.len == ESP_UUID_LEN_16) {
+      *this = BLEUUID(uuid.uuid.uuid16);
+      return;
+    }
+    for (int i = ESP_UUID_LEN_128 - 1; i >= 0; --i) {
+      char hex[3];
+      snprintf(hex, sizeof(hex), "%02x", uuid.uuid.uuid128[i]);
+      text += hex;
+      if (i == 12 || i == 10 || i == 8 || i == 6) {
+        text += '-';
+      }
+    }
+  }
+
+  bool equals(const BLEUUID& uuid) const { return text == uuid.text; }
+  std::string toString() const { return text; }
+
+private:
+  std::string text;
+};
+
+class BLEAddress {
+public:
+  BLEAddress(const esp_bd_addr_t address) { memcpy(this->address, address, ESP_BD_ADDR_LEN); }
+
+  esp_bd_addr_t* getNative() { return &address; }
+  std::string toString() const {
+    char text[18];
+    snprintf(text, sizeof(text), "%02x:%02x:%02x:%02x:%02x:%02x", address[0], address[1], address[2], address[3], address[4], address[5]);
+    return text;
+  }
+
+private:
+  esp_bd_addr_t address;
+};
+
+// descriptors ////////////////////////////////////////////////////////////////////////////////////////////////
+
+class BLEDescriptor;
+
+class BLEDescriptorCallbacks {
+public:
+  virtual ~BLEDescriptorCallbacks() = default;
+  virtual void onRead(BLEDescriptor* descriptor) {}
+  virtual void onWrite(BLEDescriptor* descriptor) {}
+};
+
+class BLEDescriptor {
+public:
+  BLEDescriptor(const char* uuid, uint16_t max_length = 100) : BLEDescriptor(BLEUUID(uuid), max_length) {}
+  BLEDescriptor(BLEUUID uuid, uint16_t max_length = 100) : uuid(uuid), max_length(max_length) {}
+  virtual ~BLEDescriptor() = default;
+
+  BLEUUID getUUID() const { return uuid; }
+  uint16_t getHandle() const { return handle; }
+  uint8_t* getValue() { return value.data(); }
+  size_t getLength() const { return value.size(); }
+  void setValue(uint8_t* data, size_t length) { value.assign(data, data + std::min<size_t>(length, max_length)); }
+  void setValue(const std::string& data) { setValue(reinterpret_cast<uint8_t*>(const_cast<char*>(data.data())), data.length()); }
+  void setAccessPermissions(esp_gatt_perm_t permissions) { this->permissions = permissions; }
+  void setCallbacks(BLEDescriptorCallbacks* callbacks) { this->callbacks = callbacks; }
+
+private:
+  friend class BLECharacteristic;
+
+  BLEUUID uuid;
+  uint16_t max_length;
+  uint16_t handle{0};
+  esp_gatt_perm_t permissions{ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE};
+  std::vector<uint8_t> value;
+  BLEDescriptorCallbacks* callbacks{nullptr};
+};
+
+/// Client characteristic configuration descriptor, which holds whether the client (any client, the library does not track them separately) enabled notifications.
+class BLE2902 : public BLEDescriptor {
+public:
+  BLE2902() : BLEDescriptor(BLEUUID((uint16_t) 0x2902), 2) {
+    uint8_t disabled[2] = { 0, 0 };
+    setValue(disabled, sizeof(disabled));
+  }
+
+  bool getNotifications() { return getValue()[0] & 0x01; }
+  bool getIndications() { return getValue()[0] & 0x02; }
+};
+
+/// Characteristic presentation format descriptor.
+class BLE2904 : public BLEDescriptor {
+public:
+  static const uint8_t FORMAT_BOOLEAN = 1;
+  static const uint8_t FORMAT_UINT8 = 4;
+  static const uint8_t FORMAT_UINT16 = 6;
+  static const uint8_t FORMAT_SINT16 = 14;
+  static const uint8_t FORMAT_SINT24 = 15;
+  static const uint8_t FORMAT_FLOAT32 = 20;
+  static const uint8_t FORMAT_UTF8 = 25;
+  static const uint8_t FORMAT_OPAQUE = 27;
+
+  BLE2904() : BLEDescriptor(BLEUUID((uint16_t) 0x2904), sizeof(format)) { update(); }
+
+  void setFormat(uint8_t format) { this->format.format = format; update(); }
+  void setExponent(int8_t exponent) { format.exponent = exponent; update(); }
+  void setUnit(uint16_t unit) { format.unit = unit; update(); }
+  void setNamespace(uint8_t name_space) { format.name_space = name_space; update(); }
+  void setDescription(uint16_t description) { format.description = description; update(); }
+
+private:
+  void update() { setValue(reinterpret_cast<uint8_t*>(&format), sizeof(format)); }
+
+  struct __attribute__((packed)) {
+    uint8_t format{0};
+    int8_t exponent{0};
+    uint16_t unit{0};
+    uint8_t name_space{0};
+    uint16_t description{0};
+  } format;
+};
+
+// characteristics ////////////////////////////////////////////////////////////////////////////////////////////////
+
+class BLECharacteristic;
+
+class BLECharacteristicCallbacks {
+public:
+  enum Status { SUCCESS_INDICATE, SUCCESS_NOTIFY, ERROR_INDICATE_DISABLED, ERROR_NOTIFY_DISABLED, ERROR_GATT, ERROR_NO_CLIENT, ERROR_INDICATE_TIMEOUT, ERROR_INDICATE_FAILURE };
+
+  virtual ~BLECharacteristicCallbacks() = default;
+  virtual void onRead(BLECharacteristic* characteristic) {}
+  virtual void onRead(BLECharacteristic* characteristic, esp_ble_gatts_cb_param_t* param) { onRead(characteristic); }
+  virtual void onWrite(BLECharacteristic* characteristic) {}
+  virtual void onWrite(BLECharacteristic* characteristic, esp_ble_gatts_cb_param_t* param) { onWrite(characteristic); }
+  virtual void onNotify(BLECharacteristic* characteristic) {}
+  virtual void onStatus(BLECharacteristic* characteristic, Status status, uint32_t code) {}
+};
+
+class BLECharacteristic {
+public:
+  static const uint32_t PROPERTY_READ = 1 << 0;
+  static const uint32_t PROPERTY_WRITE = 1 << 1;
+  static const uint32_t PROPERTY_NOTIFY = 1 << 2;
+  static const uint32_t PROPERTY_BROADCAST = 1 << 3;
+  static const uint32_t PROPERTY_INDICATE = 1 << 4;
+  static const uint32_t PROPERTY_WRITE_NR = 1 << 5;
+
+  BLECharacteristic(const char* uuid, uint32_t properties = 0) : BLECharacteristic(BLEUUID(uuid), properties) {}
+  BLECharacteristic(BLEUUID uuid, uint32_t properties = 0) : uuid(uuid), properties(properties) {}
+  virtual ~BLECharacteristic() = default;
+
+  BLEUUID getUUID() const { return uuid; }
+  uint16_t getHandle() const { return handle; }
+  BLEService* getService() const { return service; }
+  uint32_t get_properties() const { return properties; } // host build only
+
+  void addDescriptor(BLEDescriptor* descriptor) {
+    descriptor->handle = next_host_attribute_handle++;
+    descriptors.push_back(descriptor);
+  }
+  BLEDescriptor* getDescriptorByUUID(const char* uuid) { return getDescriptorByUUID(BLEUUID(uuid)); }
+  BLEDescriptor* getDescriptorByUUID(BLEUUID uuid) {
+    for (BLEDescriptor* descriptor : descriptors) {
+      if (descriptor->getUUID().equals(uuid)) {
+        return descriptor;
+      }
+    }
+    return nullptr;
+  }
+  BLEDescriptor* get_descriptor_by_handle(uint16_t handle) { // host build only
+    for (BLEDescriptor* descriptor : descriptors) {
+      if (descriptor->getHandle() == handle) {
+        return descriptor;
+      }
+    }
+    return nullptr;
+  }
+
+  std::string getValue() const { return value; }
+  uint8_t* getData() { return reinterpret_cast<uint8_t*>(&value[0]); }
+  size_t getLength() const { return value.length(); }
+
+  void setValue(uint8_t* data, size_t length) { value.assign(reinterpret_cast<const char*>(data), length); }
+  void setValue(const std::string& value) { this->value = value; }
+  void setValue(uint16_t& data) { set_binary_value(data); }
+  void setValue(uint32_t& data) { set_binary_value(data); }
+  void setValue(int& data) { set_binary_value(data); }
+  void setValue(float& data) { set_binary_value(data); }
+  void setValue(double& data) { set_binary_value(data); }
+
+  void setCallbacks(BLECharacteristicCallbacks* callbacks) { this->callbacks = callbacks; }
+  BLECharacteristicCallbacks* get_callbacks() const { return callbacks; } // host build only
+  void setAccessPermissions(esp_gatt_perm_t permissions) { this->permissions = permissions; }
+
+  /// The BLE controller sends its notifications through the stack layer, so this one is never used.
+  void notify(bool is_notification = true) {}
+  void indicate() {}
+
+private:
+  friend class BLEService;
+
+  template <typename T> void set_binary_value(T data) { value.assign(reinterpret_cast<const char*>(&data), sizeof(data)); }
+
+  BLEUUID uuid;
+  uint32_t properties;
+  uint16_t handle{0};
+  BLEService* service{nullptr};
+  esp_gatt_perm_t permissions{ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE};
+  std::string value;
+  std::vector<BLEDescriptor*> descriptors;
+  BLECharacteristicCallbacks* callbacks{nullptr};
+};
+
+// services ////////////////////////////////////////////////////////////////////////////////////////////////
+
+class BLEService {
+public:
+  BLEService(BLEUUID uuid, uint16_t num_handles) : uuid(uuid), num_handles(num_handles), handle(next_host_attribute_handle++) {}
+
+  BLEUUID getUUID() const { return uuid; }
+  uint16_t getHandle() const { return handle; }
+  uint16_t get_num_handles() const { return num_handles; } // host build only
+
+  BLECharacteristic* createCharacteristic(const char* uuid, uint32_t properties) { return createCharacteristic(BLEUUID(uuid), properties); }
+  BLECharacteristic* createCharacteristic(BLEUUID uuid, uint32_t properties) {
+    auto characteristic = std::make_unique<BLECharacteristic>(uuid, properties);
+    characteristic->service = this;
+    characteristic->handle = next_host_attribute_handle + 1; // after the declaration
+    next_host_attribute_handle += 2;
+    characteristics.push_back(std::move(characteristic));
+    return characteristics.back().get();
+  }
+  BLECharacteristic* getCharacteristic(const char* uuid) { return getCharacteristic(BLEUUID(uuid)); }
+  BLECharacteristic* getCharacteristic(BLEUUID uuid) {
+    for (auto& characteristic : characteristics) {
+      if (characteristic->getUUID().equals(uuid)) {
+        return characteristic.get();
+      }
+    }
+    return nullptr;
+  }
+  const std::vector<std::unique_ptr<BLECharacteristic>>& get_characteristics() const { return characteristics; } // host build only
+
+  void start() { started = true; }
+  void stop() { started = false; }
+  bool is_started() const { return started; } // host build only
+
+private:
+  BLEUUID uuid;
+  uint16_t num_handles;
+  uint16_t handle;
+  bool started{false};
+  std::vector<std::unique_ptr<BLECharacteristic>> characteristics;
+};
+
+// advertising and security ////////////////////////////////////////////////////////////////////////////////////////////////
+
+class BLEAdvertising {
+public:
+  void addServiceUUID(BLEUUID uuid) {}
+  void start() { advertising = true; }
+  void stop() { advertising = false; }
+  bool is_advertising() const { return advertising; } // host build only
+
+  void setMinInterval(uint16_t interval) {}
+  void setMaxInterval(uint16_t interval) {}
+  void setMinPreferred(uint16_t interval) {}
+  void setMaxPreferred(uint16_t interval) {}
+  void setScanFilter(bool scan_request_accept_list_only, bool connect_accept_list_only) {}
+  void setScanResponse(bool scan_response) {}
+
+private:
+  bool advertising{false};
+};
+
+class BLESecurityCallbacks {
+public:
+  virtual ~BLESecurityCallbacks() = default;
+  virtual uint32_t onPassKeyRequest() = 0;
+  virtual void onPassKeyNotify(uint32_t pass_key) = 0;
+  virtual bool onSecurityRequest() = 0;
+  virtual void onAuthenticationComplete(esp_ble_auth_cmpl_t result) = 0;
+  virtual bool onConfirmPIN(uint32_t pin) = 0;
+};
+
+class BLESecurity {
+public:
+  void setAuthenticationMode(esp_ble_auth_req_t mode) {}
+  void setCapability(esp_ble_io_cap_t capability) {}
+  void setInitEncryptionKey(uint8_t key) {}
+  void setRespEncryptionKey(uint8_t key) {}
+  void setKeySize(uint8_t key_size) {}
+};
+
+// server ////////////////////////////////////////////////////////////////////////////////////////////////
+
+class BLEServerCallbacks {
+public:
+  virtual ~BLEServerCallbacks() = default;
+  virtual void onConnect(BLEServer* server) {}
+  virtual void onConnect(BLEServer* server, esp_ble_gatts_cb_param_t* param) {}
+  virtual void onDisconnect(BLEServer* server) {}
+  virtual void onDisconnect(BLEServer* server, esp_ble_gatts_cb_param_t* param) {}
+  virtual void onMtuChanged(BLEServer* server, esp_ble_gatts_cb_param_t* param) {}
+};
+
+class BLEServer {
+public:
+  BLEService* createService(const char* uuid) { return createService(BLEUUID(uuid)); }
+  BLEService* createService(BLEUUID uuid, uint32_t num_handles = 15, uint8_t inst_id = 0) {
+    services.push_back(std::make_unique<BLEService>(uuid, num_handles));
+    return services.back().get();
+  }
+  BLEService* getServiceByUUID(const char* uuid) { return getServiceByUUID(BLEUUID(uuid)); }
+  BLEService* getServiceByUUID(BLEUUID uuid) {
+    for (auto& service : services) {
+      if (service->getUUID().equals(uuid)) {
+        return service.get();
+      }
+    }
+    return nullptr;
+  }
+
+  void setCallbacks(BLEServerCallbacks* callbacks) { this->callbacks = callbacks; }
+  uint32_t getConnectedCount() const { return connected_count; }
+  esp_gatt_if_t getGattsIf() const { return 3; }
+  void disconnect(uint16_t conn_id) { disconnected_conn_ids.push_back(conn_id); }
+  /// Connections the server has been asked to close (host build only).
+  std::vector<uint16_t> disconnected_conn_ids;
+
+  /// Dispatches an event like the GATT server of the library: it updates the written attribute (before the characteristic callbacks are called) and calls the callbacks.
+  void handle_gatts_event(esp_gatts_cb_event_t event, esp_ble_gatts_cb_param_t* param) {
+    switch (event) {
+      case ESP_GATTS_CONNECT_EVT:
+        ++connected_count;
+        if (callbacks != nullptr) {
+          callbacks->onConnect(this);
+          callbacks->onConnect(this, param);
+        }
+        break;
+      case ESP_GATTS_DISCONNECT_EVT:
+        --connected_count;
+        if (callbacks != nullptr) {
+          callbacks->onDisconnect(this);
+          callbacks->onDisconnect(this, param);
+        }
+        break;
+      case ESP_GATTS_MTU_EVT:
+        if (callbacks != nullptr) {
+          callbacks->onMtuChanged(this, param);
+        }
+        break;
+      case ESP_GATTS_WRITE_EVT:
+        write_attribute(param);
+        break;
+      default:
+        break;
+    }
+  }
+
+private:
+  void write_attribute(esp_ble_gatts_cb_param_t* param) {
+    for (auto& service : services) {
+      for (auto& characteristic : service->get_characteristics()) {
+        if (characteristic->getHandle() == param->write.handle) {
+          characteristic->setValue(param->write.value, param->write.len);
+          if (characteristic->get_callbacks() != nullptr) {
+            characteristic->get_callbacks()->onWrite(characteristic.get(), param);
+          }
+          return;
+        }
+        BLEDescriptor* descriptor = characteristic->get_descriptor_by_handle(param->write.handle);
+        if (descriptor != nullptr) {
+          descriptor->setValue(param->write.value, param->write.len);
+          return;
+        }
+      }
+    }
+  }
+
+  std::vector<std::unique_ptr<BLEService>> services;
+  BLEServerCallbacks* callbacks{nullptr};
+  uint32_t connected_count{0};
+};
+
+// device ////////////////////////////////////////////////////////////////////////////////////////////////
+
+class BLEDevice {
+public:
+  static BLEServer* createServer() {
+    m_pServer = new BLEServer();
+    return m_pServer;
+  }
+  static void init(const std::string& device_name) { initialized = true; }
+  static bool getInitialized() { return initialized; }
+  static BLEAddress getAddress() {
+    const esp_bd_addr_t address = { 0x24, 0x0a, 0xc4, 0x00, 0x00, 0x01 };
+    return BLEAddress(address);
+  }
+  static esp_err_t setMTU(uint16_t mtu) {
+    m_localMTU = mtu;
+    return ESP_OK;
+  }
+  static uint16_t getMTU() { return m_localMTU; }
+  static void setEncryptionLevel(esp_ble_sec_act_t level) {}
+  static void setSecurityCallbacks(BLESecurityCallbacks* callbacks) { m_securityCallbacks = callbacks; }
+  static void setCustomGattsHandler(gatts_event_handler handler) { m_customGattsHandler = handler; }
+  static void setCustomGapHandler(gap_event_handler handler) { m_customGapHandler = handler; }
+  static BLEAdvertising* getAdvertising() {
+    static BLEAdvertising advertising;
+    return &advertising;
+  }
+  static void startAdvertising() { getAdvertising()->start(); }
+
+  /// Passes a GATT server event to the server and then to the custom handler, like the library does in the BLE task (host build only).
+  static void handle_gatts_event(esp_gatts_cb_event_t event, esp_ble_gatts_cb_param_t* param) {
+    if (m_pServer != nullptr) {
+      m_pServer->handle_gatts_event(event, param);
+    }
+    if (m_customGattsHandler != nullptr) {
+      m_customGattsHandler(event, m_pServer != nullptr ? m_pServer->getGattsIf() : ESP_GATT_IF_NONE, param);
+    }
+  }
+
+  static inline BLEServer* m_pServer = nullptr;
+  static inline BLESecurityCallbacks* m_securityCallbacks = nullptr;
+  static inline uint16_t m_localMTU = 23;
+  static inline gatts_event_handler m_customGattsHandler = nullptr;
+  static inline gap_event_handler m_customGapHandler = nullptr;
+
+private:
+  static inline bool initialized = false;
+};
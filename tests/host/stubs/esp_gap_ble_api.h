@@ -0,0 +1,59 @@
+#pragma once
+
+// Host stub of the GAP definitions of ESP-IDF used by the BLE controller (see tests/host/CMakeLists.txt).
+
+#include <cstdint>
+
+#include "esp_bt_defs.h"
+
+typedef uint8_t esp_ble_auth_req_t;
+#define ESP_LE_AUTH_BOND (1 << 0)
+#define ESP_LE_AUTH_REQ_SC_MITM_BOND ((1 << 3) | (1 << 2) | (1 << 0))
+
+typedef uint8_t esp_ble_io_cap_t;
+#define ESP_IO_CAP_OUT 0
+#define ESP_IO_CAP_NONE 3
+
+#define ESP_BLE_ENC_KEY_MASK (1 << 0)
+#define ESP_BLE_ID_KEY_MASK (1 << 1)
+
+typedef enum {
+  ESP_BLE_SEC_ENCRYPT = 1,
+  ESP_BLE_SEC_ENCRYPT_NO_MITM,
+  ESP_BLE_SEC_ENCRYPT_MITM,
+} esp_ble_sec_act_t;
+
+typedef struct {
+  esp_bd_addr_t bd_addr;
+  bool key_present;
+  uint8_t key_type;
+  bool success;
+  uint8_t fail_reason;
+  uint8_t addr_type;
+  uint8_t dev_type;
+  esp_ble_auth_req_t auth_mode;
+} esp_ble_auth_cmpl_t;
+
+typedef enum {
+  ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT = 20,
+  ESP_GAP_BLE_READ_RSSI_COMPLETE_EVT = 23,
+} esp_gap_ble_cb_event_t;
+
+typedef union {
+  struct {
+    esp_bt_status_t status;
+    int8_t rssi;
+    esp_bd_addr_t remote_addr;
+  } read_rssi_cmpl;
+  struct {
+    esp_bt_status_t status;
+    esp_bd_addr_t bda;
+    uint16_t min_int;
+    uint16_t max_int;
+    uint16_t latency;
+    uint16_t conn_int;
+    uint16_t timeout;
+  } update_conn_params;
+} esp_ble_gap_cb_param_t;
+
+typedef void (*esp_gap_ble_cb_t)(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param);
@@ -0,0 +1,22 @@
+#pragma once
+
+// Host stub of the GATT definitions of ESP-IDF used by the BLE controller (see tests/host/CMakeLists.txt).
+
+#include <cstdint>
+
+#include "esp_bt_defs.h"
+
+typedef uint8_t esp_gatt_if_t;
+#define ESP_GATT_IF_NONE 0xff
+
+typedef uint16_t esp_gatt_perm_t;
+#define ESP_GATT_PERM_READ (1 << 0)
+#define ESP_GATT_PERM_READ_ENC_MITM (1 << 2)
+#define ESP_GATT_PERM_WRITE (1 << 4)
+#define ESP_GATT_PERM_WRITE_ENC_MITM (1 << 6)
+
+typedef struct {
+  uint16_t interval;
+  uint16_t latency;
+  uint16_t timeout;
+} esp_gatt_conn_params_t;
@@ -0,0 +1,54 @@
+#pragma once
+
+// Host stub of the GATT server events of ESP-IDF that the BLE controller handles (see tests/host/CMakeLists.txt).
+
+#include <cstdint>
+
+#include "esp_gatt_defs.h"
+
+typedef enum {
+  ESP_GATTS_REG_EVT = 0,
+  ESP_GATTS_READ_EVT = 1,
+  ESP_GATTS_WRITE_EVT = 2,
+  ESP_GATTS_EXEC_WRITE_EVT = 3,
+  ESP_GATTS_MTU_EVT = 4,
+  ESP_GATTS_CONF_EVT = 5,
+  ESP_GATTS_CONNECT_EVT = 14,
+  ESP_GATTS_DISCONNECT_EVT = 15,
+  ESP_GATTS_CONGEST_EVT = 18,
+} esp_gatts_cb_event_t;
+
+typedef union {
+  struct {
+    uint16_t conn_id;
+    uint8_t link_role;
+    esp_bd_addr_t remote_bda;
+    esp_gatt_conn_params_t conn_params;
+  } connect;
+  struct {
+    uint16_t conn_id;
+    esp_bd_addr_t remote_bda;
+    int reason;
+  } disconnect;
+  struct {
+    uint16_t conn_id;
+    uint16_t mtu;
+  } mtu;
+  struct {
+    uint16_t conn_id;
+    bool congested;
+  } congest;
+  struct {
+    uint16_t conn_id;
+    uint32_t trans_id;
+    esp_bd_addr_t bda;
+    uint16_t handle;
+    uint16_t offset;
+    bool need_rsp;
+    bool is_prep;
+    uint16_t len;
+    uint8_t* value;
+  } write;
+} esp_ble_gatts_cb_param_t;
+
+typedef void (*esp_gatts_cb_t)(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t* param);
@@ -0,0 +1,12 @@
+#pragma once
+
+// Host stub of the heap capabilities API of ESP-IDF (see tests/host/CMakeLists.txt), the host reports a fixed heap.
+
+#include <cstddef>
+#include <cstdint>
+
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+inline size_t heap_caps_get_free_size(uint32_t) { return 200 * 1024; }
+inline size_t heap_caps_get_largest_free_block(uint32_t) { return 100 * 1024; }
+inline size_t heap_caps_get_minimum_free_size(uint32_t) { return 150 * 1024; }
@@ -0,0 +1,97 @@
+#pragma once
+
+// Host stub of the ESPHome fan (see tests/host/CMakeLists.txt), a fan applies each call right away.
+
+#include <functional>
+#include <utility>
+
+#include "esphome/core/component.h"
+#include "esphome/core/entity_base.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/optional.h"
+
+namespace esphome {
+namespace fan {
+
+enum class FanDirection { FORWARD = 0, REVERSE = 1 };
+
+class FanTraits {
+public:
+  FanTraits() = default;
+  FanTraits(bool oscillation, bool speed, bool direction, int speed_count)
+      : oscillation(oscillation), speed(speed), direction(direction), speed_count(speed_count) {}
+
+  bool supports_oscillation() const { return oscillation; }
+  bool supports_speed() const { return speed; }
+  bool supports_direction() const { return direction; }
+  int supported_speed_count() const { return speed_count; }
+
+private:
+  bool oscillation{false};
+  bool speed{false};
+  bool direction{false};
+  int speed_count{0};
+};
+
+class Fan;
+
+class FanCall {
+public:
+  explicit FanCall(Fan& fan) : fan(fan) {}
+
+  FanCall& set_state(bool state) { this->state = state; return *this; }
+  FanCall& set_speed(int speed) { this->speed = speed; return *this; }
+  FanCall& set_oscillating(bool oscillating) { this->oscillating = oscillating; return *this; }
+  FanCall& set_direction(FanDirection direction) { this->direction = direction; return *this; }
+  void perform();
+
+  optional<bool> state;
+  optional<int> speed;
+  optional<bool> oscillating;
+  optional<FanDirection> direction;
+
+private:
+  Fan& fan;
+};
+
+class Fan : public EntityBase {
+public:
+  Fan(const std::string& name, const std::string& object_id, const FanTraits& traits) : EntityBase(name, object_id), traits(traits) {}
+
+  bool state{false};
+  bool oscillating{false};
+  int speed{0};
+  FanDirection direction{FanDirection::FORWARD};
+
+  FanTraits get_traits() { return traits; }
+  FanCall turn_on() { return make_call().set_state(true); }
+  FanCall turn_off() { return make_call().set_state(false); }
+  FanCall toggle() { return make_call().set_state(!state); }
+  FanCall make_call() { return FanCall(*this); }
+
+  void add_on_state_callback(std::function<void()>&& callback) { state_callback.add(std::move(callback)); }
+  void publish_state() { state_callback.call(); }
+
+private:
+  FanTraits traits;
+  CallbackManager<void()> state_callback;
+};
+
+inline void FanCall::perform() {
+  if (state.has_value()) {
+    fan.state = *state;
+  }
+  if (speed.has_value()) {
+    fan.speed = *speed;
+  }
+  if (oscillating.has_value()) {
+    fan.oscillating = *oscillating;
+  }
+  if (direction.has_value()) {
+    fan.direction = *direction;
+  }
+  fan.publish_state();
+}
+
+} // namespace fan
+} // namespace esphome
@@ -0,0 +1,43 @@
+#pragma once
+
+// Host stub of the ESPHome sensor (see tests/host/CMakeLists.txt), without filters.
+
+#include <cmath>
+#include <functional>
+#include <string>
+#include <utility>
+
+#include "esphome/core/component.h"
+#include "esphome/core/entity_base.h"
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+namespace sensor {
+
+class Sensor : public EntityBase {
+public:
+  Sensor(const std::string& name, const std::string& object_id, const std::string& unit_of_measurement = "", int8_t accuracy_decimals = 1)
+      : EntityBase(name, object_id), unit_of_measurement(unit_of_measurement), accuracy_decimals(accuracy_decimals) {}
+
+  float state{NAN};
+
+  bool has_state() const { return has_published_state; }
+  std::string get_unit_of_measurement() { return unit_of_measurement; }
+  int8_t get_accuracy_decimals() { return accuracy_decimals; }
+
+  void add_on_state_callback(std::function<void(float)>&& callback) { state_callback.add(std::move(callback)); }
+  void publish_state(float state) {
+    this->state = state;
+    has_published_state = true;
+    state_callback.call(state);
+  }
+
+private:
+  std::string unit_of_measurement;
+  int8_t accuracy_decimals;
+  bool has_published_state{false};
+  CallbackManager<void(float)> state_callback;
+};
+
+} // namespace sensor
+} // namespace esphome
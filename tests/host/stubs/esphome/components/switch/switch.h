@@ -0,0 +1,36 @@
+#pragma once
+
+// Host stub of the ESPHome switch (see tests/host/CMakeLists.txt), an optimistic switch that publishes each written state.
+
+#include <functional>
+#include <utility>
+
+#include "esphome/core/component.h"
+#include "esphome/core/entity_base.h"
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+namespace switch_ {
+
+class Switch : public EntityBase {
+public:
+  using EntityBase::EntityBase;
+
+  bool state{false};
+
+  void turn_on() { publish_state(true); }
+  void turn_off() { publish_state(false); }
+  void toggle() { publish_state(!state); }
+
+  void add_on_state_callback(std::function<void(bool)>&& callback) { state_callback.add(std::move(callback)); }
+  void publish_state(bool state) {
+    this->state = state;
+    state_callback.call(state);
+  }
+
+private:
+  CallbackManager<void(bool)> state_callback;
+};
+
+} // namespace switch_
+} // namespace esphome
@@ -0,0 +1,68 @@
+#pragma once
+
+// Host stub of the ESPHome application (see tests/host/CMakeLists.txt), the tests register the components the controller exposes.
+
+#include <string>
+#include <vector>
+
+#include "component.h"
+#include "defines.h"
+#include "hal.h"
+#include "helpers.h"
+
+#ifdef USE_FAN
+#include "esphome/components/fan/fan.h"
+#endif
+#ifdef USE_SENSOR
+#include "esphome/components/sensor/sensor.h"
+#endif
+#ifdef USE_SWITCH
+#include "esphome/components/switch/switch.h"
+#endif
+
+namespace esphome {
+
+class Scheduler {
+public:
+  void set_timeout(Component* component, const std::string& name, uint32_t timeout, std::function<void()>&& f) {}
+};
+
+class Application {
+public:
+  const std::string& get_name() const { return name; }
+  std::string get_compilation_time() const { return "Jan  1 2024, 12:00:00"; }
+  void safe_reboot() { ++reboots; }
+  uint32_t get_reboots() const { return reboots; } // host build only
+
+#ifdef USE_FAN
+  void register_fan(fan::Fan* fan) { fans.push_back(fan); }
+  const std::vector<fan::Fan*>& get_fans() const { return fans; }
+#endif
+#ifdef USE_SENSOR
+  void register_sensor(sensor::Sensor* sensor) { sensors.push_back(sensor); }
+  const std::vector<sensor::Sensor*>& get_sensors() const { return sensors; }
+#endif
+#ifdef USE_SWITCH
+  void register_switch(switch_::Switch* a_switch) { switches.push_back(a_switch); }
+  const std::vector<switch_::Switch*>& get_switches() const { return switches; }
+#endif
+
+  Scheduler scheduler;
+
+private:
+  std::string name{"host"};
+  uint32_t reboots{0};
+#ifdef USE_FAN
+  std::vector<fan::Fan*> fans;
+#endif
+#ifdef USE_SENSOR
+  std::vector<sensor::Sensor*> sensors;
+#endif
+#ifdef USE_SWITCH
+  std::vector<switch_::Switch*> switches;
+#endif
+};
+
+inline Application App;
+
+} // namespace esphome
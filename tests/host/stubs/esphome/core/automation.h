@@ -0,0 +1,29 @@
+#pragma once
+
+// Host stub of the ESPHome automations (see tests/host/CMakeLists.txt), a trigger runs a function instead of the actions of an automation.
+
+#include <functional>
+#include <utility>
+
+namespace esphome {
+
+template <typename... Ts> class Trigger {
+public:
+  void trigger(Ts... x) {
+    if (automation) {
+      automation(x...);
+    }
+  }
+  void set_automation(std::function<void(Ts...)>&& automation) { this->automation = std::move(automation); } // host build only
+
+private:
+  std::function<void(Ts...)> automation;
+};
+
+template <typename... Ts> class Action {
+public:
+  virtual ~Action() = default;
+  virtual void play(Ts... x) = 0;
+};
+
+} // namespace esphome
@@ -0,0 +1,47 @@
+#pragma once
+
+// Host stub of the ESPHome component (see tests/host/CMakeLists.txt), the host build has no scheduler, so timeouts and intervals never fire.
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "log.h"
+
+namespace esphome {
+
+namespace setup_priority {
+inline const float BLUETOOTH = 350.0f;
+inline const float AFTER_BLUETOOTH = 300.0f;
+inline const float PROCESSOR = 400.0f;
+inline const float DATA = 600.0f;
+} // namespace setup_priority
+
+class Component {
+public:
+  virtual ~Component() = default;
+  virtual void setup() {}
+  virtual void loop() {}
+  virtual void dump_config() {}
+  virtual float get_setup_priority() const { return setup_priority::DATA; }
+
+  bool is_failed() const { return failed; }
+  void mark_failed() { failed = true; }
+
+protected:
+  void set_timeout(const std::string& name, uint32_t timeout, std::function<void()>&& f) {}
+  void set_interval(const std::string& name, uint32_t interval, std::function<void()>&& f) {}
+  bool cancel_timeout(const std::string& name) { return false; }
+
+private:
+  bool failed{false};
+};
+
+class PollingComponent : public Component {
+public:
+  PollingComponent() = default;
+  PollingComponent(uint32_t update_interval) {}
+  virtual void update() = 0;
+};
+
+} // namespace esphome
@@ -0,0 +1,13 @@
+#pragma once
+
+// Host stub of the ESPHome controller (see tests/host/CMakeLists.txt).
+
+#include "component.h"
+#include "defines.h"
+#include "entity_base.h"
+
+namespace esphome {
+
+class Controller {};
+
+} // namespace esphome
@@ -0,0 +1,12 @@
+#pragma once
+
+// Host stub of the defines generated by ESPHome (see tests/host/CMakeLists.txt), for the configuration that the tests set up (see host_tests.cpp).
+
+#define PACKED __attribute__((packed))
+
+#define USE_FAN
+#define USE_SENSOR
+#define USE_SWITCH
+
+#define BLE_CONTROLLER_NUM_CHARACTERISTICS 3
+#define BLE_CONTROLLER_NUM_CUSTOM_COMMANDS 1
@@ -0,0 +1,24 @@
+#pragma once
+
+// Host stub of the ESPHome entity base (see tests/host/CMakeLists.txt).
+
+#include <cstdint>
+#include <string>
+
+namespace esphome {
+
+class EntityBase {
+public:
+  EntityBase() = default;
+  EntityBase(const std::string& name, const std::string& object_id) : name(name), object_id(object_id) {}
+
+  const std::string& get_name() const { return name; }
+  const std::string& get_object_id() const { return object_id; }
+  bool is_internal() const { return false; }
+
+private:
+  std::string name;
+  std::string object_id;
+};
+
+} // namespace esphome
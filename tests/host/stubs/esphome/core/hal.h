@@ -0,0 +1,19 @@
+#pragma once
+
+// Host stub of the ESPHome hardware abstraction (see tests/host/CMakeLists.txt), the clocks run from the start of the process.
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+namespace esphome {
+
+inline std::chrono::steady_clock::time_point host_start_time = std::chrono::steady_clock::now();
+
+inline uint32_t micros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - host_start_time).count();
+}
+inline uint32_t millis() { return micros() / 1000; }
+inline void delay(uint32_t ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+
+} // namespace esphome
@@ -0,0 +1,90 @@
+#pragma once
+
+// Host stub of the ESPHome helpers used by the BLE controller (see tests/host/CMakeLists.txt).
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "optional.h"
+
+namespace esphome {
+
+using std::to_string;
+
+template <typename T>
+constexpr const T& clamp(const T& value, const T& min, const T& max) {
+  return value < min ? min : (max < value ? max : value);
+}
+
+/// There is no PSRAM on the host, so this allocates from the heap.
+template <class T>
+class ExternalRAMAllocator {
+public:
+  using value_type = T;
+
+  enum Flags {
+    NONE = 0,
+    REFUSE_INTERNAL = 1 << 0,
+    ALLOW_FAILURE = 1 << 1,
+  };
+
+  ExternalRAMAllocator() = default;
+  ExternalRAMAllocator(Flags flags) : flags(flags) {}
+
+  T* allocate(size_t n) { return static_cast<T*>(malloc(n * sizeof(T))); }
+  void deallocate(T* p, size_t) { free(p); }
+
+private:
+  Flags flags{Flags::ALLOW_FAILURE};
+};
+
+inline uint32_t fnv1_hash(const std::string& text) {
+  uint32_t hash = 2166136261UL;
+  for (char c : text) {
+    hash *= 16777619UL;
+    hash ^= c;
+  }
+  return hash;
+}
+
+template <typename T> optional<T> parse_number(const std::string& text) {
+  char* end = nullptr;
+  const long long value = strtoll(text.c_str(), &end, 10);
+  if (text.empty() || end != text.c_str() + text.length()) {
+    return {};
+  }
+  return static_cast<T>(value);
+}
+
+template <typename... Ts> class CallbackManager;
+
+template <typename... Ts> class CallbackManager<void(Ts...)> {
+public:
+  void add(std::function<void(Ts...)>&& callback) { callbacks.push_back(std::move(callback)); }
+  void call(Ts... args) {
+    for (auto& callback : callbacks) {
+      callback(args...);
+    }
+  }
+
+private:
+  std::vector<std::function<void(Ts...)>> callbacks;
+};
+
+/// The host build has no loop delay, so this only tracks whether a high frequency loop has been requested.
+class HighFrequencyLoopRequester {
+public:
+  void start() { started = true; }
+  void stop() { started = false; }
+  bool is_started() const { return started; } // host build only
+
+private:
+  bool started{false};
+};
+
+} // namespace esphome
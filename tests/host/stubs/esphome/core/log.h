@@ -0,0 +1,17 @@
+#pragma once
+
+// Host stub of the ESPHome logger (see tests/host/CMakeLists.txt), log messages are discarded
+// (after the compiler has checked their format).
+
+namespace esphome {
+
+inline void __attribute__((format(printf, 2, 3))) discard_log(const char* tag, const char* format, ...) {}
+
+} // namespace esphome
+
+#define ESP_LOGE(tag, ...) ::esphome::discard_log(tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) ::esphome::discard_log(tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) ::esphome::discard_log(tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...) ::esphome::discard_log(tag, __VA_ARGS__)
+#define ESP_LOGV(tag, ...) ::esphome::discard_log(tag, __VA_ARGS__)
+#define ESP_LOGCONFIG(tag, ...) ::esphome::discard_log(tag, __VA_ARGS__)
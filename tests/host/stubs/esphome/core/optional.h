@@ -0,0 +1,12 @@
+#pragma once
+
+// Host stub of the optional of ESPHome (see tests/host/CMakeLists.txt), which behaves like the one of the standard library.
+
+#include <optional>
+
+namespace esphome {
+
+template <typename T> using optional = std::optional<T>;
+using std::nullopt;
+
+} // namespace esphome
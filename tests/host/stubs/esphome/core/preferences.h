@@ -0,0 +1,47 @@
+#pragma once
+
+// Host stub of the ESPHome preferences (see tests/host/CMakeLists.txt), they are kept in memory only.
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <vector>
+
+namespace esphome {
+
+class ESPPreferenceObject {
+public:
+  ESPPreferenceObject() = default;
+  ESPPreferenceObject(std::vector<uint8_t>* data) : data(data) {}
+
+  template <typename T> bool save(const T* value) {
+    if (data == nullptr) {
+      return false;
+    }
+    data->assign(reinterpret_cast<const uint8_t*>(value), reinterpret_cast<const uint8_t*>(value) + sizeof(T));
+    return true;
+  }
+  template <typename T> bool load(T* value) {
+    if (data == nullptr || data->size() != sizeof(T)) {
+      return false;
+    }
+    memcpy(value, data->data(), sizeof(T));
+    return true;
+  }
+
+private:
+  std::vector<uint8_t>* data{nullptr};
+};
+
+class ESPPreferences {
+public:
+  template <typename T> ESPPreferenceObject make_preference(uint32_t type, bool in_flash = false) { return ESPPreferenceObject(&preferences[type]); }
+
+private:
+  std::map<uint32_t, std::vector<uint8_t>> preferences;
+};
+
+inline ESPPreferences host_preferences;
+inline ESPPreferences* global_preferences = &host_preferences;
+
+} // namespace esphome
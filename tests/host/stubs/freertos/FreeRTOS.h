@@ -0,0 +1,30 @@
+#pragma once
+
+// Host stub of the Free RTOS types used by the BLE controller (see tests/host/CMakeLists.txt).
+
+#include <cstdint>
+#include <mutex>
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define pdTRUE ((BaseType_t) 1)
+#define pdFALSE ((BaseType_t) 0)
+#define pdPASS (pdTRUE)
+#define pdFAIL (pdFALSE)
+#define errQUEUE_FULL ((BaseType_t) 0)
+#define errQUEUE_EMPTY ((BaseType_t) 0)
+
+#define portMAX_DELAY ((TickType_t) 0xffffffffUL)
+#define portTICK_PERIOD_MS ((TickType_t) 1)
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms))
+
+// the critical sections of the BLE controller are short, a mutex stands in for the spinlock
+struct portMUX_TYPE {
+  std::mutex mutex;
+};
+
+#define portMUX_INITIALIZER_UNLOCKED {}
+#define portENTER_CRITICAL(mux) ((mux)->mutex.lock())
+#define portEXIT_CRITICAL(mux) ((mux)->mutex.unlock())
@@ -0,0 +1,68 @@
+#pragma once
+
+// Host stub of the statically allocated Free RTOS queues, implemented with a mutex and a condition variable (see tests/host/CMakeLists.txt).
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+
+#include "FreeRTOS.h"
+
+struct StaticQueue_t {
+  std::mutex mutex;
+  std::condition_variable not_empty;
+  uint8_t* storage{nullptr};
+  UBaseType_t length{0};
+  UBaseType_t item_size{0};
+  UBaseType_t first{0};
+  UBaseType_t count{0};
+};
+
+typedef StaticQueue_t* QueueHandle_t;
+
+inline QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t item_size, uint8_t* storage, StaticQueue_t* queue) {
+  queue->storage = storage;
+  queue->length = length;
+  queue->item_size = item_size;
+  queue->first = 0;
+  queue->count = 0;
+  return queue;
+}
+
+/// Items are always appended without waiting, the BLE controller never blocks on a full queue.
+inline BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t) {
+  {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (queue->count == queue->length) {
+      return errQUEUE_FULL;
+    }
+    memcpy(queue->storage + ((queue->first + queue->count) % queue->length) * queue->item_size, item, queue->item_size);
+    ++queue->count;
+  }
+  queue->not_empty.notify_one();
+  return pdPASS;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks_to_wait) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  const auto has_items = [queue]() { return queue->count > 0; };
+  if (ticks_to_wait == 0) {
+    if (!has_items()) {
+      return errQUEUE_EMPTY;
+    }
+  } else if (ticks_to_wait == portMAX_DELAY) {
+    queue->not_empty.wait(lock, has_items);
+  } else if (!queue->not_empty.wait_for(lock, std::chrono::milliseconds(ticks_to_wait * portTICK_PERIOD_MS), has_items)) {
+    return errQUEUE_EMPTY;
+  }
+  memcpy(item, queue->storage + queue->first * queue->item_size, queue->item_size);
+  queue->first = (queue->first + 1) % queue->length;
+  --queue->count;
+  return pdPASS;
+}
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  return queue->count;
+}